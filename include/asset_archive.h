@@ -0,0 +1,318 @@
+#ifndef ASSET_ARCHIVE_H
+#define ASSET_ARCHIVE_H
+
+#include "mapped_file.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Packed asset archive (.pak): every shader, texture and model in one file,
+// mapped once at startup. Entries are stored raw or zlib-compressed; stored
+// entries are handed out as pointers into the mapping, without a copy.
+//
+// File layout (offsets from the start of the file):
+//   AssetArchiveHeader
+//   AssetArchiveEntry[entryCount]   sorted by pathHash
+//   names                           entry paths, not terminated
+//   entry data                      16-byte aligned, in packing order
+//
+// Entry paths are relative to the working directory the app runs from, as
+// normalized by normalizeAssetPath().
+
+const uint32_t ASSET_ARCHIVE_MAGIC = 0x4b415041; // "APAK"
+const uint32_t ASSET_ARCHIVE_VERSION = 1;
+const char ASSET_ARCHIVE_DEFAULT[] = "assets.pak";
+
+enum AssetCompression { ASSET_STORED = 0, ASSET_DEFLATE = 1 };
+// Most bytes deflate can produce per compressed byte.
+const uint64_t ASSET_DEFLATE_MAX_EXPANSION = 1032;
+
+struct AssetArchiveHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t entryCount;
+  uint32_t namesBytes;
+};
+
+struct AssetArchiveEntry {
+  uint64_t pathHash;
+  uint32_t nameOffset; // into the name table
+  uint32_t nameLength;
+  uint64_t offset;
+  uint64_t storedBytes;
+  uint64_t size; // uncompressed
+  uint32_t compression;
+  uint32_t crc; // crc32 of the uncompressed data
+};
+
+// FNV-1a; only used to order and look up entries, names are compared too.
+inline uint64_t assetPathHash(const char *path, size_t length) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < length; i++) {
+    hash ^= (unsigned char)path[i];
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+// Forward slashes, no "." segments, "dir/.." folded away. Assimp builds
+// material and texture paths by joining directories, so the same file is
+// often asked for under several spellings.
+inline string normalizeAssetPath(const string &path) {
+  vector<string> parts;
+  size_t start = 0;
+  bool absolute = !path.empty() && (path[0] == '/' || path[0] == '\\');
+  while (start <= path.size()) {
+    size_t end = path.find_first_of("/\\", start);
+    if (end == string::npos)
+      end = path.size();
+    string part = path.substr(start, end - start);
+    if (part == "..") {
+      if (!parts.empty() && parts.back() != "..")
+        parts.pop_back();
+      else if (!absolute)
+        parts.push_back(part);
+    } else if (!part.empty() && part != ".") {
+      parts.push_back(part);
+    }
+    start = end + 1;
+  }
+
+  string normalized = absolute ? "/" : "";
+  for (size_t i = 0; i < parts.size(); i++) {
+    if (i)
+      normalized += '/';
+    normalized += parts[i];
+  }
+  return normalized;
+}
+
+// Contents of one asset. The bytes stay valid as long as any copy of this
+// object is alive; owner holds whatever they point into.
+struct AssetData {
+  const unsigned char *bytes;
+  size_t size;
+  shared_ptr<const void> owner;
+
+  AssetData() : bytes(nullptr), size(0) {}
+  bool valid() const { return owner != nullptr; }
+};
+
+class AssetArchive : public enable_shared_from_this<AssetArchive> {
+public:
+  AssetArchive() : entries(nullptr), names(nullptr), entryCount(0) {}
+
+  AssetArchive(const AssetArchive &) = delete;
+  AssetArchive &operator=(const AssetArchive &) = delete;
+
+  // Maps the archive and validates its table; the data itself is only
+  // touched when an entry is read.
+  bool open(const string &path) {
+    archivePath = path;
+    entries = nullptr;
+    entryCount = 0;
+    if (!file.open(path, MADV_RANDOM)) {
+      cout << "ERROR::ASSET_ARCHIVE::CANNOT_OPEN " << path << endl;
+      return false;
+    }
+
+    AssetArchiveHeader header;
+    if (file.length() < sizeof(header))
+      return invalid();
+    memcpy(&header, file.bytes(), sizeof(header));
+    size_t tableEnd = sizeof(header) +
+                      (size_t)header.entryCount * sizeof(AssetArchiveEntry);
+    if (header.magic != ASSET_ARCHIVE_MAGIC ||
+        header.version != ASSET_ARCHIVE_VERSION || tableEnd > file.length() ||
+        header.namesBytes > file.length() - tableEnd)
+      return invalid();
+
+    const AssetArchiveEntry *table =
+        (const AssetArchiveEntry *)(file.bytes() + sizeof(header));
+    // read() allocates an entry's size before its crc can be checked, so
+    // a compressed size must be one its stored bytes can inflate to
+    for (uint32_t i = 0; i < header.entryCount; i++) {
+      const AssetArchiveEntry &e = table[i];
+      if ((uint64_t)e.nameOffset + e.nameLength > header.namesBytes ||
+          e.offset > file.length() ||
+          e.storedBytes > file.length() - e.offset ||
+          e.compression > ASSET_DEFLATE ||
+          (e.compression == ASSET_STORED && e.storedBytes != e.size) ||
+          e.size > e.storedBytes * ASSET_DEFLATE_MAX_EXPANSION ||
+          (i && e.pathHash < table[i - 1].pathHash))
+        return invalid();
+    }
+    // the table is what every lookup touches; fault it in up front
+    madvise((void *)file.bytes(), tableEnd + header.namesBytes,
+            MADV_WILLNEED);
+
+    entries = table;
+    entryCount = header.entryCount;
+    names = (const char *)file.bytes() + tableEnd;
+    return true;
+  }
+
+  const string &path() const { return archivePath; }
+  uint32_t size() const { return entryCount; }
+  const AssetArchiveEntry &entry(uint32_t i) const { return entries[i]; }
+  string name(const AssetArchiveEntry &e) const {
+    return string(names + e.nameOffset, e.nameLength);
+  }
+
+  // Entry for a normalized path, or nullptr.
+  const AssetArchiveEntry *find(const string &path) const {
+    uint64_t hash = assetPathHash(path.data(), path.size());
+    const AssetArchiveEntry *end = entries + entryCount;
+    const AssetArchiveEntry *it = lower_bound(
+        entries, end, hash,
+        [](const AssetArchiveEntry &e, uint64_t h) { return e.pathHash < h; });
+    for (; it != end && it->pathHash == hash; ++it)
+      if (it->nameLength == path.size() &&
+          !memcmp(names + it->nameOffset, path.data(), path.size()))
+        return it;
+    return nullptr;
+  }
+
+  // Stored entries point into the mapping; compressed ones are inflated
+  // into a buffer of their own and checked against their crc.
+  AssetData read(const AssetArchiveEntry &e) const {
+    AssetData data;
+    const unsigned char *stored = file.bytes() + e.offset;
+    if (e.compression == ASSET_STORED) {
+      data.bytes = stored;
+      data.size = (size_t)e.size;
+      data.owner = shared_from_this();
+      return data;
+    }
+
+    shared_ptr<vector<unsigned char> > buffer =
+        make_shared<vector<unsigned char> >((size_t)e.size);
+    uLongf bytes = (uLongf)e.size;
+    if (uncompress(buffer->data(), &bytes, stored, (uLong)e.storedBytes) !=
+            Z_OK ||
+        bytes != e.size ||
+        crc32(0, buffer->data(), (uInt)e.size) != e.crc) {
+      cout << "ERROR::ASSET_ARCHIVE::CORRUPT_ENTRY " << name(e) << " in "
+           << archivePath << endl;
+      return data;
+    }
+    data.bytes = buffer->data();
+    data.size = buffer->size();
+    data.owner = buffer;
+    return data;
+  }
+
+private:
+  string archivePath;
+  MappedFile file;
+  const AssetArchiveEntry *entries;
+  const char *names;
+  uint32_t entryCount;
+
+  bool invalid() {
+    cout << "ERROR::ASSET_ARCHIVE::INVALID_ARCHIVE " << archivePath << endl;
+    file.close();
+    return false;
+  }
+};
+
+// Where every asset read goes: mounted archives first, most recently
+// mounted first, then loose files on disk (mapped, via mappedFiles()).
+// Safe to use from any thread.
+class AssetFileSystem {
+public:
+  bool mount(const string &archivePath) {
+    shared_ptr<AssetArchive> archive = make_shared<AssetArchive>();
+    if (!archive->open(archivePath))
+      return false;
+    lock_guard<mutex> lock(mountMutex);
+    archives.insert(archives.begin(), archive);
+    return true;
+  }
+
+  void unmountAll() {
+    lock_guard<mutex> lock(mountMutex);
+    archives.clear();
+  }
+
+  size_t mountedCount() {
+    lock_guard<mutex> lock(mountMutex);
+    return archives.size();
+  }
+
+  AssetData read(const string &path) {
+    string name = normalizeAssetPath(path);
+    shared_ptr<AssetArchive> archive;
+    const AssetArchiveEntry *e = find(name, archive);
+    if (e)
+      return archive->read(*e);
+
+    AssetData data;
+    shared_ptr<MappedFile> file = mappedFiles().open(path);
+    if (file) {
+      data.bytes = file->bytes();
+      data.size = file->length();
+      data.owner = file;
+    }
+    return data;
+  }
+
+  bool exists(const string &path) {
+    if (archived(path))
+      return true;
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+  }
+
+  // True when path is served from an archive rather than from disk.
+  bool archived(const string &path) {
+    shared_ptr<AssetArchive> archive;
+    return find(normalizeAssetPath(path), archive) != nullptr;
+  }
+
+  // Size and crc32 of an archived file, which identify its content without
+  // reading it. False when path is not in a mounted archive.
+  bool archivedChecksum(const string &path, uint64_t &size, uint32_t &crc) {
+    shared_ptr<AssetArchive> archive;
+    const AssetArchiveEntry *e = find(normalizeAssetPath(path), archive);
+    if (!e)
+      return false;
+    size = e->size;
+    crc = e->crc;
+    return true;
+  }
+
+private:
+  mutex mountMutex;
+  vector<shared_ptr<AssetArchive> > archives;
+
+  const AssetArchiveEntry *find(const string &name,
+                                shared_ptr<AssetArchive> &archive) {
+    lock_guard<mutex> lock(mountMutex);
+    for (size_t i = 0; i < archives.size(); i++) {
+      const AssetArchiveEntry *e = archives[i]->find(name);
+      if (e) {
+        archive = archives[i];
+        return e;
+      }
+    }
+    return nullptr;
+  }
+};
+
+inline AssetFileSystem &assetFiles() {
+  static AssetFileSystem files;
+  return files;
+}
+
+#endif
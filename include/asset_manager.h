@@ -0,0 +1,337 @@
+#ifndef ASSET_MANAGER_H
+#define ASSET_MANAGER_H
+
+#include "model.h"
+#include "mpsc_queue.h"
+#include "thread_pool.h"
+
+#include <glad/glad.h>
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Upload granularity; one slice is the smallest unit of per-frame work.
+const size_t ASSET_UPLOAD_SLICE_BYTES = 1 << 20;
+
+// A cubemap texture that may still be loading.
+struct Cubemap {
+  GLuint texture;
+  size_t bytes; // estimated VRAM footprint once uploaded
+  bool loaded;
+
+  Cubemap() : texture(0), bytes(0), loaded(false) {}
+  bool ready() const { return loaded; }
+};
+
+// Decoded pixels of one image, owned by stb_image.
+struct ImageData {
+  unsigned char *pixels;
+  int width, height, channels;
+
+  ImageData() : pixels(nullptr), width(0), height(0), channels(0) {}
+};
+
+// Background asset loading. Meshes and images are decoded on the thread pool,
+// handed back through a lock-free queue and uploaded on the render thread by
+// update(), which stops once the per-frame time budget is used up. Callers get
+// a handle immediately and draw a placeholder until it reports ready(); a
+// model whose import failed reports failed() instead and keeps the
+// placeholder.
+class AssetManager {
+public:
+  AssetManager(ThreadPool &pool, double uploadBudgetMs = 2.0)
+      : pool(pool), uploadBudgetMs(uploadBudgetMs), requested(0),
+        completed(0), pendingJobs(0), floatGeometry(VERTEX_FORMAT_FLOAT),
+        packedGeometry(VERTEX_FORMAT_PACKED) {
+    createPlaceholders();
+  }
+
+  // Waits for in-flight decodes, which push into our queue, and drops
+  // unfinished uploads while the arenas they free into still exist.
+  ~AssetManager() {
+    while (pendingJobs > 0)
+      this_thread::yield();
+    Result r;
+    while (results.pop(r))
+      ;
+    uploads.clear();
+  }
+
+  AssetManager(const AssetManager &) = delete;
+  AssetManager &operator=(const AssetManager &) = delete;
+
+  shared_ptr<Model> requestModel(const string &path,
+                                 VertexFormat format = VERTEX_FORMAT_FLOAT) {
+    shared_ptr<Model> model = make_shared<Model>();
+    requested++;
+
+    MPSCQueue<Result> *queue = &results;
+    atomic<int> *pending = &pendingJobs;
+    pending->fetch_add(1);
+    ThreadPool *workers = &pool;
+    pool.submit([queue, pending, workers, model, path, format]() {
+      Result r;
+      r.model = model;
+      r.modelData =
+          make_shared<ModelData>(Model::decode(path, format, true, workers));
+      queue->push(r);
+      pending->fetch_sub(1);
+    });
+    return model;
+  }
+
+  // Decodes the six faces in parallel, straight from the mapped file or
+  // archive entry; the worker finishing the last face queues the upload.
+  shared_ptr<Cubemap> requestCubemap(const char *faces[6]) {
+    shared_ptr<Cubemap> cubemap = make_shared<Cubemap>();
+    shared_ptr<CubemapDecode> decode = make_shared<CubemapDecode>();
+    requested++;
+
+    MPSCQueue<Result> *queue = &results;
+    atomic<int> *pending = &pendingJobs;
+    for (int i = 0; i < 6; i++) {
+      string path = faces[i];
+      pending->fetch_add(1);
+      pool.submit([queue, pending, cubemap, decode, path, i]() {
+        ImageData &img = decode->faces[i];
+        AssetData file = assetFiles().read(path);
+        if (file.valid())
+          img.pixels = stbi_load_from_memory(file.bytes, (int)file.size,
+                                             &img.width, &img.height,
+                                             &img.channels, 0);
+        if (!img.pixels)
+          cout << "Cubemap texture failed to load at path: " << path << endl;
+
+        if (--decode->remaining == 0) {
+          Result r;
+          r.cubemap = cubemap;
+          r.cubemapData = decode;
+          queue->push(r);
+        }
+        pending->fetch_sub(1);
+      });
+    }
+    return cubemap;
+  }
+
+  // Render thread, once per frame. Uploads finished decodes until the time
+  // budget runs out; at least one slice is uploaded so loading always
+  // progresses.
+  void update() {
+    Result r;
+    while (results.pop(r))
+      uploads.push_back(Upload(r));
+
+    Clock::time_point deadline =
+        Clock::now() + chrono::microseconds((long long)(uploadBudgetMs * 1000));
+    bool first = true;
+    while (!uploads.empty() && (first || Clock::now() < deadline)) {
+      first = false;
+      if (step(uploads.front())) {
+        uploads.pop_front();
+        completed++;
+      }
+    }
+  }
+
+  Model &placeholderModel() { return placeholder; }
+
+  // Shared vertex/index storage for every model of that format.
+  GeometryArena &geometry(VertexFormat format) {
+    return format == VERTEX_FORMAT_PACKED ? packedGeometry : floatGeometry;
+  }
+  GLuint placeholderCubemap() const { return placeholderTexture; }
+
+  int requestedCount() const { return requested; }
+  int completedCount() const { return completed; }
+  bool busy() const { return completed < requested; }
+
+private:
+  typedef chrono::steady_clock Clock;
+
+  struct CubemapDecode {
+    ImageData faces[6];
+    atomic<int> remaining;
+
+    CubemapDecode() : remaining(6) {}
+    ~CubemapDecode() {
+      for (int i = 0; i < 6; i++)
+        if (faces[i].pixels)
+          stbi_image_free(faces[i].pixels);
+    }
+  };
+
+  struct Result {
+    shared_ptr<Model> model;
+    shared_ptr<ModelData> modelData;
+    shared_ptr<Cubemap> cubemap;
+    shared_ptr<CubemapDecode> cubemapData;
+  };
+
+  // Progress of one asset through its upload.
+  struct Upload {
+    Result result;
+    size_t item; // mesh or face index
+    size_t vertexBytesDone;
+    size_t indexBytesDone;
+
+    explicit Upload(const Result &r)
+        : result(r), item(0), vertexBytesDone(0), indexBytesDone(0) {}
+  };
+
+  ThreadPool &pool;
+  double uploadBudgetMs;
+  MPSCQueue<Result> results;
+  deque<Upload> uploads;
+  int requested;
+  int completed;
+  atomic<int> pendingJobs; // submitted to the pool and not yet finished
+
+  // declared before placeholder, which frees into them
+  GeometryArena floatGeometry;
+  GeometryArena packedGeometry;
+  Model placeholder;
+  GLuint placeholderTexture;
+
+  // Performs one slice of work; returns true when the asset is complete.
+  bool step(Upload &u) {
+    if (u.result.model)
+      return stepModel(u);
+    return stepCubemap(u);
+  }
+
+  bool stepModel(Upload &u) {
+    ModelData &data = *u.result.modelData;
+    Model &model = *u.result.model;
+
+    if (!data.ok || data.meshes.empty()) {
+      cout << "ERROR::ASSET_MANAGER::MODEL_LOAD_FAILED " << data.path << endl;
+      model.markFailed();
+      return true;
+    }
+    if (u.item >= data.meshes.size()) {
+      model.markReady();
+      return true;
+    }
+
+    MeshData &m = data.meshes[u.item];
+    if (u.item == 0 && u.vertexBytesDone == 0 && u.indexBytesDone == 0)
+      model.reserveMeshes(data.meshes.size());
+    if (u.vertexBytesDone == 0 && u.indexBytesDone == 0)
+      model.addMesh(m.allocate(geometry(m.format)));
+    const Mesh &mesh = model.lastMesh();
+
+    size_t vertexBytes = m.vertexCount * m.vertexStride();
+    size_t indexBytes = m.indexCount * sizeof(unsigned int);
+
+    // The handle is resolved on every slice because other allocations may
+    // grow or compact the arena between frames.
+    if (u.vertexBytesDone < vertexBytes) {
+      size_t n = min(ASSET_UPLOAD_SLICE_BYTES, vertexBytes - u.vertexBytesDone);
+      mesh.arena->uploadVertices(mesh.geometry, u.vertexBytesDone, n,
+                                 (const char *)m.uploadData() +
+                                     u.vertexBytesDone);
+      u.vertexBytesDone += n;
+    } else if (u.indexBytesDone < indexBytes) {
+      size_t n = min(ASSET_UPLOAD_SLICE_BYTES, indexBytes - u.indexBytesDone);
+      mesh.arena->uploadIndices(mesh.geometry, u.indexBytesDone, n,
+                                (const char *)m.indexData() +
+                                    u.indexBytesDone);
+      u.indexBytesDone += n;
+    }
+
+    if (u.vertexBytesDone >= vertexBytes && u.indexBytesDone >= indexBytes) {
+      // the arrays are on the GPU now; free them before the next mesh
+      m.releaseArrays();
+      u.item++;
+      u.vertexBytesDone = 0;
+      u.indexBytesDone = 0;
+    }
+    return false;
+  }
+
+  bool stepCubemap(Upload &u) {
+    Cubemap &cubemap = *u.result.cubemap;
+    if (cubemap.texture == 0)
+      glGenTextures(1, &cubemap.texture);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap.texture);
+
+    if (u.item < 6) {
+      const ImageData &img = u.result.cubemapData->faces[u.item];
+      uploadCubemapFace((GLuint)u.item, img);
+      // drivers pad RGB texels to four bytes
+      cubemap.bytes +=
+          (size_t)img.width * img.height * (img.channels == 1 ? 1 : 4);
+      u.item++;
+      return false;
+    }
+
+    setCubemapParameters();
+    cubemap.loaded = true;
+    u.result.cubemapData.reset();
+    return true;
+  }
+
+  static void uploadCubemapFace(GLuint face, const ImageData &img) {
+    if (!img.pixels)
+      return;
+
+    GLenum format = GL_RGB;
+    if (img.channels == 4)
+      format = GL_RGBA;
+    else if (img.channels == 1)
+      format = GL_RED;
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, format, img.width,
+                 img.height, 0, format, GL_UNSIGNED_BYTE, img.pixels);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  }
+
+  static void setCubemapParameters() {
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+  }
+
+  // A unit octahedron stands in for meshes, a flat grey cube for skyboxes.
+  void createPlaceholders() {
+    vector<Vertex> vertices;
+    const glm::vec3 axes[6] = {glm::vec3(1, 0, 0),  glm::vec3(-1, 0, 0),
+                               glm::vec3(0, 1, 0),  glm::vec3(0, -1, 0),
+                               glm::vec3(0, 0, 1),  glm::vec3(0, 0, -1)};
+    for (int i = 0; i < 6; i++) {
+      Vertex v;
+      v.Position = axes[i];
+      v.Normal = axes[i];
+      vertices.push_back(v);
+    }
+    const unsigned int faces[24] = {0, 2, 4, 4, 2, 1, 1, 2, 5, 5, 2, 0,
+                                    4, 3, 0, 1, 3, 4, 5, 3, 1, 0, 3, 5};
+    vector<unsigned int> indices(faces, faces + 24);
+    placeholder.addMesh(Mesh(floatGeometry, move(vertices), move(indices)));
+    placeholder.markReady();
+
+    const unsigned char grey[3] = {26, 26, 38};
+    glGenTextures(1, &placeholderTexture);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, placeholderTexture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (GLuint i = 0; i < 6; i++)
+      glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, 1, 1, 0,
+                   GL_RGB, GL_UNSIGNED_BYTE, grey);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    setCubemapParameters();
+  }
+};
+
+#endif
@@ -0,0 +1,141 @@
+#ifndef CUBEMAP_CACHE_H
+#define CUBEMAP_CACHE_H
+
+#include "asset_manager.h"
+#include "resource_registry.h"
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+
+using namespace std;
+
+// Keeps decoded skyboxes resident on the GPU, keyed by face set, and evicts
+// the least recently used ones once the VRAM budget is exceeded. Textures
+// come from the resource registry, which frees them once evicted here and
+// unused elsewhere.
+//
+// Switching is double-buffered: select() only queues the new cubemap, and
+// the displayed texture changes in update() once the new one is fully
+// uploaded, so the skybox never flashes the placeholder or stalls a frame.
+class CubemapCache {
+public:
+  CubemapCache(ResourceRegistry &resources, AssetManager &assets,
+               size_t budgetBytes = 256u << 20)
+      : resources(resources), assets(assets), budget(budgetBytes), tick(0) {}
+
+  CubemapCache(const CubemapCache &) = delete;
+  CubemapCache &operator=(const CubemapCache &) = delete;
+
+  // Makes this face set current as soon as it is resident.
+  void select(const char *faces[6]) {
+    pendingKey = acquire(faces).key;
+    if (frontKey.empty())
+      frontKey = pendingKey;
+  }
+
+  // Starts loading a face set in the background without displaying it.
+  void prefetch(const char *faces[6]) { acquire(faces); }
+
+  // Render thread, once per frame after AssetManager::update().
+  void update() {
+    if (!pendingKey.empty()) {
+      Entry &pending = entries[pendingKey];
+      if (pending.cubemap->ready()) {
+        frontKey = pendingKey;
+        pendingKey.clear();
+      }
+    }
+    if (!frontKey.empty())
+      entries[frontKey].lastUsed = ++tick;
+    evict();
+  }
+
+  // Texture to bind this frame; the placeholder until anything is resident.
+  GLuint current() {
+    if (frontKey.empty())
+      return assets.placeholderCubemap();
+    const Cubemap &c = *entries[frontKey].cubemap;
+    return c.ready() ? c.texture : assets.placeholderCubemap();
+  }
+
+  bool switching() const { return !pendingKey.empty(); }
+
+  void setBudget(size_t bytes) { budget = bytes; }
+  size_t budgetBytes() const { return budget; }
+
+  size_t residentBytes() const {
+    size_t total = 0;
+    for (map<string, Entry>::const_iterator it = entries.begin();
+         it != entries.end(); ++it)
+      total += it->second.cubemap->bytes;
+    return total;
+  }
+
+  size_t residentCount() const { return entries.size(); }
+
+private:
+  struct Entry {
+    string key;
+    shared_ptr<Cubemap> cubemap;
+    uint64_t lastUsed;
+  };
+
+  ResourceRegistry &resources;
+  AssetManager &assets;
+  size_t budget;
+  uint64_t tick;
+  map<string, Entry> entries;
+  string frontKey;
+  string pendingKey;
+
+  static string keyFor(const char *faces[6]) {
+    string key;
+    for (int i = 0; i < 6; i++) {
+      key += faces[i];
+      key += '\n';
+    }
+    return key;
+  }
+
+  Entry &acquire(const char *faces[6]) {
+    string key = keyFor(faces);
+    map<string, Entry>::iterator it = entries.find(key);
+    if (it == entries.end()) {
+      Entry e;
+      e.key = key;
+      e.cubemap = resources.cubemap(faces);
+      it = entries.insert(make_pair(key, e)).first;
+    }
+    it->second.lastUsed = ++tick;
+    return it->second;
+  }
+
+  // Drops least recently used textures until under budget. The displayed and
+  // pending cubemaps are never evicted, nor are ones still uploading.
+  void evict() {
+    size_t resident = residentBytes();
+    while (resident > budget) {
+      map<string, Entry>::iterator victim = entries.end();
+      for (map<string, Entry>::iterator it = entries.begin();
+           it != entries.end(); ++it) {
+        if (it->first == frontKey || it->first == pendingKey ||
+            !it->second.cubemap->ready())
+          continue;
+        if (victim == entries.end() ||
+            it->second.lastUsed < victim->second.lastUsed)
+          victim = it;
+      }
+      if (victim == entries.end())
+        return;
+
+      resident -= victim->second.cubemap->bytes;
+      entries.erase(victim);
+    }
+  }
+};
+
+#endif
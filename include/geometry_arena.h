@@ -0,0 +1,409 @@
+#ifndef GEOMETRY_ARENA_H
+#define GEOMETRY_ARENA_H
+
+#include "vertex_packing.h"
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+using namespace std;
+
+// First-fit allocator over a range of abstract units. Free blocks are kept
+// sorted by offset so neighbours coalesce on free().
+class RangeAllocator {
+public:
+  static const size_t npos = ~size_t(0);
+
+  RangeAllocator() : total(0), used(0) {}
+
+  size_t allocate(size_t size) {
+    if (size == 0)
+      return 0;
+    for (map<size_t, size_t>::iterator it = freeBlocks.begin();
+         it != freeBlocks.end(); ++it) {
+      if (it->second < size)
+        continue;
+      size_t offset = it->first;
+      size_t rest = it->second - size;
+      freeBlocks.erase(it);
+      if (rest)
+        freeBlocks[offset + size] = rest;
+      used += size;
+      return offset;
+    }
+    return npos;
+  }
+
+  void free(size_t offset, size_t size) {
+    if (size == 0)
+      return;
+    used -= size;
+    map<size_t, size_t>::iterator next = freeBlocks.lower_bound(offset);
+    if (next != freeBlocks.end() && offset + size == next->first) {
+      size += next->second;
+      freeBlocks.erase(next++);
+    }
+    if (next != freeBlocks.begin()) {
+      map<size_t, size_t>::iterator prev = next;
+      --prev;
+      if (prev->first + prev->second == offset) {
+        prev->second += size;
+        return;
+      }
+    }
+    freeBlocks[offset] = size;
+  }
+
+  // Extends the range; the new space is free.
+  void grow(size_t newCapacity) {
+    if (newCapacity <= total)
+      return;
+    size_t added = newCapacity - total;
+    size_t start = total;
+    total = newCapacity;
+    used += added; // free() below takes it back out
+    free(start, added);
+  }
+
+  // Forgets every allocation and marks [0, usedPrefix) as taken.
+  void reset(size_t usedPrefix) {
+    freeBlocks.clear();
+    used = usedPrefix;
+    if (usedPrefix < total)
+      freeBlocks[usedPrefix] = total - usedPrefix;
+  }
+
+  size_t capacity() const { return total; }
+  size_t usedSize() const { return used; }
+  size_t freeSize() const { return total - used; }
+  size_t freeBlockCount() const { return freeBlocks.size(); }
+
+  size_t largestFreeBlock() const {
+    size_t largest = 0;
+    for (map<size_t, size_t>::const_iterator it = freeBlocks.begin();
+         it != freeBlocks.end(); ++it)
+      largest = max(largest, it->second);
+    return largest;
+  }
+
+private:
+  map<size_t, size_t> freeBlocks; // offset -> size
+  size_t total;
+  size_t used;
+};
+
+typedef uint32_t GeometryHandle;
+const GeometryHandle GEOMETRY_INVALID_HANDLE = ~0u;
+
+// Where one mesh lives inside the arena, in vertices and indices.
+struct GeometryRange {
+  uint32_t vertexOffset;
+  uint32_t vertexCount;
+  uint32_t indexOffset;
+  uint32_t indexCount;
+  bool live;
+};
+
+struct GeometryArenaStats {
+  size_t vertexBytes, vertexCapacityBytes;
+  size_t indexBytes, indexCapacityBytes;
+  size_t allocations;
+  size_t freeBlocks; // vertex and index fragments together
+  size_t compactions;
+};
+
+// All meshes of one vertex format suballocated from one vertex buffer and
+// one index buffer behind a single VAO. Meshes keep a handle rather than
+// offsets because growing and compacting move the data; draws look the
+// range up and use glDrawElementsBaseVertex, so indices stay mesh-relative.
+class GeometryArena {
+public:
+  explicit GeometryArena(VertexFormat format,
+                         size_t initialVertices = 1 << 16,
+                         size_t initialIndices = 1 << 18)
+      : vertexFormat(format), vao(0), vbo(0), ebo(0), compactions(0) {
+    createBuffers(initialVertices, initialIndices, vao, vbo, ebo);
+    vertexSpace.grow(initialVertices);
+    indexSpace.grow(initialIndices);
+  }
+
+  ~GeometryArena() {
+    if (boundVao() == vao)
+      boundVao() = 0;
+    glDeleteVertexArrays(1, &vao);
+    glDeleteBuffers(1, &vbo);
+    glDeleteBuffers(1, &ebo);
+  }
+
+  GeometryArena(const GeometryArena &) = delete;
+  GeometryArena &operator=(const GeometryArena &) = delete;
+
+  // Reserves space for a mesh; grows or compacts the buffers when needed.
+  // The contents are undefined until uploaded.
+  GeometryHandle allocate(size_t vertexCount, size_t indexCount) {
+    size_t v = vertexSpace.allocate(vertexCount);
+    size_t i = indexSpace.allocate(indexCount);
+    if (v == RangeAllocator::npos || i == RangeAllocator::npos) {
+      if (v != RangeAllocator::npos)
+        vertexSpace.free(v, vertexCount);
+      if (i != RangeAllocator::npos)
+        indexSpace.free(i, indexCount);
+      makeRoom(vertexCount, indexCount);
+      v = vertexSpace.allocate(vertexCount);
+      i = indexSpace.allocate(indexCount);
+    }
+
+    GeometryRange r = {(uint32_t)v, (uint32_t)vertexCount, (uint32_t)i,
+                       (uint32_t)indexCount, true};
+    if (!freeHandles.empty()) {
+      GeometryHandle h = freeHandles.back();
+      freeHandles.pop_back();
+      ranges[h] = r;
+      return h;
+    }
+    ranges.push_back(r);
+    return (GeometryHandle)(ranges.size() - 1);
+  }
+
+  // allocate() for fixed-size pools: compacts if that makes room but never
+  // grows the buffers. Returns GEOMETRY_INVALID_HANDLE when it does not fit.
+  GeometryHandle tryAllocate(size_t vertexCount, size_t indexCount) {
+    if (vertexSpace.freeSize() < vertexCount ||
+        indexSpace.freeSize() < indexCount)
+      return GEOMETRY_INVALID_HANDLE;
+    if (vertexSpace.largestFreeBlock() < vertexCount ||
+        indexSpace.largestFreeBlock() < indexCount)
+      compact();
+    return allocate(vertexCount, indexCount);
+  }
+
+  void free(GeometryHandle h) {
+    if (h >= ranges.size() || !ranges[h].live)
+      return;
+    GeometryRange &r = ranges[h];
+    vertexSpace.free(r.vertexOffset, r.vertexCount);
+    indexSpace.free(r.indexOffset, r.indexCount);
+    r.live = false;
+    freeHandles.push_back(h);
+  }
+
+  // Byte ranges relative to the start of the allocation.
+  void uploadVertices(GeometryHandle h, size_t byteOffset, size_t bytes,
+                      const void *data) {
+    glBindBuffer(GL_COPY_WRITE_BUFFER, vbo);
+    glBufferSubData(GL_COPY_WRITE_BUFFER,
+                    ranges[h].vertexOffset * vertexStride() + byteOffset,
+                    bytes, data);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  }
+
+  void uploadIndices(GeometryHandle h, size_t byteOffset, size_t bytes,
+                     const void *data) {
+    glBindBuffer(GL_COPY_WRITE_BUFFER, ebo);
+    glBufferSubData(GL_COPY_WRITE_BUFFER,
+                    ranges[h].indexOffset * sizeof(unsigned int) + byteOffset,
+                    bytes, data);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  }
+
+  const GeometryRange &range(GeometryHandle h) const { return ranges[h]; }
+
+  // Skips the call when this arena's VAO is already bound, so consecutive
+  // draws from one arena do not switch state.
+  void bind() {
+    if (boundVao() != vao) {
+      glBindVertexArray(vao);
+      boundVao() = vao;
+    }
+  }
+
+  // Call before binding any other VAO.
+  static void unbind() {
+    glBindVertexArray(0);
+    boundVao() = 0;
+  }
+
+  // Moves every live range to the front of fresh buffers, closing the holes
+  // left by free().
+  void compact() {
+    vector<GeometryHandle> order;
+    for (size_t h = 0; h < ranges.size(); h++)
+      if (ranges[h].live)
+        order.push_back((GeometryHandle)h);
+    sort(order.begin(), order.end(),
+         [this](GeometryHandle a, GeometryHandle b) {
+           return ranges[a].vertexOffset < ranges[b].vertexOffset;
+         });
+
+    GLuint newVao, newVbo, newEbo;
+    createBuffers(vertexSpace.capacity(), indexSpace.capacity(), newVao,
+                  newVbo, newEbo);
+
+    const size_t stride = vertexStride();
+    size_t vertexEnd = 0, indexEnd = 0;
+    glBindBuffer(GL_COPY_READ_BUFFER, vbo);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, newVbo);
+    for (size_t k = 0; k < order.size(); k++) {
+      GeometryRange &r = ranges[order[k]];
+      glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                          r.vertexOffset * stride, vertexEnd * stride,
+                          r.vertexCount * stride);
+      r.vertexOffset = (uint32_t)vertexEnd;
+      vertexEnd += r.vertexCount;
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, ebo);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, newEbo);
+    for (size_t k = 0; k < order.size(); k++) {
+      GeometryRange &r = ranges[order[k]];
+      glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                          r.indexOffset * sizeof(unsigned int),
+                          indexEnd * sizeof(unsigned int),
+                          r.indexCount * sizeof(unsigned int));
+      r.indexOffset = (uint32_t)indexEnd;
+      indexEnd += r.indexCount;
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    replaceBuffers(newVao, newVbo, newEbo);
+    vertexSpace.reset(vertexEnd);
+    indexSpace.reset(indexEnd);
+    compactions++;
+  }
+
+  GeometryArenaStats stats() const {
+    GeometryArenaStats s;
+    s.vertexBytes = vertexSpace.usedSize() * vertexStride();
+    s.vertexCapacityBytes = vertexSpace.capacity() * vertexStride();
+    s.indexBytes = indexSpace.usedSize() * sizeof(unsigned int);
+    s.indexCapacityBytes = indexSpace.capacity() * sizeof(unsigned int);
+    s.allocations = ranges.size() - freeHandles.size();
+    s.freeBlocks =
+        vertexSpace.freeBlockCount() + indexSpace.freeBlockCount();
+    s.compactions = compactions;
+    return s;
+  }
+
+  VertexFormat format() const { return vertexFormat; }
+
+  size_t vertexStride() const {
+    return vertexFormat == VERTEX_FORMAT_PACKED ? sizeof(PackedVertex)
+                                                : sizeof(Vertex);
+  }
+
+private:
+  VertexFormat vertexFormat;
+  GLuint vao, vbo, ebo;
+  RangeAllocator vertexSpace;
+  RangeAllocator indexSpace;
+  vector<GeometryRange> ranges; // indexed by handle
+  vector<GeometryHandle> freeHandles;
+  size_t compactions;
+
+  // VAO last bound through bind(), shared by all arenas
+  static GLuint &boundVao() {
+    static GLuint bound = 0;
+    return bound;
+  }
+
+  // Compacting is enough when the holes add up to the request; otherwise
+  // the buffers at least double.
+  void makeRoom(size_t vertexCount, size_t indexCount) {
+    if (vertexSpace.freeSize() >= vertexCount &&
+        indexSpace.freeSize() >= indexCount &&
+        (vertexSpace.largestFreeBlock() < vertexCount ||
+         indexSpace.largestFreeBlock() < indexCount)) {
+      compact();
+      if (vertexSpace.largestFreeBlock() >= vertexCount &&
+          indexSpace.largestFreeBlock() >= indexCount)
+        return;
+    }
+
+    size_t vertexCapacity = vertexSpace.capacity();
+    size_t indexCapacity = indexSpace.capacity();
+    if (vertexSpace.largestFreeBlock() < vertexCount)
+      vertexCapacity = max(vertexCapacity * 2, vertexCapacity + vertexCount);
+    if (indexSpace.largestFreeBlock() < indexCount)
+      indexCapacity = max(indexCapacity * 2, indexCapacity + indexCount);
+    grow(vertexCapacity, indexCapacity);
+  }
+
+  void grow(size_t vertexCapacity, size_t indexCapacity) {
+    GLuint newVao, newVbo, newEbo;
+    createBuffers(vertexCapacity, indexCapacity, newVao, newVbo, newEbo);
+
+    glBindBuffer(GL_COPY_READ_BUFFER, vbo);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, newVbo);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+                        vertexSpace.capacity() * vertexStride());
+    glBindBuffer(GL_COPY_READ_BUFFER, ebo);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, newEbo);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+                        indexSpace.capacity() * sizeof(unsigned int));
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    replaceBuffers(newVao, newVbo, newEbo);
+    vertexSpace.grow(vertexCapacity);
+    indexSpace.grow(indexCapacity);
+  }
+
+  void replaceBuffers(GLuint newVao, GLuint newVbo, GLuint newEbo) {
+    if (boundVao() == vao)
+      unbind();
+    glDeleteVertexArrays(1, &vao);
+    glDeleteBuffers(1, &vbo);
+    glDeleteBuffers(1, &ebo);
+    vao = newVao;
+    vbo = newVbo;
+    ebo = newEbo;
+  }
+
+  void createBuffers(size_t vertexCapacity, size_t indexCapacity,
+                     GLuint &outVao, GLuint &outVbo, GLuint &outEbo) const {
+    glGenVertexArrays(1, &outVao);
+    glGenBuffers(1, &outVbo);
+    glGenBuffers(1, &outEbo);
+
+    glBindVertexArray(outVao);
+    glBindBuffer(GL_ARRAY_BUFFER, outVbo);
+    glBufferData(GL_ARRAY_BUFFER, vertexCapacity * vertexStride(), nullptr,
+                 GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, outEbo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                 indexCapacity * sizeof(unsigned int), nullptr,
+                 GL_STATIC_DRAW);
+
+    if (vertexFormat == VERTEX_FORMAT_PACKED) {
+      // Position attribute: unorm16 over the mesh bounds
+      glEnableVertexAttribArray(0);
+      glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE,
+                            sizeof(PackedVertex), (void *)0);
+
+      // Octahedral normal: raw int16, scaled in the shader so the decode
+      // does not depend on the GL version's snorm conversion rule
+      glEnableVertexAttribArray(2);
+      glVertexAttribPointer(2, 2, GL_SHORT, GL_FALSE, sizeof(PackedVertex),
+                            (void *)offsetof(PackedVertex, normal));
+    } else {
+      // Position attribute
+      glEnableVertexAttribArray(0);
+      glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                            (void *)0);
+
+      // Normal attribute
+      glEnableVertexAttribArray(1);
+      glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
+                            (void *)offsetof(Vertex, Normal));
+    }
+
+    glBindVertexArray(boundVao());
+  }
+};
+
+#endif
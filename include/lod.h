@@ -0,0 +1,68 @@
+#ifndef LOD_H
+#define LOD_H
+
+#include "camera.h"
+#include "model.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+// Per-object LOD selection from projected screen-space size. A level is
+// acceptable when its simplification error, projected at the object's
+// distance, stays under a pixel threshold. Moving to a coarser level needs
+// extra margin so objects hovering around a boundary do not pop back and
+// forth.
+
+const float LOD_PIXEL_ERROR = 1.0f;
+const float LOD_HYSTERESIS = 0.3f;
+
+struct LodState {
+  int level;
+  float screenRadius; // projected bounding sphere radius in pixels
+
+  LodState() : level(0), screenRadius(0.0f) {}
+};
+
+inline int selectLod(const Model &model, const glm::mat4 &modelMatrix,
+                     const Camera &camera, float viewportHeight,
+                     LodState &state, float pixelError = LOD_PIXEL_ERROR) {
+  int count = model.lodCount();
+  if (count <= 1) {
+    state.level = 0;
+    return 0;
+  }
+
+  glm::vec4 sphere = model.bounds();
+  glm::vec3 center =
+      glm::vec3(modelMatrix * glm::vec4(glm::vec3(sphere), 1.0f));
+  float scale = max(glm::length(glm::vec3(modelMatrix[0])),
+                    max(glm::length(glm::vec3(modelMatrix[1])),
+                        glm::length(glm::vec3(modelMatrix[2]))));
+  float radius = sphere.w * scale;
+
+  // distance to the nearest point of the sphere, kept off zero
+  float distance =
+      max(glm::length(center - camera.position) - radius, 0.1f);
+  float pixelsPerUnit =
+      viewportHeight /
+      (2.0f * tanf(glm::radians(camera.zoom) * 0.5f) * distance);
+  state.screenRadius = radius * pixelsPerUnit;
+
+  int level = min(state.level, count - 1);
+  // refine while the current level's error is visible
+  while (level > 0 &&
+         model.lodError(level) * scale * pixelsPerUnit > pixelError)
+    level--;
+  // coarsen only with margin
+  while (level + 1 < count && model.lodError(level + 1) * scale *
+                                      pixelsPerUnit <=
+                                  pixelError * (1.0f - LOD_HYSTERESIS))
+    level++;
+
+  state.level = level;
+  return level;
+}
+
+#endif
@@ -0,0 +1,138 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+using namespace std;
+
+// Read-only memory mapping of a whole file. The mapping stays valid until the
+// object is destroyed or close() is called.
+class MappedFile {
+public:
+  MappedFile() : data(nullptr), size(0), fd(-1), mtime(0) {}
+
+  explicit MappedFile(const string &path, int advice = MADV_NORMAL)
+      : data(nullptr), size(0), fd(-1), mtime(0) {
+    open(path, advice);
+  }
+
+  ~MappedFile() { close(); }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  bool open(const string &path, int advice = MADV_NORMAL) {
+    close();
+
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+      close();
+      return false;
+    }
+    size = (size_t)st.st_size;
+    mtime = (int64_t)st.st_mtime;
+
+    void *ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (ptr == MAP_FAILED) {
+      close();
+      return false;
+    }
+    data = (const unsigned char *)ptr;
+    madvise(ptr, size, advice);
+    return true;
+  }
+
+  void close() {
+    if (data)
+      munmap((void *)data, size);
+    if (fd >= 0)
+      ::close(fd);
+    data = nullptr;
+    size = 0;
+    fd = -1;
+    mtime = 0;
+  }
+
+  bool valid() const { return data != nullptr; }
+  const unsigned char *bytes() const { return data; }
+  size_t length() const { return size; }
+  int64_t modifiedTime() const { return mtime; }
+
+private:
+  const unsigned char *data;
+  size_t size;
+  int fd;
+  int64_t mtime;
+};
+
+// Size and modification time of a file without opening it.
+inline bool statFile(const string &path, uint64_t &size, int64_t &mtime) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0)
+    return false;
+  size = (uint64_t)st.st_size;
+  mtime = (int64_t)st.st_mtime;
+  return true;
+}
+
+// Process-wide table of open file mappings. Importers running in parallel on
+// the same file share one mapping; it is unmapped when the last stream and
+// importer let go of it.
+class MappedFileTable {
+public:
+  shared_ptr<MappedFile> open(const string &path) {
+    lock_guard<mutex> lock(tableMutex);
+    map<string, weak_ptr<MappedFile> >::iterator it = files.find(path);
+    if (it != files.end()) {
+      shared_ptr<MappedFile> file = it->second.lock();
+      if (file)
+        return file;
+    }
+
+    shared_ptr<MappedFile> file =
+        make_shared<MappedFile>(path, MADV_SEQUENTIAL);
+    if (!file->valid()) {
+      if (it != files.end())
+        files.erase(it);
+      return shared_ptr<MappedFile>();
+    }
+    files[path] = file;
+    prune();
+    return file;
+  }
+
+private:
+  mutex tableMutex;
+  map<string, weak_ptr<MappedFile> > files;
+
+  void prune() {
+    for (map<string, weak_ptr<MappedFile> >::iterator it = files.begin();
+         it != files.end();) {
+      if (it->second.expired())
+        files.erase(it++);
+      else
+        ++it;
+    }
+  }
+};
+
+inline MappedFileTable &mappedFiles() {
+  static MappedFileTable table;
+  return table;
+}
+
+#endif
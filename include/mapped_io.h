@@ -0,0 +1,93 @@
+#ifndef MAPPED_IO_H
+#define MAPPED_IO_H
+
+#include "asset_archive.h"
+
+#include <assimp/IOStream.hpp>
+#include <assimp/IOSystem.hpp>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Read-only Assimp stream over an asset in memory: a mapped file or an
+// archive entry. Read() is a single memcpy out of the page cache instead of
+// stdio's buffered read syscalls.
+class MappedIOStream : public Assimp::IOStream {
+public:
+  explicit MappedIOStream(const AssetData &file) : file(file), position(0) {}
+
+  size_t Read(void *buffer, size_t size, size_t count) {
+    if (!size || !count)
+      return 0;
+    size_t available = (file.size - position) / size;
+    if (count > available)
+      count = available;
+    memcpy(buffer, file.bytes + position, size * count);
+    position += size * count;
+    return count;
+  }
+
+  size_t Write(const void *, size_t, size_t) { return 0; }
+
+  aiReturn Seek(size_t offset, aiOrigin origin) {
+    size_t target;
+    switch (origin) {
+    case aiOrigin_SET:
+      target = offset;
+      break;
+    case aiOrigin_CUR:
+      target = position + offset;
+      break;
+    case aiOrigin_END:
+      target = file.size - offset;
+      break;
+    default:
+      return aiReturn_FAILURE;
+    }
+    if (target > file.size)
+      return aiReturn_FAILURE;
+    position = target;
+    return aiReturn_SUCCESS;
+  }
+
+  size_t Tell() const { return position; }
+  size_t FileSize() const { return file.size; }
+  void Flush() {}
+
+private:
+  AssetData file;
+  size_t position;
+};
+
+// Assimp IOSystem that opens files through assetFiles(), so models and the
+// materials they reference can come from a mounted archive. The importer
+// owns and deletes its IOSystem, so each importer gets its own instance;
+// what is shared is the mapping table behind it. Files opened during one
+// import stay alive until the importer is destroyed, since Assimp often
+// probes and then reopens the same file. Writes are not supported.
+class MappedIOSystem : public Assimp::IOSystem {
+public:
+  bool Exists(const char *path) const { return assetFiles().exists(path); }
+
+  char getOsSeparator() const { return '/'; }
+
+  Assimp::IOStream *Open(const char *path, const char *mode = "rb") {
+    if (strchr(mode, 'w') || strchr(mode, 'a') || strchr(mode, '+'))
+      return nullptr;
+    AssetData file = assetFiles().read(path);
+    if (!file.valid())
+      return nullptr;
+    opened.push_back(file);
+    return new MappedIOStream(file);
+  }
+
+  void Close(Assimp::IOStream *stream) { delete stream; }
+
+private:
+  vector<AssetData> opened;
+};
+
+#endif
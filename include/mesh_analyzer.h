@@ -0,0 +1,294 @@
+#ifndef MESH_ANALYZER_H
+#define MESH_ANALYZER_H
+
+#include "mesh_optimizer.h"
+#include "scratch_arena.h"
+#include "thread_pool.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+using namespace std;
+
+// Offline metrics for how expensive a mesh is to render, used by the
+// mesh_analyze tool. Everything works on plain position/index arrays
+// (positions are the first three floats of each vertex), like the optimizer
+// passes whose results it is meant to check.
+
+const unsigned int ANALYZER_CACHE_SIZES[] = {8, 16, 32};
+const size_t ANALYZER_CACHE_SIZE_COUNT = 3;
+const size_t FETCH_LINE_BYTES = 64;
+const size_t FETCH_CACHE_BYTES = 16 << 10;
+const int OVERDRAW_RESOLUTION = 256;
+const size_t OVERDRAW_VIEW_COUNT = 6;
+const float OVERDRAW_VIEWS[OVERDRAW_VIEW_COUNT][3] = {
+    {1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}};
+
+struct VertexFetchStats {
+  size_t bytesFetched;
+  float overfetch; // bytes fetched / vertex buffer size (1 is optimal)
+};
+
+// Memory traffic of vertex fetch: every post-transform cache miss loads the
+// vertex's cache lines through a FIFO cache of FETCH_CACHE_BYTES.
+inline VertexFetchStats analyzeVertexFetch(const unsigned int *indices,
+                                           size_t indexCount,
+                                           size_t vertexCount,
+                                           size_t vertexStride) {
+  VertexFetchStats stats = {0, 0.0f};
+  if (indexCount < 3 || vertexCount == 0)
+    return stats;
+
+  ScratchScope scope(importScratch());
+  size_t lineCount =
+      (vertexCount * vertexStride + FETCH_LINE_BYTES - 1) / FETCH_LINE_BYTES;
+  const size_t cacheLines = FETCH_CACHE_BYTES / FETCH_LINE_BYTES;
+  size_t *vertexTime = importScratch().allocZeroed<size_t>(vertexCount);
+  size_t *lineTime = importScratch().allocZeroed<size_t>(lineCount);
+  size_t vertexClock = VERTEX_CACHE_SIZE + 1, lineClock = cacheLines + 1;
+  for (size_t i = 0; i < indexCount; i++) {
+    unsigned int v = indices[i];
+    if (vertexClock - vertexTime[v] <= VERTEX_CACHE_SIZE)
+      continue;
+    vertexTime[v] = vertexClock++;
+
+    size_t first = (size_t)v * vertexStride / FETCH_LINE_BYTES;
+    size_t last = ((size_t)v * vertexStride + vertexStride - 1) /
+                  FETCH_LINE_BYTES;
+    for (size_t line = first; line <= last; line++) {
+      if (lineClock - lineTime[line] > cacheLines) {
+        lineTime[line] = lineClock++;
+        stats.bytesFetched += FETCH_LINE_BYTES;
+      }
+    }
+  }
+  stats.overfetch =
+      (float)stats.bytesFetched / (float)(vertexCount * vertexStride);
+  return stats;
+}
+
+struct OverdrawStats {
+  size_t pixelsCovered;
+  size_t pixelsShaded; // fragments that passed the depth test when drawn
+  float overdraw;      // shaded / covered (1 is optimal)
+};
+
+// Rasterizes the triangles in index order with an orthographic camera
+// looking along `direction` and a depth test, the way early-Z sees them.
+// Both faces are drawn since the renderer does not cull back faces.
+inline OverdrawStats analyzeOverdraw(const float *positions,
+                                     size_t vertexStride, size_t vertexCount,
+                                     const unsigned int *indices,
+                                     size_t indexCount,
+                                     const float direction[3],
+                                     int resolution = OVERDRAW_RESOLUTION) {
+  OverdrawStats stats = {0, 0, 0.0f};
+  if (indexCount < 3 || vertexCount == 0)
+    return stats;
+
+  // camera basis: d is the view direction, (r, u) span the image plane
+  float d[3] = {direction[0], direction[1], direction[2]};
+  float h[3] = {0.0f, 1.0f, 0.0f};
+  if (fabsf(d[1]) > 0.99f) {
+    h[0] = 1.0f;
+    h[1] = 0.0f;
+  }
+  float r[3] = {h[1] * d[2] - h[2] * d[1], h[2] * d[0] - h[0] * d[2],
+                h[0] * d[1] - h[1] * d[0]};
+  float rl = sqrtf(r[0] * r[0] + r[1] * r[1] + r[2] * r[2]);
+  for (int k = 0; k < 3; k++)
+    r[k] /= rl;
+  float u[3] = {d[1] * r[2] - d[2] * r[1], d[2] * r[0] - d[0] * r[2],
+                d[0] * r[1] - d[1] * r[0]};
+
+  size_t floatStride = vertexStride / sizeof(float);
+  vector<float> screen(vertexCount * 3);
+  float lo[2] = {numeric_limits<float>::max(), numeric_limits<float>::max()};
+  float hi[2] = {-lo[0], -lo[1]};
+  for (size_t i = 0; i < vertexCount; i++) {
+    const float *p = positions + i * floatStride;
+    float *s = &screen[i * 3];
+    s[0] = p[0] * r[0] + p[1] * r[1] + p[2] * r[2];
+    s[1] = p[0] * u[0] + p[1] * u[1] + p[2] * u[2];
+    s[2] = p[0] * d[0] + p[1] * d[1] + p[2] * d[2];
+    for (int k = 0; k < 2; k++) {
+      lo[k] = min(lo[k], s[k]);
+      hi[k] = max(hi[k], s[k]);
+    }
+  }
+  float extent = max(hi[0] - lo[0], hi[1] - lo[1]);
+  float scale = extent > 0.0f ? (resolution - 1) / extent : 0.0f;
+  for (size_t i = 0; i < vertexCount; i++) {
+    screen[i * 3] = (screen[i * 3] - lo[0]) * scale;
+    screen[i * 3 + 1] = (screen[i * 3 + 1] - lo[1]) * scale;
+  }
+
+  vector<float> depth((size_t)resolution * resolution,
+                      numeric_limits<float>::max());
+  for (size_t t = 0; t + 2 < indexCount; t += 3) {
+    const float *a = &screen[indices[t] * 3];
+    const float *b = &screen[indices[t + 1] * 3];
+    const float *c = &screen[indices[t + 2] * 3];
+    float area = (b[0] - a[0]) * (c[1] - a[1]) - (b[1] - a[1]) * (c[0] - a[0]);
+    if (fabsf(area) < 1e-12f)
+      continue;
+    float inv = 1.0f / area;
+
+    int x0 = max(0, (int)floorf(min(a[0], min(b[0], c[0]))));
+    int x1 = min(resolution - 1, (int)ceilf(max(a[0], max(b[0], c[0]))));
+    int y0 = max(0, (int)floorf(min(a[1], min(b[1], c[1]))));
+    int y1 = min(resolution - 1, (int)ceilf(max(a[1], max(b[1], c[1]))));
+    for (int y = y0; y <= y1; y++) {
+      float py = y + 0.5f;
+      for (int x = x0; x <= x1; x++) {
+        float px = x + 0.5f;
+        float wa = ((b[0] - px) * (c[1] - py) - (b[1] - py) * (c[0] - px)) *
+                   inv;
+        float wb = ((c[0] - px) * (a[1] - py) - (c[1] - py) * (a[0] - px)) *
+                   inv;
+        float wc = 1.0f - wa - wb;
+        if (wa < 0.0f || wb < 0.0f || wc < 0.0f)
+          continue;
+        float z = wa * a[2] + wb * b[2] + wc * c[2];
+        float &stored = depth[(size_t)y * resolution + x];
+        if (z < stored) {
+          if (stored == numeric_limits<float>::max())
+            stats.pixelsCovered++;
+          stored = z;
+          stats.pixelsShaded++;
+        }
+      }
+    }
+  }
+  stats.overdraw = stats.pixelsCovered
+                       ? (float)stats.pixelsShaded / stats.pixelsCovered
+                       : 0.0f;
+  return stats;
+}
+
+struct MeshAnalysis {
+  size_t vertexCount;
+  size_t triangleCount;
+  size_t unusedVertices;     // not referenced by any triangle
+  size_t uniquePositions;    // vertices left after welding exact positions
+  size_t degenerateIndices;  // triangles repeating a vertex
+  size_t degenerateArea;     // distinct vertices but zero area
+  size_t duplicateTriangles; // same vertices and winding as an earlier one
+  VertexCacheStats cache[ANALYZER_CACHE_SIZE_COUNT];
+  VertexFetchStats fetch;
+  OverdrawStats overdraw[OVERDRAW_VIEW_COUNT];
+  float meanOverdraw;
+};
+
+// All metrics for one index range. The overdraw views run on the pool.
+inline MeshAnalysis analyzeMesh(const float *positions, size_t vertexStride,
+                                size_t vertexCount,
+                                const unsigned int *indices,
+                                size_t indexCount,
+                                ThreadPool *pool = nullptr) {
+  MeshAnalysis a;
+  memset(&a, 0, sizeof(a));
+  a.vertexCount = vertexCount;
+  a.triangleCount = indexCount / 3;
+  size_t floatStride = vertexStride / sizeof(float);
+
+  vector<bool> used(vertexCount, false);
+  for (size_t i = 0; i < indexCount; i++)
+    used[indices[i]] = true;
+  a.unusedVertices = count(used.begin(), used.end(), false);
+
+  vector<glm::vec3> welded(vertexCount);
+  for (size_t i = 0; i < vertexCount; i++)
+    welded[i] = glm::vec3(positions[i * floatStride],
+                          positions[i * floatStride + 1],
+                          positions[i * floatStride + 2]);
+  sort(welded.begin(), welded.end(),
+       [](const glm::vec3 &p, const glm::vec3 &q) {
+         return p.x != q.x ? p.x < q.x : p.y != q.y ? p.y < q.y : p.z < q.z;
+       });
+  a.uniquePositions =
+      unique(welded.begin(), welded.end(),
+             [](const glm::vec3 &p, const glm::vec3 &q) {
+               return p.x == q.x && p.y == q.y && p.z == q.z;
+             }) -
+      welded.begin();
+
+  // zero area relative to the mesh size, so scale does not matter
+  float lo[3] = {numeric_limits<float>::max(), numeric_limits<float>::max(),
+                 numeric_limits<float>::max()};
+  float hi[3] = {-lo[0], -lo[1], -lo[2]};
+  for (size_t i = 0; i < vertexCount; i++)
+    for (int k = 0; k < 3; k++) {
+      lo[k] = min(lo[k], positions[i * floatStride + k]);
+      hi[k] = max(hi[k], positions[i * floatStride + k]);
+    }
+  float diagonal2 = 0.0f;
+  for (int k = 0; k < 3; k++)
+    diagonal2 += vertexCount ? (hi[k] - lo[k]) * (hi[k] - lo[k]) : 0.0f;
+
+  struct Key {
+    unsigned int v[3];
+    bool operator<(const Key &o) const {
+      return v[0] != o.v[0]   ? v[0] < o.v[0]
+             : v[1] != o.v[1] ? v[1] < o.v[1]
+                              : v[2] < o.v[2];
+    }
+    bool operator==(const Key &o) const {
+      return v[0] == o.v[0] && v[1] == o.v[1] && v[2] == o.v[2];
+    }
+  };
+  vector<Key> keys;
+  keys.reserve(a.triangleCount);
+  for (size_t t = 0; t + 2 < indexCount; t += 3) {
+    unsigned int i0 = indices[t], i1 = indices[t + 1], i2 = indices[t + 2];
+    if (i0 == i1 || i1 == i2 || i0 == i2) {
+      a.degenerateIndices++;
+      continue;
+    }
+    const float *p0 = positions + i0 * floatStride;
+    const float *p1 = positions + i1 * floatStride;
+    const float *p2 = positions + i2 * floatStride;
+    float e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+    float e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+    float cx = e1[1] * e2[2] - e1[2] * e2[1];
+    float cy = e1[2] * e2[0] - e1[0] * e2[2];
+    float cz = e1[0] * e2[1] - e1[1] * e2[0];
+    if (sqrtf(cx * cx + cy * cy + cz * cz) <= 1e-10f * diagonal2)
+      a.degenerateArea++;
+
+    // rotated to start at the smallest index, keeping the winding, so a
+    // back face over the same vertices (double-sided geometry) is not a
+    // duplicate
+    Key key = {{i0, i1, i2}};
+    if (i1 < i0 && i1 < i2)
+      key = Key{{i1, i2, i0}};
+    else if (i2 < i0 && i2 < i1)
+      key = Key{{i2, i0, i1}};
+    keys.push_back(key);
+  }
+  sort(keys.begin(), keys.end());
+  size_t distinct = unique(keys.begin(), keys.end()) - keys.begin();
+  a.duplicateTriangles = keys.size() - distinct;
+
+  for (size_t c = 0; c < ANALYZER_CACHE_SIZE_COUNT; c++)
+    a.cache[c] = analyzeVertexCache(indices, indexCount, vertexCount,
+                                    ANALYZER_CACHE_SIZES[c]);
+  a.fetch = analyzeVertexFetch(indices, indexCount, vertexCount, vertexStride);
+
+  parallelFor(pool, OVERDRAW_VIEW_COUNT, [&](size_t view) {
+    a.overdraw[view] =
+        analyzeOverdraw(positions, vertexStride, vertexCount, indices,
+                        indexCount, OVERDRAW_VIEWS[view]);
+  });
+  for (size_t view = 0; view < OVERDRAW_VIEW_COUNT; view++)
+    a.meanOverdraw += a.overdraw[view].overdraw / OVERDRAW_VIEW_COUNT;
+  return a;
+}
+
+#endif
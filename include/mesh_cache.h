@@ -0,0 +1,378 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include "mapped_file.h"
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Binary cache of imported meshes. Each source model gets one file under
+// cache/meshes/ holding the final interleaved vertex and index arrays, so a
+// warm start maps the file and hands the arrays straight to glBufferData.
+//
+// File layout (all offsets from the start of the file, 16-byte aligned):
+//   MeshCacheHeader
+//   MeshCacheEntry[meshCount]
+//   vertex, index and meshlet blobs
+
+const char MESH_CACHE_DIR[] = "cache/meshes";
+const uint32_t MESH_CACHE_MAGIC = 0x48534d54; // "TMSH"
+// Bump whenever the import pipeline changes what ends up in the arrays.
+const uint32_t MESH_CACHE_VERSION = 7;
+
+const uint32_t MESH_MAX_LODS = 6;
+
+// One level of detail: a range of the mesh's index buffer and the largest
+// deviation from the full-resolution surface, in model units.
+struct MeshLod {
+  uint32_t indexOffset;
+  uint32_t indexCount;
+  float error;
+  float reserved;
+};
+
+// A contiguous index range of at most 64 vertices and 124 triangles, with a
+// bounding sphere and normal cone for culling, all in model space.
+struct Meshlet {
+  uint32_t indexOffset;
+  uint32_t indexCount;
+  float center[3];
+  float radius;
+  float coneAxis[3];
+  float coneCutoff; // sine of the cone's spread; 1 disables cone culling
+};
+
+// LOD and meshlet index ranges go straight to the draw calls, so each must
+// be whole triangles within the mesh's indices. Meshlets are found by
+// binary search and must also be sorted.
+template <typename Range>
+bool rangesInside(const Range *ranges, uint32_t count, uint32_t indexCount,
+                  bool sorted) {
+  for (uint32_t i = 0; i < count; i++) {
+    const Range &r = ranges[i];
+    if (r.indexOffset % 3 != 0 || r.indexCount % 3 != 0 ||
+        (uint64_t)r.indexOffset + r.indexCount > indexCount ||
+        (sorted && i && r.indexOffset < ranges[i - 1].indexOffset))
+      return false;
+  }
+  return true;
+}
+
+struct MeshCacheHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t vertexStride;
+  uint32_t importFlags;
+  uint64_t pathHash;
+  uint64_t sourceSize;
+  int64_t sourceMtime;
+  uint64_t sourceHash;
+  uint32_t meshCount;
+  uint32_t reserved;
+};
+
+struct MeshCacheEntry {
+  uint64_t vertexOffset;
+  uint64_t indexOffset;
+  uint32_t vertexCount;
+  uint32_t indexCount;
+  float bounds[4]; // bounding sphere center and radius
+  uint32_t lodCount;
+  uint32_t meshletCount;
+  MeshLod lods[MESH_MAX_LODS];
+  uint64_t meshletOffset;
+  float transform[16]; // node transform within the model, column-major
+};
+
+// One mesh worth of data, either to be written or as read back from a
+// mapping. The pointers are not owned.
+struct MeshCacheBlob {
+  const void *vertices;
+  uint32_t vertexCount;
+  const unsigned int *indices;
+  uint32_t indexCount;
+  float bounds[4];
+  uint32_t lodCount;
+  const MeshLod *lods;
+  uint32_t meshletCount;
+  const Meshlet *meshlets;
+  float transform[16];
+};
+
+// MurmurHash64A, 8 bytes per step; fast enough to fingerprint large OBJ files.
+inline uint64_t hashBytes(const void *key, size_t len, uint64_t seed = 0) {
+  const uint64_t m = 0xc6a4a7935bd1e995ULL;
+  const int r = 47;
+  uint64_t h = seed ^ (len * m);
+
+  const unsigned char *data = (const unsigned char *)key;
+  const unsigned char *end = data + (len / 8) * 8;
+  for (; data != end; data += 8) {
+    uint64_t k;
+    memcpy(&k, data, 8);
+    k *= m;
+    k ^= k >> r;
+    k *= m;
+    h ^= k;
+    h *= m;
+  }
+
+  switch (len & 7) {
+  case 7:
+    h ^= uint64_t(data[6]) << 48;
+    // fall through
+  case 6:
+    h ^= uint64_t(data[5]) << 40;
+    // fall through
+  case 5:
+    h ^= uint64_t(data[4]) << 32;
+    // fall through
+  case 4:
+    h ^= uint64_t(data[3]) << 24;
+    // fall through
+  case 3:
+    h ^= uint64_t(data[2]) << 16;
+    // fall through
+  case 2:
+    h ^= uint64_t(data[1]) << 8;
+    // fall through
+  case 1:
+    h ^= uint64_t(data[0]);
+    h *= m;
+  }
+
+  h ^= h >> r;
+  h *= m;
+  h ^= h >> r;
+  return h;
+}
+
+inline uint64_t hashString(const string &s, uint64_t seed = 0) {
+  return hashBytes(s.data(), s.size(), seed);
+}
+
+inline bool makeDirs(const string &path) {
+  for (size_t pos = path.find('/'); ; pos = path.find('/', pos + 1)) {
+    string dir = path.substr(0, pos);
+    if (!dir.empty() && mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+      return false;
+    if (pos == string::npos)
+      return true;
+  }
+}
+
+class MeshCache {
+public:
+  MeshCache(const string &sourcePath, uint32_t importFlags,
+            uint32_t vertexStride)
+      : sourcePath(sourcePath), importFlags(importFlags),
+        vertexStride(vertexStride), pathHash(hashString(sourcePath)) {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bin",
+             (unsigned long long)(pathHash ^ importFlags));
+    cachePath = string(MESH_CACHE_DIR) + "/" + name;
+  }
+
+  // Maps the cache file and validates it against the source. On success the
+  // returned blobs point into the mapping, which stays alive as long as the
+  // caller holds on to this object.
+  bool load(vector<MeshCacheBlob> &blobs) {
+    uint64_t srcSize;
+    int64_t srcMtime;
+    if (!statFile(sourcePath, srcSize, srcMtime))
+      return false;
+
+    if (!file.open(cachePath, MADV_WILLNEED))
+      return false;
+    if (file.length() < sizeof(MeshCacheHeader))
+      return reject();
+
+    MeshCacheHeader header;
+    memcpy(&header, file.bytes(), sizeof(header));
+    if (header.magic != MESH_CACHE_MAGIC ||
+        header.version != MESH_CACHE_VERSION ||
+        header.vertexStride != vertexStride ||
+        header.importFlags != importFlags || header.pathHash != pathHash)
+      return reject();
+
+    // Size and mtime match: trust the cache without reading the source.
+    // Otherwise fall back to comparing content hashes, so a touched but
+    // unchanged file does not force a re-import.
+    if (header.sourceSize != srcSize || header.sourceMtime != srcMtime) {
+      if (header.sourceSize != srcSize || header.sourceHash != hashSource())
+        return reject();
+      restamp(srcMtime);
+    }
+
+    size_t tableEnd = sizeof(MeshCacheHeader) +
+                      (size_t)header.meshCount * sizeof(MeshCacheEntry);
+    if (file.length() < tableEnd)
+      return reject();
+
+    const MeshCacheEntry *entries =
+        (const MeshCacheEntry *)(file.bytes() + sizeof(MeshCacheHeader));
+    blobs.clear();
+    blobs.reserve(header.meshCount);
+    for (uint32_t i = 0; i < header.meshCount; i++) {
+      const MeshCacheEntry &e = entries[i];
+      uint64_t vEnd = e.vertexOffset + (uint64_t)e.vertexCount * vertexStride;
+      uint64_t iEnd = e.indexOffset + (uint64_t)e.indexCount * sizeof(unsigned);
+      uint64_t mEnd =
+          e.meshletOffset + (uint64_t)e.meshletCount * sizeof(Meshlet);
+      if (vEnd > file.length() || iEnd > file.length() ||
+          mEnd > file.length() || e.lodCount > MESH_MAX_LODS ||
+          e.indexCount % 3 != 0)
+        return reject();
+      const Meshlet *meshlets =
+          (const Meshlet *)(file.bytes() + e.meshletOffset);
+      if (!rangesInside(e.lods, e.lodCount, e.indexCount, false) ||
+          !rangesInside(meshlets, e.meshletCount, e.indexCount, true))
+        return reject();
+
+      MeshCacheBlob blob;
+      blob.vertices = file.bytes() + e.vertexOffset;
+      blob.vertexCount = e.vertexCount;
+      blob.indices = (const unsigned int *)(file.bytes() + e.indexOffset);
+      blob.indexCount = e.indexCount;
+      memcpy(blob.bounds, e.bounds, sizeof(blob.bounds));
+      memcpy(blob.transform, e.transform, sizeof(blob.transform));
+      blob.lodCount = e.lodCount;
+      blob.lods = e.lods;
+      blob.meshletCount = e.meshletCount;
+      blob.meshlets = meshlets;
+      blobs.push_back(blob);
+    }
+    return true;
+  }
+
+  // Writes a fresh cache file. Goes through a uniquely named temporary file
+  // and rename so concurrent loaders never see a partial cache.
+  bool store(const vector<MeshCacheBlob> &blobs) {
+    uint64_t srcSize;
+    int64_t srcMtime;
+    if (!statFile(sourcePath, srcSize, srcMtime) || !makeDirs(MESH_CACHE_DIR))
+      return false;
+
+    MeshCacheHeader header = {};
+    header.magic = MESH_CACHE_MAGIC;
+    header.version = MESH_CACHE_VERSION;
+    header.vertexStride = vertexStride;
+    header.importFlags = importFlags;
+    header.pathHash = pathHash;
+    header.sourceSize = srcSize;
+    header.sourceMtime = srcMtime;
+    header.sourceHash = hashSource();
+    header.meshCount = (uint32_t)blobs.size();
+
+    vector<MeshCacheEntry> entries(blobs.size(), MeshCacheEntry());
+    uint64_t offset = align(sizeof(MeshCacheHeader) +
+                            entries.size() * sizeof(MeshCacheEntry));
+    for (size_t i = 0; i < blobs.size(); i++) {
+      entries[i].vertexCount = blobs[i].vertexCount;
+      entries[i].indexCount = blobs[i].indexCount;
+      memcpy(entries[i].bounds, blobs[i].bounds, sizeof(entries[i].bounds));
+      memcpy(entries[i].transform, blobs[i].transform,
+             sizeof(entries[i].transform));
+      entries[i].lodCount = min(blobs[i].lodCount, MESH_MAX_LODS);
+      for (uint32_t l = 0; l < entries[i].lodCount; l++)
+        entries[i].lods[l] = blobs[i].lods[l];
+      entries[i].vertexOffset = offset;
+      offset = align(offset + (uint64_t)blobs[i].vertexCount * vertexStride);
+      entries[i].indexOffset = offset;
+      offset = align(offset + (uint64_t)blobs[i].indexCount * sizeof(unsigned));
+      entries[i].meshletCount = blobs[i].meshletCount;
+      entries[i].meshletOffset = offset;
+      offset =
+          align(offset + (uint64_t)blobs[i].meshletCount * sizeof(Meshlet));
+    }
+
+    static atomic<unsigned> tmpCounter(0);
+    string tmpPath = cachePath + ".tmp." + to_string(getpid()) + "." +
+                     to_string(tmpCounter++);
+    ofstream out(tmpPath.c_str(), ios::binary | ios::trunc);
+    if (!out)
+      return false;
+
+    uint64_t written = 0;
+    writeAt(out, written, 0, &header, sizeof(header));
+    writeAt(out, written, written, entries.data(),
+            entries.size() * sizeof(MeshCacheEntry));
+    for (size_t i = 0; i < blobs.size(); i++) {
+      writeAt(out, written, entries[i].vertexOffset, blobs[i].vertices,
+              (size_t)blobs[i].vertexCount * vertexStride);
+      writeAt(out, written, entries[i].indexOffset, blobs[i].indices,
+              (size_t)blobs[i].indexCount * sizeof(unsigned));
+      writeAt(out, written, entries[i].meshletOffset, blobs[i].meshlets,
+              (size_t)blobs[i].meshletCount * sizeof(Meshlet));
+    }
+    out.close();
+
+    if (!out || rename(tmpPath.c_str(), cachePath.c_str()) != 0) {
+      remove(tmpPath.c_str());
+      cout << "ERROR::MESH_CACHE::WRITE_FAILED " << cachePath << endl;
+      return false;
+    }
+    return true;
+  }
+
+  const string &path() const { return cachePath; }
+
+private:
+  string sourcePath;
+  string cachePath;
+  uint32_t importFlags;
+  uint32_t vertexStride;
+  uint64_t pathHash;
+  MappedFile file;
+
+  static uint64_t align(uint64_t v) { return (v + 15) & ~uint64_t(15); }
+
+  bool reject() {
+    file.close();
+    return false;
+  }
+
+  uint64_t hashSource() const {
+    MappedFile src(sourcePath, MADV_SEQUENTIAL);
+    return src.valid() ? hashBytes(src.bytes(), src.length()) : 0;
+  }
+
+  void restamp(int64_t srcMtime) {
+    FILE *f = fopen(cachePath.c_str(), "r+b");
+    if (!f)
+      return;
+    fseek(f, offsetof(MeshCacheHeader, sourceMtime), SEEK_SET);
+    fwrite(&srcMtime, sizeof(srcMtime), 1, f);
+    fclose(f);
+  }
+
+  static void writeAt(ofstream &out, uint64_t &written, uint64_t offset,
+                      const void *data, size_t size) {
+    static const char zeros[16] = {0};
+    while (written < offset) {
+      size_t pad = (size_t)(offset - written);
+      out.write(zeros, pad < sizeof(zeros) ? pad : sizeof(zeros));
+      written += pad < sizeof(zeros) ? pad : sizeof(zeros);
+    }
+    if (size)
+      out.write((const char *)data, size);
+    written += size;
+  }
+};
+
+#endif
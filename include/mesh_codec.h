@@ -0,0 +1,466 @@
+#ifndef MESH_CODEC_H
+#define MESH_CODEC_H
+
+#include "mapped_file.h"
+#include "mesh_cache.h"
+#include "scratch_arena.h"
+#include "thread_pool.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Compressed container for fully processed meshes (.mshz): what the mesh
+// cache holds, but small enough to ship. Vertex and index arrays are cut
+// into chunks that are filtered, then zlib-compressed independently, so a
+// load decodes all chunks of all meshes in parallel.
+//
+//  - Indices: each triangle is rotated (winding kept) to start at its
+//    smallest index, then stored as the delta of that index from the
+//    previous triangle's, zigzag-encoded, followed by the offsets of the
+//    other two corners from it. Optimized meshes reference nearby
+//    vertices, so nearly all of these are small.
+//  - Vertices: every 32-bit word is replaced by its difference from the
+//    same word of the previous vertex, and the result is stored byte-planar
+//    (byte 0 of all vertices, then byte 1, ...), which lines up the
+//    mostly-constant high bytes for zlib.
+//
+// Filtering restarts at every chunk. LOD tables and meshlets are small and
+// stored raw.
+//
+// File layout (offsets from the start of the data, 16-byte aligned):
+//   MeshContainerHeader
+//   MeshContainerMesh[meshCount]
+//   MeshContainerChunk[chunkCount]
+//   LOD tables, meshlets and compressed chunks
+
+const uint32_t MESH_CONTAINER_MAGIC = 0x5a48534d; // "MSHZ"
+const uint32_t MESH_CONTAINER_VERSION = 2;
+const uint32_t MESH_CODEC_CHUNK_VERTICES = 1 << 14;
+const uint32_t MESH_CODEC_CHUNK_TRIANGLES = 1 << 15;
+// Most bytes deflate can produce per compressed byte.
+const uint64_t MESH_CODEC_MAX_EXPANSION = 1032;
+
+struct MeshContainerHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t vertexStride;
+  uint32_t meshCount;
+  uint32_t chunkCount;
+  uint32_t reserved;
+};
+
+struct MeshContainerMesh {
+  uint32_t vertexCount;
+  uint32_t indexCount;
+  uint32_t lodCount;
+  uint32_t meshletCount;
+  float bounds[4];
+  uint64_t lodOffset;
+  uint64_t meshletOffset;
+  uint32_t firstChunk;
+  uint32_t chunkCount;
+  float transform[16]; // node transform within the model, column-major
+};
+
+enum MeshChunkKind { MESH_CHUNK_VERTICES = 0, MESH_CHUNK_INDICES = 1 };
+
+struct MeshContainerChunk {
+  uint32_t kind;
+  uint32_t first; // first vertex or index of the mesh it covers
+  uint32_t count; // vertices or indices
+  uint32_t compressedBytes;
+  uint64_t offset;
+};
+
+inline uint32_t zigzag(int32_t v) {
+  return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+inline int32_t unzigzag(uint32_t v) {
+  return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+// ---- filters ----
+
+// count vertices of `stride` bytes (a multiple of 4) -> stride byte planes
+inline void encodeVertexPlanes(const unsigned char *vertices, size_t count,
+                               size_t stride, unsigned char *planes) {
+  size_t words = stride / 4;
+  uint32_t previous[64] = {0};
+  for (size_t i = 0; i < count; i++) {
+    for (size_t w = 0; w < words; w++) {
+      uint32_t value;
+      memcpy(&value, vertices + i * stride + w * 4, 4);
+      uint32_t delta = value - previous[w];
+      previous[w] = value;
+      for (int b = 0; b < 4; b++)
+        planes[(w * 4 + b) * count + i] = (unsigned char)(delta >> (8 * b));
+    }
+  }
+}
+
+inline void decodeVertexPlanes(const unsigned char *planes, size_t count,
+                               size_t stride, unsigned char *vertices) {
+  size_t words = stride / 4;
+  for (size_t w = 0; w < words; w++) {
+    const unsigned char *p0 = planes + (w * 4 + 0) * count;
+    const unsigned char *p1 = planes + (w * 4 + 1) * count;
+    const unsigned char *p2 = planes + (w * 4 + 2) * count;
+    const unsigned char *p3 = planes + (w * 4 + 3) * count;
+    uint32_t value = 0;
+    for (size_t i = 0; i < count; i++) {
+      value += (uint32_t)p0[i] | (uint32_t)p1[i] << 8 |
+               (uint32_t)p2[i] << 16 | (uint32_t)p3[i] << 24;
+      memcpy(vertices + i * stride + w * 4, &value, 4);
+    }
+  }
+}
+
+// count indices (a multiple of 3) -> 4 byte planes of filtered words
+inline void encodeIndexPlanes(const unsigned int *indices, size_t count,
+                              unsigned char *planes) {
+  uint32_t previous = 0;
+  for (size_t t = 0; t < count; t += 3) {
+    unsigned int a = indices[t], b = indices[t + 1], c = indices[t + 2];
+    if (b < a && b <= c) { // rotate b to the front
+      unsigned int x = a;
+      a = b;
+      b = c;
+      c = x;
+    } else if (c < a && c < b) { // rotate c to the front
+      unsigned int x = c;
+      c = b;
+      b = a;
+      a = x;
+    }
+    uint32_t words[3] = {zigzag((int32_t)(a - previous)), b - a, c - a};
+    previous = a;
+    for (int k = 0; k < 3; k++)
+      for (int byte = 0; byte < 4; byte++)
+        planes[byte * count + t + k] = (unsigned char)(words[k] >> (8 * byte));
+  }
+}
+
+// False if a delta wraps or any index is vertexCount or more.
+inline bool decodeIndexPlanes(const unsigned char *planes, size_t count,
+                              uint32_t vertexCount, unsigned int *indices) {
+  const unsigned char *p0 = planes, *p1 = planes + count,
+                      *p2 = planes + 2 * count, *p3 = planes + 3 * count;
+  // reassemble the words first, then undo the filter
+  for (size_t i = 0; i < count; i++)
+    indices[i] = (uint32_t)p0[i] | (uint32_t)p1[i] << 8 |
+                 (uint32_t)p2[i] << 16 | (uint32_t)p3[i] << 24;
+
+  // 64-bit sums, so a corrupt delta cannot wrap back into range
+  uint64_t previous = 0;
+  for (size_t t = 0; t < count; t += 3) {
+    int64_t a = (int64_t)previous + unzigzag(indices[t]);
+    uint64_t b = (uint64_t)a + indices[t + 1];
+    uint64_t c = (uint64_t)a + indices[t + 2];
+    if (a < 0 || b >= vertexCount || c >= vertexCount)
+      return false; // b and c are never below a
+    indices[t] = (uint32_t)a;
+    indices[t + 1] = (uint32_t)b;
+    indices[t + 2] = (uint32_t)c;
+    previous = (uint64_t)a;
+  }
+  return true;
+}
+
+// ---- writing ----
+
+inline uint64_t codecAlign(uint64_t offset) { return (offset + 15) & ~15ull; }
+
+inline void codecWriteAt(vector<unsigned char> &image, uint64_t offset,
+                         const void *data, size_t bytes) {
+  if (bytes)
+    memcpy(image.data() + offset, data, bytes);
+}
+
+// Encodes meshes into a container image in memory. level is the zlib level.
+inline bool encodeMeshContainer(const vector<MeshCacheBlob> &meshes,
+                                uint32_t vertexStride,
+                                vector<unsigned char> &image,
+                                int level = Z_BEST_COMPRESSION) {
+  if (vertexStride % 4 != 0 || vertexStride > 256)
+    return false;
+
+  MeshContainerHeader header = {MESH_CONTAINER_MAGIC, MESH_CONTAINER_VERSION,
+                                vertexStride, (uint32_t)meshes.size(), 0, 0};
+  vector<MeshContainerMesh> table(meshes.size());
+  vector<MeshContainerChunk> chunks;
+  for (size_t m = 0; m < meshes.size(); m++) {
+    const MeshCacheBlob &blob = meshes[m];
+    MeshContainerMesh &e = table[m];
+    e.vertexCount = blob.vertexCount;
+    e.indexCount = blob.indexCount;
+    e.lodCount = blob.lodCount;
+    e.meshletCount = blob.meshletCount;
+    memcpy(e.bounds, blob.bounds, sizeof(e.bounds));
+    memcpy(e.transform, blob.transform, sizeof(e.transform));
+    e.firstChunk = (uint32_t)chunks.size();
+    for (uint32_t v = 0; v < blob.vertexCount; v += MESH_CODEC_CHUNK_VERTICES) {
+      MeshContainerChunk c = {MESH_CHUNK_VERTICES, v,
+                              min(MESH_CODEC_CHUNK_VERTICES,
+                                  blob.vertexCount - v),
+                              0, 0};
+      chunks.push_back(c);
+    }
+    const uint32_t chunkIndices = MESH_CODEC_CHUNK_TRIANGLES * 3;
+    for (uint32_t i = 0; i + 2 < blob.indexCount; i += chunkIndices) {
+      MeshContainerChunk c = {MESH_CHUNK_INDICES, i,
+                              min(chunkIndices, blob.indexCount / 3 * 3 - i),
+                              0, 0};
+      chunks.push_back(c);
+    }
+    e.chunkCount = (uint32_t)chunks.size() - e.firstChunk;
+  }
+  header.chunkCount = (uint32_t)chunks.size();
+
+  // compress everything up front so the tables can be written first
+  vector<vector<unsigned char> > compressed(chunks.size());
+  vector<unsigned char> planes;
+  for (size_t m = 0, k = 0; m < meshes.size(); m++) {
+    const MeshCacheBlob &blob = meshes[m];
+    for (uint32_t n = 0; n < table[m].chunkCount; n++, k++) {
+      MeshContainerChunk &c = chunks[k];
+      if (c.kind == MESH_CHUNK_VERTICES) {
+        planes.resize((size_t)c.count * vertexStride);
+        encodeVertexPlanes((const unsigned char *)blob.vertices +
+                               (size_t)c.first * vertexStride,
+                           c.count, vertexStride, planes.data());
+      } else {
+        planes.resize((size_t)c.count * 4);
+        encodeIndexPlanes(blob.indices + c.first, c.count, planes.data());
+      }
+      uLongf bytes = compressBound((uLong)planes.size());
+      compressed[k].resize(bytes);
+      if (compress2(compressed[k].data(), &bytes, planes.data(),
+                    (uLong)planes.size(), level) != Z_OK)
+        return false;
+      compressed[k].resize(bytes);
+      c.compressedBytes = (uint32_t)bytes;
+    }
+  }
+
+  uint64_t offset =
+      codecAlign(sizeof(header) + table.size() * sizeof(table[0]) +
+                 chunks.size() * sizeof(chunks[0]));
+  for (size_t m = 0; m < meshes.size(); m++) {
+    table[m].lodOffset = offset;
+    offset = codecAlign(offset + meshes[m].lodCount * sizeof(MeshLod));
+    table[m].meshletOffset = offset;
+    offset = codecAlign(offset + meshes[m].meshletCount * sizeof(Meshlet));
+  }
+  for (size_t k = 0; k < chunks.size(); k++) {
+    chunks[k].offset = offset;
+    offset = codecAlign(offset + compressed[k].size());
+  }
+
+  image.assign(offset, 0);
+  codecWriteAt(image, 0, &header, sizeof(header));
+  codecWriteAt(image, sizeof(header), table.data(),
+               table.size() * sizeof(table[0]));
+  codecWriteAt(image, sizeof(header) + table.size() * sizeof(table[0]),
+               chunks.data(), chunks.size() * sizeof(chunks[0]));
+  for (size_t m = 0; m < meshes.size(); m++) {
+    codecWriteAt(image, table[m].lodOffset, meshes[m].lods,
+                 meshes[m].lodCount * sizeof(MeshLod));
+    codecWriteAt(image, table[m].meshletOffset, meshes[m].meshlets,
+                 meshes[m].meshletCount * sizeof(Meshlet));
+  }
+  for (size_t k = 0; k < chunks.size(); k++)
+    codecWriteAt(image, chunks[k].offset, compressed[k].data(),
+                 compressed[k].size());
+  return true;
+}
+
+// Encodes meshes and writes them to path, through a temporary file.
+inline bool writeMeshContainer(const string &path,
+                               const vector<MeshCacheBlob> &meshes,
+                               uint32_t vertexStride,
+                               int level = Z_BEST_COMPRESSION) {
+  vector<unsigned char> image;
+  if (!encodeMeshContainer(meshes, vertexStride, image, level))
+    return false;
+
+  string tmpPath = path + ".tmp";
+  ofstream out(tmpPath.c_str(), ios::binary | ios::trunc);
+  if (!out) {
+    cout << "ERROR::MESH_CODEC::CANNOT_WRITE " << path << endl;
+    return false;
+  }
+  out.write((const char *)image.data(), (streamsize)image.size());
+  out.close();
+  if (!out || rename(tmpPath.c_str(), path.c_str()) != 0) {
+    remove(tmpPath.c_str());
+    cout << "ERROR::MESH_CODEC::CANNOT_WRITE " << path << endl;
+    return false;
+  }
+  return true;
+}
+
+// ---- reading ----
+
+// Read side of the container. open() validates the tables of a file or an
+// in-memory image (which must outlive the reader); decode() then fills
+// caller-provided arrays, spreading the chunks over the pool.
+class MeshContainer {
+public:
+  MeshContainer() : data(nullptr), size(0), header() {}
+
+  MeshContainer(const MeshContainer &) = delete;
+  MeshContainer &operator=(const MeshContainer &) = delete;
+
+  bool open(const string &path) {
+    file = make_shared<MappedFile>(path, MADV_SEQUENTIAL);
+    if (!file->valid()) {
+      cout << "ERROR::MESH_CODEC::CANNOT_OPEN " << path << endl;
+      return false;
+    }
+    return open(file->bytes(), file->length());
+  }
+
+  bool open(const unsigned char *bytes, size_t length) {
+    data = bytes;
+    size = length;
+    meshes = nullptr;
+    chunks = nullptr;
+    if (size < sizeof(header))
+      return invalid();
+    memcpy(&header, data, sizeof(header));
+    size_t tables = sizeof(header) +
+                    (size_t)header.meshCount * sizeof(MeshContainerMesh) +
+                    (size_t)header.chunkCount * sizeof(MeshContainerChunk);
+    if (header.magic != MESH_CONTAINER_MAGIC ||
+        header.version != MESH_CONTAINER_VERSION ||
+        header.vertexStride % 4 != 0 || header.vertexStride == 0 ||
+        header.vertexStride > 256 ||
+        tables > size)
+      return invalid();
+    meshes = (const MeshContainerMesh *)(data + sizeof(header));
+    chunks = (const MeshContainerChunk *)(meshes + header.meshCount);
+
+    // Counts are checked against each other and, through the compressed
+    // sizes, against the file, so a corrupt one cannot ask the loader for
+    // gigabytes.
+    for (uint32_t m = 0; m < header.meshCount; m++) {
+      const MeshContainerMesh &e = meshes[m];
+      if (e.indexCount % 3 != 0 || e.firstChunk > header.chunkCount ||
+          e.chunkCount > header.chunkCount - e.firstChunk ||
+          !inside(e.lodOffset, (uint64_t)e.lodCount * sizeof(MeshLod)) ||
+          !inside(e.meshletOffset,
+                  (uint64_t)e.meshletCount * sizeof(Meshlet)))
+        return invalid();
+      uint64_t vertices = 0, indices = 0;
+      for (uint32_t k = e.firstChunk; k < e.firstChunk + e.chunkCount; k++) {
+        const MeshContainerChunk &c = chunks[k];
+        uint64_t &covered = c.kind == MESH_CHUNK_VERTICES ? vertices : indices;
+        uint64_t bytes = (uint64_t)c.count *
+                         (c.kind == MESH_CHUNK_VERTICES ? header.vertexStride
+                                                        : 4);
+        if (c.kind > MESH_CHUNK_INDICES || c.first != covered ||
+            !inside(c.offset, c.compressedBytes) ||
+            bytes > c.compressedBytes * MESH_CODEC_MAX_EXPANSION ||
+            (c.kind == MESH_CHUNK_INDICES && c.count % 3 != 0))
+          return invalid();
+        covered += c.count;
+      }
+      if (vertices != e.vertexCount || indices != e.indexCount ||
+          !rangesInside(lods(m), e.lodCount, e.indexCount, false) ||
+          !rangesInside(meshlets(m), e.meshletCount, e.indexCount, true))
+        return invalid();
+    }
+    return true;
+  }
+
+  uint32_t meshCount() const { return header.meshCount; }
+  uint32_t vertexStride() const { return header.vertexStride; }
+  const MeshContainerMesh &mesh(uint32_t m) const { return meshes[m]; }
+
+  const MeshLod *lods(uint32_t m) const {
+    return (const MeshLod *)(data + meshes[m].lodOffset);
+  }
+  const Meshlet *meshlets(uint32_t m) const {
+    return (const Meshlet *)(data + meshes[m].meshletOffset);
+  }
+
+  // vertices[m] / indices[m] must hold mesh m's vertexCount * stride bytes
+  // and indexCount indices. Fails on corrupt chunks or out-of-range indices.
+  bool decode(void *const *vertices, unsigned int *const *indices,
+              ThreadPool *pool = nullptr) const {
+    vector<uint32_t> owner(header.chunkCount);
+    for (uint32_t m = 0; m < header.meshCount; m++)
+      for (uint32_t k = 0; k < meshes[m].chunkCount; k++)
+        owner[meshes[m].firstChunk + k] = m;
+
+    atomic<bool> failed(false);
+    const size_t stride = header.vertexStride;
+    parallelFor(pool, header.chunkCount, [&](size_t k) {
+      const MeshContainerChunk &c = chunks[k];
+      const MeshContainerMesh &e = meshes[owner[k]];
+      size_t expected =
+          (size_t)c.count * (c.kind == MESH_CHUNK_VERTICES ? stride : 4);
+
+      ScratchArena &scratch = importScratch();
+      ScratchScope scope(scratch);
+      unsigned char *planes = scratch.alloc<unsigned char>(expected);
+      uLongf bytes = (uLongf)expected;
+      if (uncompress(planes, &bytes, data + c.offset, c.compressedBytes) !=
+              Z_OK ||
+          bytes != expected) {
+        failed = true;
+        return;
+      }
+
+      if (c.kind == MESH_CHUNK_VERTICES) {
+        decodeVertexPlanes(planes, c.count, stride,
+                           (unsigned char *)vertices[owner[k]] +
+                               (size_t)c.first * stride);
+      } else {
+        if (!decodeIndexPlanes(planes, c.count, e.vertexCount,
+                               indices[owner[k]] + c.first))
+          failed = true;
+      }
+    });
+
+    if (failed) {
+      cout << "ERROR::MESH_CODEC::CORRUPT_DATA" << endl;
+      return false;
+    }
+    return true;
+  }
+
+private:
+  shared_ptr<MappedFile> file; // when opened from a path
+  const unsigned char *data;
+  size_t size;
+  MeshContainerHeader header;
+  const MeshContainerMesh *meshes;
+  const MeshContainerChunk *chunks;
+
+  bool inside(uint64_t offset, uint64_t bytes) const {
+    return offset <= size && bytes <= size - offset;
+  }
+
+  bool invalid() {
+    cout << "ERROR::MESH_CODEC::INVALID_CONTAINER" << endl;
+    meshes = nullptr;
+    chunks = nullptr;
+    header.meshCount = header.chunkCount = 0;
+    return false;
+  }
+};
+
+#endif
@@ -0,0 +1,283 @@
+#ifndef MESH_NORMALS_H
+#define MESH_NORMALS_H
+
+#include "scratch_arena.h"
+#include "thread_pool.h"
+#include "vertex_packing.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+// Import-time smooth normals for vertices that arrive without one (a zero
+// Normal). Each face contributes to a corner in proportion to its area times
+// the corner angle, so long slivers and fan centres do not skew the result,
+// and only faces within the crease angle of the corner's own face are
+// averaged: hard edges stay hard and everything else is smooth. Vertices on
+// a crease are split, one per distinct normal.
+//
+// The work is laid out for the thread pool:
+//  1. face normals and corner weights, per triangle chunk, from positions
+//     gathered into structure-of-arrays form so the arithmetic loop
+//     vectorizes;
+//  2. a position -> corner adjacency built once;
+//  3. per corner chunk, each corner gathers the weighted normals of its
+//     neighbours. Every corner writes only its own result, so there is no
+//     scattered accumulation to merge or synchronize.
+// Vertices that already have a normal are left as they are.
+
+const float NORMAL_CREASE_ANGLE = 60.0f; // degrees
+const size_t NORMAL_CHUNK_TRIANGLES = 16384;
+const size_t NORMAL_BLOCK_TRIANGLES = 256; // gathered at a time, on the stack
+
+// Per-triangle face data, one array per component.
+struct FaceNormals {
+  float *x, *y, *z; // unit face normal, zero for degenerate triangles
+  float *weight[3]; // area * corner angle, per corner
+};
+
+// Face normals and corner weights for triangles [begin, end).
+inline void computeFaceNormals(const Vertex *vertices,
+                               const unsigned int *indices, size_t begin,
+                               size_t end, FaceNormals &faces) {
+  float p[9][NORMAL_BLOCK_TRIANGLES];
+  for (size_t block = begin; block < end; block += NORMAL_BLOCK_TRIANGLES) {
+    size_t count = min(NORMAL_BLOCK_TRIANGLES, end - block);
+    for (size_t i = 0; i < count; i++) {
+      for (int k = 0; k < 3; k++) {
+        const glm::vec3 &v = vertices[indices[(block + i) * 3 + k]].Position;
+        p[k * 3 + 0][i] = v.x;
+        p[k * 3 + 1][i] = v.y;
+        p[k * 3 + 2][i] = v.z;
+      }
+    }
+
+    float *fx = faces.x + block, *fy = faces.y + block, *fz = faces.z + block;
+    float *w0 = faces.weight[0] + block, *w1 = faces.weight[1] + block,
+          *w2 = faces.weight[2] + block;
+    for (size_t i = 0; i < count; i++) {
+      // edges: e0 = p1 - p0, e1 = p2 - p1, e2 = p0 - p2
+      float e0x = p[3][i] - p[0][i], e0y = p[4][i] - p[1][i],
+            e0z = p[5][i] - p[2][i];
+      float e1x = p[6][i] - p[3][i], e1y = p[7][i] - p[4][i],
+            e1z = p[8][i] - p[5][i];
+      float e2x = p[0][i] - p[6][i], e2y = p[1][i] - p[7][i],
+            e2z = p[2][i] - p[8][i];
+
+      // e2 x e0 == (p1 - p0) x (p2 - p0), twice the area long
+      float nx = e2y * e0z - e2z * e0y;
+      float ny = e2z * e0x - e2x * e0z;
+      float nz = e2x * e0y - e2y * e0x;
+      float doubleArea = sqrtf(nx * nx + ny * ny + nz * nz);
+      float inv = doubleArea > 0.0f ? 1.0f / doubleArea : 0.0f;
+      fx[i] = nx * inv;
+      fy[i] = ny * inv;
+      fz[i] = nz * inv;
+
+      float l0 = sqrtf(e0x * e0x + e0y * e0y + e0z * e0z);
+      float l1 = sqrtf(e1x * e1x + e1y * e1y + e1z * e1z);
+      float l2 = sqrtf(e2x * e2x + e2y * e2y + e2z * e2z);
+      float i0 = l0 > 0.0f ? 1.0f / l0 : 0.0f;
+      float i1 = l1 > 0.0f ? 1.0f / l1 : 0.0f;
+      float i2 = l2 > 0.0f ? 1.0f / l2 : 0.0f;
+      float c0 = -(e0x * e2x + e0y * e2y + e0z * e2z) * i0 * i2;
+      float c1 = -(e1x * e0x + e1y * e0y + e1z * e0z) * i1 * i0;
+      float c2 = -(e2x * e1x + e2y * e1y + e2z * e1z) * i2 * i1;
+      float area = doubleArea * 0.5f;
+      w0[i] = area * acosf(max(-1.0f, min(1.0f, c0)));
+      w1[i] = area * acosf(max(-1.0f, min(1.0f, c1)));
+      w2[i] = area * acosf(max(-1.0f, min(1.0f, c2)));
+    }
+  }
+}
+
+// Bit pattern for hashing; -0 and +0 compare equal, so they hash equal too.
+inline uint32_t normalHashFloat(float f) {
+  if (f == 0.0f)
+    return 0;
+  uint32_t bits;
+  memcpy(&bits, &f, sizeof(bits));
+  return bits;
+}
+
+// Fills in missing (zero) normals. Returns the number of vertices that got a
+// generated normal, counting crease splits.
+inline size_t generateNormals(vector<Vertex> &vertices,
+                              vector<unsigned int> &indices,
+                              float creaseAngle = NORMAL_CREASE_ANGLE,
+                              ThreadPool *pool = nullptr) {
+  const glm::vec3 zero(0.0f);
+  size_t vertexCount = vertices.size();
+  size_t faceCount = indices.size() / 3;
+  ScratchArena &scratch = importScratch();
+  ScratchScope scope(scratch);
+
+  uint8_t *missing = scratch.alloc<uint8_t>(vertexCount);
+  size_t missingCount = 0;
+  for (size_t i = 0; i < vertexCount; i++)
+    missingCount += missing[i] = vertices[i].Normal == zero;
+  if (missingCount == 0)
+    return 0;
+
+  // Vertices at the same position smooth together even if the importer kept
+  // them apart (different texture coordinates, say).
+  uint32_t *positionId = scratch.alloc<uint32_t>(vertexCount);
+  size_t capacity = 16;
+  while (capacity < vertexCount * 2)
+    capacity *= 2;
+  uint32_t *table = scratch.alloc<uint32_t>(capacity);
+  memset(table, 0xff, capacity * sizeof(uint32_t));
+  uint32_t *representative = scratch.alloc<uint32_t>(vertexCount);
+  size_t positionCount = 0;
+  for (size_t i = 0; i < vertexCount; i++) {
+    const glm::vec3 &p = vertices[i].Position;
+    uint32_t h = normalHashFloat(p.x) * 73856093u ^
+                 normalHashFloat(p.y) * 19349663u ^
+                 normalHashFloat(p.z) * 83492791u;
+    size_t slot = h & (capacity - 1);
+    for (;;) {
+      uint32_t id = table[slot];
+      if (id == ~0u) {
+        table[slot] = (uint32_t)positionCount;
+        representative[positionCount] = (uint32_t)i;
+        positionId[i] = (uint32_t)positionCount++;
+        break;
+      }
+      if (vertices[representative[id]].Position == p) {
+        positionId[i] = id;
+        break;
+      }
+      slot = (slot + 1) & (capacity - 1);
+    }
+  }
+
+  FaceNormals faces;
+  faces.x = scratch.alloc<float>(faceCount);
+  faces.y = scratch.alloc<float>(faceCount);
+  faces.z = scratch.alloc<float>(faceCount);
+  for (int k = 0; k < 3; k++)
+    faces.weight[k] = scratch.alloc<float>(faceCount);
+
+  const Vertex *vertexData = vertices.data();
+  const unsigned int *indexData = indices.data();
+  size_t chunks = (faceCount + NORMAL_CHUNK_TRIANGLES - 1) /
+                  NORMAL_CHUNK_TRIANGLES;
+  parallelFor(pool, chunks, [&](size_t c) {
+    size_t begin = c * NORMAL_CHUNK_TRIANGLES;
+    size_t end = min(faceCount, begin + NORMAL_CHUNK_TRIANGLES);
+    computeFaceNormals(vertexData, indexData, begin, end, faces);
+  });
+
+  // position -> corners (CSR)
+  size_t cornerCount = faceCount * 3;
+  uint32_t *offsets = scratch.allocZeroed<uint32_t>(positionCount + 1);
+  for (size_t c = 0; c < cornerCount; c++)
+    offsets[positionId[indexData[c]] + 1]++;
+  for (size_t p = 0; p < positionCount; p++)
+    offsets[p + 1] += offsets[p];
+  uint32_t *adjacency = scratch.alloc<uint32_t>(cornerCount);
+  uint32_t *fill = scratch.alloc<uint32_t>(positionCount);
+  memcpy(fill, offsets, positionCount * sizeof(uint32_t));
+  for (size_t c = 0; c < cornerCount; c++)
+    adjacency[fill[positionId[indexData[c]]]++] = (uint32_t)c;
+
+  // Each corner of a vertex without a normal gathers from its neighbours.
+  glm::vec3 *cornerNormals = scratch.alloc<glm::vec3>(cornerCount);
+  const float cosCrease = cosf(glm::radians(creaseAngle));
+  parallelFor(pool, chunks, [&](size_t chunk) {
+    size_t begin = chunk * NORMAL_CHUNK_TRIANGLES * 3;
+    size_t end = min(cornerCount, begin + NORMAL_CHUNK_TRIANGLES * 3);
+    for (size_t c = begin; c < end; c++) {
+      unsigned int v = indexData[c];
+      if (!missing[v])
+        continue;
+      size_t t = c / 3;
+      float fx = faces.x[t], fy = faces.y[t], fz = faces.z[t];
+      // a degenerate face has no direction to crease against: take all
+      float threshold = fx == 0.0f && fy == 0.0f && fz == 0.0f ? -2.0f
+                                                               : cosCrease;
+
+      float nx = 0.0f, ny = 0.0f, nz = 0.0f;
+      uint32_t p = positionId[v];
+      for (uint32_t a = offsets[p]; a < offsets[p + 1]; a++) {
+        uint32_t other = adjacency[a];
+        size_t u = other / 3;
+        float ux = faces.x[u], uy = faces.y[u], uz = faces.z[u];
+        if (fx * ux + fy * uy + fz * uz >= threshold) {
+          float w = faces.weight[other % 3][u];
+          nx += ux * w;
+          ny += uy * w;
+          nz += uz * w;
+        }
+      }
+      float length = sqrtf(nx * nx + ny * ny + nz * nz);
+      if (length > 0.0f)
+        cornerNormals[c] = glm::vec3(nx, ny, nz) / length;
+      else if (threshold < -1.0f)
+        cornerNormals[c] = glm::vec3(0.0f, 1.0f, 0.0f);
+      else
+        cornerNormals[c] = glm::vec3(fx, fy, fz);
+    }
+  });
+
+  // Corners of one vertex whose neighbour sets match produce bit-identical
+  // normals, so exact compares decide the splits. The first normal a vertex
+  // receives goes into its own slot; any other (across a crease) gets a copy
+  // of the vertex, found again through a hash on (vertex, normal).
+  size_t splitCapacity = 16;
+  while (splitCapacity < cornerCount * 2)
+    splitCapacity *= 2;
+  uint32_t *splits = scratch.alloc<uint32_t>(splitCapacity);
+  memset(splits, 0xff, splitCapacity * sizeof(uint32_t));
+  uint8_t *assigned = scratch.allocZeroed<uint8_t>(vertexCount);
+  vector<uint32_t> splitOrigin; // original vertex of each appended copy
+
+  size_t generated = 0;
+  for (size_t c = 0; c < cornerCount; c++) {
+    unsigned int v = indices[c];
+    if (!missing[v])
+      continue;
+    const glm::vec3 &n = cornerNormals[c];
+    if (!assigned[v]) {
+      vertices[v].Normal = n;
+      assigned[v] = 1;
+      generated++;
+      continue;
+    }
+    if (vertices[v].Normal == n)
+      continue;
+
+    uint32_t h = v * 2654435761u ^ normalHashFloat(n.x) * 73856093u ^
+                 normalHashFloat(n.y) * 19349663u ^
+                 normalHashFloat(n.z) * 83492791u;
+    size_t slot = h & (splitCapacity - 1);
+    for (;;) {
+      uint32_t id = splits[slot];
+      if (id == ~0u) {
+        id = (uint32_t)vertices.size();
+        Vertex copy = vertices[v];
+        copy.Normal = n;
+        vertices.push_back(copy);
+        splitOrigin.push_back(v);
+        splits[slot] = id;
+        indices[c] = id;
+        generated++;
+        break;
+      }
+      if (splitOrigin[id - vertexCount] == v && vertices[id].Normal == n) {
+        indices[c] = id;
+        break;
+      }
+      slot = (slot + 1) & (splitCapacity - 1);
+    }
+  }
+  return generated;
+}
+
+#endif
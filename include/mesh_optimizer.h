@@ -0,0 +1,325 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include "mesh_cache.h"
+#include "scratch_arena.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+// Import-time reordering of index and vertex data for the GPU:
+//  1. Tipsify (Sander et al. 2007) triangle order for the post-transform
+//     vertex cache.
+//  2. Overdraw-aware cluster ordering on top of it: clusters that face
+//     outwards are drawn first so the early depth test rejects more of the
+//     expensive refraction fragments behind them.
+//  3. Vertex fetch order, renumbering vertices by first use.
+// All functions work on plain arrays so they run on worker threads, and take
+// their temporaries from the thread's import scratch arena.
+
+const unsigned int VERTEX_CACHE_SIZE = 16;
+
+struct VertexCacheStats {
+  float acmr; // transformed vertices per triangle (0.5 .. 3)
+  float atvr; // transformed vertices per vertex (1 is optimal)
+};
+
+// Simulates a FIFO post-transform cache of the given size.
+inline VertexCacheStats analyzeVertexCache(const unsigned int *indices,
+                                           size_t indexCount,
+                                           size_t vertexCount,
+                                           unsigned int cacheSize) {
+  VertexCacheStats stats = {0.0f, 0.0f};
+  if (indexCount < 3 || vertexCount == 0)
+    return stats;
+
+  ScratchScope scope(importScratch());
+  // timestamps[v] is when v last entered the cache
+  size_t *timestamps = importScratch().allocZeroed<size_t>(vertexCount);
+  size_t time = cacheSize + 1;
+  size_t misses = 0;
+  for (size_t i = 0; i < indexCount; i++) {
+    unsigned int v = indices[i];
+    if (time - timestamps[v] > cacheSize) {
+      timestamps[v] = time++;
+      misses++;
+    }
+  }
+
+  stats.acmr = (float)misses / (float)(indexCount / 3);
+  stats.atvr = (float)misses / (float)vertexCount;
+  return stats;
+}
+
+// Tipsify: greedy fanning around the most recently used vertex that is still
+// in the cache, in linear time. Writes the reordered triangles to
+// `destination`. `clusters` receives the triangle index at which each hard
+// cache boundary starts (when the walk had to jump to an unrelated vertex);
+// these are the cluster seams used by the overdraw pass.
+inline void tipsifyIndices(unsigned int *destination,
+                           const unsigned int *indices, size_t indexCount,
+                           size_t vertexCount, unsigned int cacheSize,
+                           vector<unsigned int> &clusters) {
+  size_t faceCount = indexCount / 3;
+  clusters.clear();
+  if (faceCount == 0)
+    return;
+
+  ScratchArena &scratch = importScratch();
+  ScratchScope scope(scratch);
+
+  // vertex -> triangle adjacency (CSR)
+  unsigned int *liveTriangles = scratch.allocZeroed<unsigned int>(vertexCount);
+  for (size_t i = 0; i < indexCount; i++)
+    liveTriangles[indices[i]]++;
+
+  unsigned int *offsets = scratch.alloc<unsigned int>(vertexCount + 1);
+  unsigned int maxValence = 0;
+  offsets[0] = 0;
+  for (size_t v = 0; v < vertexCount; v++) {
+    offsets[v + 1] = offsets[v] + liveTriangles[v];
+    maxValence = max(maxValence, liveTriangles[v]);
+  }
+
+  unsigned int *adjacency = scratch.alloc<unsigned int>(indexCount);
+  unsigned int *fill = scratch.alloc<unsigned int>(vertexCount);
+  copy(offsets, offsets + vertexCount, fill);
+  for (size_t i = 0; i < indexCount; i++)
+    adjacency[fill[indices[i]]++] = (unsigned int)(i / 3);
+
+  char *emitted = scratch.allocZeroed<char>(faceCount);
+  size_t *cacheTime = scratch.allocZeroed<size_t>(vertexCount);
+  unsigned int *deadEnd = scratch.alloc<unsigned int>(indexCount);
+  size_t deadEndSize = 0;
+
+  // one fan emits at most maxValence triangles
+  unsigned int *candidates = scratch.alloc<unsigned int>(3 * maxValence);
+  size_t candidateCount = 0;
+
+  size_t time = cacheSize + 1;
+  size_t cursor = 0; // scan position for the next non-dead vertex
+  size_t out = 0;
+  int fanning = 0; // current fanning vertex
+  clusters.push_back(0);
+
+  while (fanning >= 0) {
+    candidateCount = 0;
+
+    // emit every live triangle around the fanning vertex
+    for (unsigned int k = offsets[fanning]; k < offsets[fanning + 1]; k++) {
+      unsigned int t = adjacency[k];
+      if (emitted[t])
+        continue;
+      for (int c = 0; c < 3; c++) {
+        unsigned int v = indices[t * 3 + c];
+        destination[out++] = v;
+        deadEnd[deadEndSize++] = v;
+        candidates[candidateCount++] = v;
+        liveTriangles[v]--;
+        if (time - cacheTime[v] > cacheSize)
+          cacheTime[v] = time++;
+      }
+      emitted[t] = 1;
+    }
+
+    // pick the oldest candidate that will still be in cache after its own
+    // fan has been emitted
+    int best = -1;
+    int bestPriority = 0;
+    for (size_t i = 0; i < candidateCount; i++) {
+      unsigned int v = candidates[i];
+      if (liveTriangles[v] == 0)
+        continue;
+      int priority = 0;
+      if (time - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize)
+        priority = (int)(time - cacheTime[v]);
+      if (priority > bestPriority) {
+        bestPriority = priority;
+        best = (int)v;
+      }
+    }
+
+    if (best < 0) {
+      // fall back to the dead-end stack, then to a linear scan
+      while (deadEndSize > 0) {
+        unsigned int v = deadEnd[--deadEndSize];
+        if (liveTriangles[v] > 0) {
+          best = (int)v;
+          break;
+        }
+      }
+      if (best < 0) {
+        while (cursor < vertexCount && liveTriangles[cursor] == 0)
+          cursor++;
+        if (cursor < vertexCount)
+          best = (int)cursor;
+      }
+      if (best >= 0 && out / 3 != clusters.back())
+        clusters.push_back((unsigned int)(out / 3));
+    }
+    fanning = best;
+  }
+}
+
+// Reorders the clusters produced by tipsifyIndices so that outward-facing
+// clusters near the silhouette are drawn before the ones behind them. Each
+// cluster is scored by how far along its average normal it sits from the
+// mesh centroid (Sander et al., "Fast triangle reordering for vertex
+// locality and reduced overdraw"). The vertex cache order inside a cluster is
+// kept, so ACMR only changes by the cost of the new seams.
+inline void optimizeOverdraw(unsigned int *destination,
+                             const unsigned int *indices, size_t indexCount,
+                             const float *positions, size_t vertexStride,
+                             const vector<unsigned int> &clusters) {
+  size_t faceCount = indexCount / 3;
+  size_t clusterCount = clusters.size();
+  if (clusterCount <= 1) {
+    copy(indices, indices + indexCount, destination);
+    return;
+  }
+
+  ScratchArena &scratch = importScratch();
+  ScratchScope scope(scratch);
+
+  const size_t stride = vertexStride / sizeof(float);
+  glm::vec3 meshCentroid(0.0f);
+  float meshArea = 0.0f;
+
+  glm::vec3 *centroid = scratch.alloc<glm::vec3>(clusterCount);
+  glm::vec3 *normal = scratch.alloc<glm::vec3>(clusterCount);
+  float *area = scratch.allocZeroed<float>(clusterCount);
+  fill_n(centroid, clusterCount, glm::vec3(0.0f));
+  fill_n(normal, clusterCount, glm::vec3(0.0f));
+
+  for (size_t c = 0; c < clusterCount; c++) {
+    size_t end = c + 1 < clusterCount ? clusters[c + 1] : faceCount;
+    for (size_t t = clusters[c]; t < end; t++) {
+      const float *p0 = positions + indices[t * 3 + 0] * stride;
+      const float *p1 = positions + indices[t * 3 + 1] * stride;
+      const float *p2 = positions + indices[t * 3 + 2] * stride;
+      glm::vec3 a(p0[0], p0[1], p0[2]);
+      glm::vec3 b(p1[0], p1[1], p1[2]);
+      glm::vec3 d(p2[0], p2[1], p2[2]);
+
+      glm::vec3 n = glm::cross(b - a, d - a);
+      float twiceArea = glm::length(n);
+      glm::vec3 center = (a + b + d) / 3.0f;
+
+      normal[c] += n;
+      centroid[c] += center * twiceArea;
+      area[c] += twiceArea;
+      meshCentroid += center * twiceArea;
+      meshArea += twiceArea;
+    }
+  }
+  if (meshArea > 0.0f)
+    meshCentroid /= meshArea;
+
+  float *score = scratch.allocZeroed<float>(clusterCount);
+  unsigned int *order = scratch.alloc<unsigned int>(clusterCount);
+  for (size_t c = 0; c < clusterCount; c++) {
+    order[c] = (unsigned int)c;
+    if (area[c] <= 0.0f)
+      continue;
+    glm::vec3 center = centroid[c] / area[c];
+    float len = glm::length(normal[c]);
+    glm::vec3 n = len > 0.0f ? normal[c] / len : glm::vec3(0.0f);
+    score[c] = glm::dot(center - meshCentroid, n);
+  }
+
+  stable_sort(order, order + clusterCount,
+              [&score](unsigned int a, unsigned int b) {
+                return score[a] > score[b];
+              });
+
+  size_t out = 0;
+  for (size_t i = 0; i < clusterCount; i++) {
+    unsigned int c = order[i];
+    size_t end = c + 1 < clusterCount ? clusters[c + 1] : faceCount;
+    for (size_t t = clusters[c]; t < end; t++)
+      for (int k = 0; k < 3; k++)
+        destination[out++] = indices[t * 3 + k];
+  }
+}
+
+// Renumbers vertices in order of first use by the index buffer and reorders
+// the vertex array to match, so vertex fetch walks memory linearly.
+// Unreferenced vertices are dropped; returns the new vertex count.
+template <typename V>
+size_t optimizeVertexFetch(vector<V> &vertices, vector<unsigned int> &indices) {
+  ScratchArena &scratch = importScratch();
+  ScratchScope scope(scratch);
+
+  const unsigned int unused = ~0u;
+  unsigned int *remap = scratch.alloc<unsigned int>(vertices.size());
+  fill_n(remap, vertices.size(), unused);
+  V *reordered = scratch.alloc<V>(vertices.size());
+  size_t count = 0;
+
+  for (size_t i = 0; i < indices.size(); i++) {
+    unsigned int &slot = remap[indices[i]];
+    if (slot == unused) {
+      slot = (unsigned int)count;
+      reordered[count++] = vertices[indices[i]];
+    }
+    indices[i] = slot;
+  }
+
+  // shrinking never reallocates
+  copy(reordered, reordered + count, vertices.begin());
+  vertices.resize(count);
+  return count;
+}
+
+// Runs the full pass in place and prints before/after ACMR and ATVR of the
+// full-resolution level. Each LOD range is reordered on its own; vertex fetch
+// order follows LOD 0, whose vertices every coarser level reuses.
+template <typename V>
+void optimizeMesh(vector<V> &vertices, vector<unsigned int> &indices,
+                  const vector<MeshLod> &lods, const char *label) {
+  if (indices.size() < 3 || vertices.empty() || lods.empty())
+    return;
+
+  VertexCacheStats before = analyzeVertexCache(
+      indices.data(), lods[0].indexCount, vertices.size(), VERTEX_CACHE_SIZE);
+
+  ScratchScope scope(importScratch());
+  unsigned int *copyBuffer =
+      importScratch().alloc<unsigned int>(lods[0].indexCount);
+  vector<unsigned int> clusters;
+  size_t clusterCount = 0;
+  for (size_t l = 0; l < lods.size(); l++) {
+    // coarser levels are never larger than LOD 0
+    unsigned int *range = indices.data() + lods[l].indexOffset;
+    size_t count = lods[l].indexCount;
+    copy(range, range + count, copyBuffer);
+    tipsifyIndices(range, copyBuffer, count, vertices.size(),
+                   VERTEX_CACHE_SIZE, clusters);
+    copy(range, range + count, copyBuffer);
+    optimizeOverdraw(range, copyBuffer, count,
+                     (const float *)vertices.data(), sizeof(V), clusters);
+    if (l == 0)
+      clusterCount = clusters.size();
+  }
+  optimizeVertexFetch(vertices, indices);
+
+  VertexCacheStats after = analyzeVertexCache(
+      indices.data(), lods[0].indexCount, vertices.size(), VERTEX_CACHE_SIZE);
+
+  char line[160];
+  snprintf(line, sizeof(line),
+           "MESH_OPTIMIZER::%s ACMR %.3f -> %.3f, ATVR %.3f -> %.3f "
+           "(%zu clusters, %zu LODs)",
+           label, before.acmr, after.acmr, before.atvr, after.atvr,
+           clusterCount, lods.size());
+  cout << line << endl;
+}
+
+#endif
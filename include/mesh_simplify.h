@@ -0,0 +1,441 @@
+#ifndef MESH_SIMPLIFY_H
+#define MESH_SIMPLIFY_H
+
+#include "mesh_cache.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+// Quadric error metric edge-collapse simplification (Garland & Heckbert) used
+// to build the LOD chain at import time.
+//
+// Collapses happen between welded positions rather than vertices, so normal
+// seams do not block simplification; each surviving triangle corner then
+// picks the vertex at its new position whose normal best matches the one it
+// had. The collapse cost adds a heavily weighted normal deviation term to the
+// geometric quadric error, because refraction through the surface magnifies
+// normal error far more than silhouette error.
+
+// Cost weight of normal deviation, in units of squared edge length.
+const float LOD_NORMAL_WEIGHT = 8.0f;
+// Coarsest LODs may deviate from the source by this fraction of the extent.
+const float LOD_MAX_ERROR = 0.05f;
+const unsigned int LOD_MIN_TRIANGLES = 64;
+
+struct Quadric {
+  double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+  double weight;
+
+  Quadric()
+      : a2(0), ab(0), ac(0), ad(0), b2(0), bc(0), bd(0), c2(0), cd(0), d2(0),
+        weight(0) {}
+
+  // plane n.x + d = 0 with unit n
+  void addPlane(const glm::vec3 &n, float d, double w) {
+    a2 += w * n.x * n.x;
+    ab += w * n.x * n.y;
+    ac += w * n.x * n.z;
+    ad += w * n.x * d;
+    b2 += w * n.y * n.y;
+    bc += w * n.y * n.z;
+    bd += w * n.y * d;
+    c2 += w * n.z * n.z;
+    cd += w * n.z * d;
+    d2 += w * d * d;
+    weight += w;
+  }
+
+  void add(const Quadric &q) {
+    a2 += q.a2;
+    ab += q.ab;
+    ac += q.ac;
+    ad += q.ad;
+    b2 += q.b2;
+    bc += q.bc;
+    bd += q.bd;
+    c2 += q.c2;
+    cd += q.cd;
+    d2 += q.d2;
+    weight += q.weight;
+  }
+
+  // area-weighted mean squared distance to the accumulated planes
+  double eval(const glm::vec3 &p) const {
+    double x = p.x, y = p.y, z = p.z;
+    double e = a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x +
+               b2 * y * y + 2 * bc * y * z + 2 * bd * y + c2 * z * z +
+               2 * cd * z + d2;
+    return weight > 0 ? fabs(e) / weight : 0.0;
+  }
+};
+
+class MeshSimplifier {
+public:
+  // positions/normals are read with the given byte stride
+  MeshSimplifier(const float *positions, const float *normals, size_t stride,
+                 size_t vertexCount, const unsigned int *indices,
+                 size_t indexCount)
+      : stride(stride / sizeof(float)), positions(positions),
+        normals(normals), vertexCount(vertexCount), maxCost(0.0) {
+    weld();
+    buildTriangles(indices, indexCount);
+    buildQuadrics();
+    lockBorders();
+    for (size_t t = 0; t < triCount(); t++)
+      for (int k = 0; k < 3; k++) {
+        unsigned int a = triGroups[t * 3 + k];
+        unsigned int b = triGroups[t * 3 + (k + 1) % 3];
+        push(a, b);
+        push(b, a);
+      }
+  }
+
+  // Collapses edges until at most targetTriangles remain or the error bound
+  // is hit. Returns false if it could not get there.
+  bool simplify(size_t targetTriangles, float maxError) {
+    double maxCostAllowed = (double)maxError * maxError;
+    while (liveTriangles > targetTriangles && !heap.empty()) {
+      Collapse c = heap.top();
+      if (c.cost > maxCostAllowed)
+        return false;
+      heap.pop();
+      if (c.fromVersion != version[c.from] || c.toVersion != version[c.to])
+        continue;
+      if (!collapse(c.from, c.to))
+        continue;
+      maxCost = max(maxCost, (double)c.cost);
+    }
+    return liveTriangles <= targetTriangles;
+  }
+
+  size_t triangleCount() const { return liveTriangles; }
+
+  // Largest deviation introduced so far, in model units.
+  float error() const { return (float)sqrt(maxCost); }
+
+  void appendIndices(vector<unsigned int> &out) const {
+    for (size_t t = 0; t < triCount(); t++)
+      if (alive[t])
+        out.insert(out.end(), triVertices.begin() + t * 3,
+                   triVertices.begin() + t * 3 + 3);
+  }
+
+private:
+  struct Collapse {
+    float cost;
+    unsigned int from, to;
+    unsigned int fromVersion, toVersion;
+
+    bool operator<(const Collapse &o) const { return cost > o.cost; }
+  };
+
+  size_t stride;
+  const float *positions;
+  const float *normals;
+  size_t vertexCount;
+
+  // vertex -> welded position group, and group -> vertices (CSR)
+  vector<unsigned int> groupOf;
+  vector<unsigned int> groupStart;
+  vector<unsigned int> groupVerts;
+  vector<glm::vec3> groupPos;
+  vector<glm::vec3> groupNormal;
+  vector<Quadric> quadrics;
+  vector<char> locked;
+  vector<unsigned int> version;
+  vector<vector<unsigned int>> groupTris;
+
+  vector<unsigned int> triVertices;
+  vector<unsigned int> triGroups;
+  vector<char> alive;
+  size_t liveTriangles;
+
+  priority_queue<Collapse> heap;
+  double maxCost;
+
+  size_t triCount() const { return triVertices.size() / 3; }
+
+  glm::vec3 pos(unsigned int v) const {
+    const float *p = positions + v * stride;
+    return glm::vec3(p[0], p[1], p[2]);
+  }
+
+  glm::vec3 nrm(unsigned int v) const {
+    const float *n = normals + v * stride;
+    return glm::vec3(n[0], n[1], n[2]);
+  }
+
+  void weld() {
+    unordered_map<uint64_t, unsigned int> lookup;
+    lookup.reserve(vertexCount);
+    groupOf.resize(vertexCount);
+
+    for (size_t v = 0; v < vertexCount; v++) {
+      const float *p = positions + v * stride;
+      uint64_t h = hashBytes(p, 3 * sizeof(float));
+      // resolve hash collisions by probing
+      for (;; h++) {
+        unordered_map<uint64_t, unsigned int>::iterator it = lookup.find(h);
+        if (it == lookup.end()) {
+          unsigned int g = (unsigned int)groupPos.size();
+          lookup[h] = g;
+          groupPos.push_back(pos((unsigned int)v));
+          groupOf[v] = g;
+          break;
+        }
+        if (groupPos[it->second] == pos((unsigned int)v)) {
+          groupOf[v] = it->second;
+          break;
+        }
+      }
+    }
+
+    size_t groups = groupPos.size();
+    groupStart.assign(groups + 1, 0);
+    for (size_t v = 0; v < vertexCount; v++)
+      groupStart[groupOf[v] + 1]++;
+    for (size_t g = 0; g < groups; g++)
+      groupStart[g + 1] += groupStart[g];
+    groupVerts.resize(vertexCount);
+    vector<unsigned int> fill(groupStart.begin(), groupStart.end() - 1);
+    for (size_t v = 0; v < vertexCount; v++)
+      groupVerts[fill[groupOf[v]]++] = (unsigned int)v;
+
+    groupNormal.assign(groups, glm::vec3(0.0f));
+    for (size_t v = 0; v < vertexCount; v++)
+      groupNormal[groupOf[v]] += nrm((unsigned int)v);
+    for (size_t g = 0; g < groups; g++) {
+      float len = glm::length(groupNormal[g]);
+      if (len > 0.0f)
+        groupNormal[g] /= len;
+    }
+
+    version.assign(groups, 0);
+    locked.assign(groups, 0);
+    groupTris.resize(groups);
+  }
+
+  void buildTriangles(const unsigned int *indices, size_t indexCount) {
+    triVertices.reserve(indexCount);
+    triGroups.reserve(indexCount);
+    for (size_t i = 0; i + 2 < indexCount; i += 3) {
+      unsigned int g0 = groupOf[indices[i]], g1 = groupOf[indices[i + 1]],
+                   g2 = groupOf[indices[i + 2]];
+      if (g0 == g1 || g1 == g2 || g0 == g2)
+        continue; // degenerate after welding
+      unsigned int t = (unsigned int)(triVertices.size() / 3);
+      for (int k = 0; k < 3; k++) {
+        triVertices.push_back(indices[i + k]);
+        triGroups.push_back(groupOf[indices[i + k]]);
+        groupTris[groupOf[indices[i + k]]].push_back(t);
+      }
+    }
+    alive.assign(triCount(), 1);
+    liveTriangles = triCount();
+  }
+
+  void buildQuadrics() {
+    quadrics.assign(groupPos.size(), Quadric());
+    for (size_t t = 0; t < triCount(); t++) {
+      glm::vec3 a = groupPos[triGroups[t * 3]];
+      glm::vec3 b = groupPos[triGroups[t * 3 + 1]];
+      glm::vec3 c = groupPos[triGroups[t * 3 + 2]];
+      glm::vec3 n = glm::cross(b - a, c - a);
+      float area = glm::length(n);
+      if (area <= 0.0f)
+        continue;
+      n /= area;
+      Quadric q;
+      q.addPlane(n, -glm::dot(n, a), area * 0.5);
+      for (int k = 0; k < 3; k++)
+        quadrics[triGroups[t * 3 + k]].add(q);
+    }
+  }
+
+  // Open edges are used by exactly one triangle; pinning their endpoints
+  // keeps holes and outlines intact.
+  void lockBorders() {
+    unordered_map<uint64_t, int> edges;
+    edges.reserve(triGroups.size());
+    for (size_t t = 0; t < triCount(); t++)
+      for (int k = 0; k < 3; k++)
+        edges[edgeKey(triGroups[t * 3 + k], triGroups[t * 3 + (k + 1) % 3])]++;
+    for (unordered_map<uint64_t, int>::iterator it = edges.begin();
+         it != edges.end(); ++it)
+      if (it->second == 1) {
+        locked[(unsigned int)(it->first >> 32)] = 1;
+        locked[(unsigned int)(it->first & 0xffffffffu)] = 1;
+      }
+  }
+
+  static uint64_t edgeKey(unsigned int a, unsigned int b) {
+    if (a > b)
+      swap(a, b);
+    return ((uint64_t)a << 32) | b;
+  }
+
+  void push(unsigned int from, unsigned int to) {
+    if (locked[from])
+      return;
+    Quadric q = quadrics[from];
+    q.add(quadrics[to]);
+    glm::vec3 edge = groupPos[to] - groupPos[from];
+    double normalCost = LOD_NORMAL_WEIGHT *
+                        (1.0 - glm::dot(groupNormal[from], groupNormal[to])) *
+                        glm::dot(edge, edge);
+    Collapse c;
+    c.cost = (float)(q.eval(groupPos[to]) + normalCost);
+    c.from = from;
+    c.to = to;
+    c.fromVersion = version[from];
+    c.toVersion = version[to];
+    heap.push(c);
+  }
+
+  // Vertex at `group` whose normal is closest to vertex v's.
+  unsigned int matchVertex(unsigned int group, unsigned int v) const {
+    glm::vec3 n = nrm(v);
+    unsigned int best = groupVerts[groupStart[group]];
+    float bestDot = -2.0f;
+    for (unsigned int i = groupStart[group]; i < groupStart[group + 1]; i++) {
+      float d = glm::dot(n, nrm(groupVerts[i]));
+      if (d > bestDot) {
+        bestDot = d;
+        best = groupVerts[i];
+      }
+    }
+    return best;
+  }
+
+  bool collapse(unsigned int from, unsigned int to) {
+    const vector<unsigned int> &tris = groupTris[from];
+
+    // reject collapses that fold a remaining triangle over
+    for (size_t i = 0; i < tris.size(); i++) {
+      unsigned int t = tris[i];
+      if (!alive[t])
+        continue;
+      glm::vec3 p[3], q[3];
+      bool sharesEdge = false;
+      for (int k = 0; k < 3; k++) {
+        unsigned int g = triGroups[t * 3 + k];
+        sharesEdge |= g == to;
+        p[k] = groupPos[g];
+        q[k] = g == from ? groupPos[to] : p[k];
+      }
+      if (sharesEdge)
+        continue;
+      glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+      glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+      if (glm::dot(before, after) < 0.2f * glm::length(before) *
+                                        glm::length(after))
+        return false;
+    }
+
+    for (size_t i = 0; i < tris.size(); i++) {
+      unsigned int t = tris[i];
+      if (!alive[t])
+        continue;
+      bool sharesEdge = false;
+      for (int k = 0; k < 3; k++)
+        sharesEdge |= triGroups[t * 3 + k] == to;
+      if (sharesEdge) {
+        alive[t] = 0;
+        liveTriangles--;
+        continue;
+      }
+      for (int k = 0; k < 3; k++)
+        if (triGroups[t * 3 + k] == from) {
+          triGroups[t * 3 + k] = to;
+          triVertices[t * 3 + k] = matchVertex(to, triVertices[t * 3 + k]);
+        }
+      groupTris[to].push_back(t);
+    }
+
+    quadrics[to].add(quadrics[from]);
+    vector<unsigned int>().swap(groupTris[from]);
+    version[from]++;
+    version[to]++;
+
+    // requeue the edges around the merged position
+    vector<unsigned int> &merged = groupTris[to];
+    size_t live = 0;
+    for (size_t i = 0; i < merged.size(); i++) {
+      unsigned int t = merged[i];
+      if (!alive[t])
+        continue;
+      merged[live++] = t;
+      for (int k = 0; k < 3; k++) {
+        unsigned int g = triGroups[t * 3 + k];
+        if (g == to)
+          continue;
+        push(to, g);
+        push(g, to);
+      }
+    }
+    merged.resize(live);
+    return true;
+  }
+};
+
+// Builds up to MESH_MAX_LODS levels, halving the triangle count each time.
+// LOD 0 is the input; coarser levels are appended to `indices` and recorded
+// in `lods`. Stops early when simplification stalls or exceeds the error
+// bound relative to the mesh extent.
+template <typename V>
+void generateLods(const vector<V> &vertices, vector<unsigned int> &indices,
+                  vector<MeshLod> &lods) {
+  lods.clear();
+  MeshLod base = {0, (uint32_t)indices.size(), 0.0f, 0.0f};
+  lods.push_back(base);
+  if (vertices.empty() || indices.size() < 3 * LOD_MIN_TRIANGLES * 2)
+    return;
+
+  glm::vec3 lo = vertices[0].Position, hi = vertices[0].Position;
+  for (size_t i = 1; i < vertices.size(); i++) {
+    lo = glm::min(lo, vertices[i].Position);
+    hi = glm::max(hi, vertices[i].Position);
+  }
+  float extent = glm::length(hi - lo);
+
+  // halving levels add at most as many indices again as LOD 0 has
+  indices.reserve(indices.size() * 2);
+  lods.reserve(MESH_MAX_LODS);
+
+  MeshSimplifier simplifier(
+      (const float *)&vertices[0].Position, (const float *)&vertices[0].Normal,
+      sizeof(V), vertices.size(), indices.data(), indices.size());
+
+  size_t previous = simplifier.triangleCount();
+  while (lods.size() < MESH_MAX_LODS) {
+    size_t target = previous / 2;
+    if (target < LOD_MIN_TRIANGLES)
+      break;
+    simplifier.simplify(target, LOD_MAX_ERROR * extent);
+
+    size_t reached = simplifier.triangleCount();
+    if (reached > previous * 9 / 10)
+      break; // not worth another level
+
+    MeshLod lod;
+    lod.indexOffset = (uint32_t)indices.size();
+    simplifier.appendIndices(indices);
+    lod.indexCount = (uint32_t)(indices.size() - lod.indexOffset);
+    lod.error = simplifier.error();
+    lod.reserved = 0.0f;
+    lods.push_back(lod);
+    previous = reached;
+  }
+}
+
+#endif
@@ -0,0 +1,679 @@
+#ifndef MESH_STREAM_H
+#define MESH_STREAM_H
+
+#include "camera.h"
+#include "geometry_arena.h"
+#include "lod.h"
+#include "mapped_file.h"
+#include "mesh_simplify.h"
+#include "model.h"
+#include "mpsc_queue.h"
+#include "shaders.h"
+#include "thread_pool.h"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Out-of-core meshes for scans too large to import whole. An offline build
+// (stream_build) cuts the mesh into a binary tree of spatial chunks: leaves
+// hold the full-resolution triangles of their cell, each inner node a
+// simplified version of its two children together. At run time the tree is
+// refined only where the projected error is visible, chunks are read from the
+// mapped file on the thread pool, coarse ones first, and uploaded into a
+// fixed-size GeometryArena, evicting what the view no longer needs. GPU and
+// resident CPU memory stay bounded however large the file is.
+//
+// Cells are simplified with their open boundary pinned (MeshSimplifier locks
+// border edges), so neighbouring chunks drawn at different levels still meet
+// without cracks. The price is that coarse nodes keep their cell outlines at
+// full resolution.
+
+const uint32_t MESH_STREAM_MAGIC = 0x5254534d; // "MSTR"
+const uint32_t MESH_STREAM_VERSION = 1;
+const size_t STREAM_CHUNK_TRIANGLES = 1 << 15;
+// Default pool: 48 MB of float vertices, 24 MB of indices.
+const size_t STREAM_POOL_VERTICES = 2 << 20;
+const size_t STREAM_POOL_INDICES = 6 << 20;
+const size_t STREAM_MAX_IN_FLIGHT = 4;
+const size_t STREAM_UPLOAD_BYTES_PER_FRAME = 4 << 20;
+
+struct MeshStreamHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t nodeCount;
+  uint32_t vertexStride;
+  float bounds[4];
+};
+
+// Nodes are stored breadth-first, root first; children are contiguous.
+struct MeshStreamNode {
+  float center[3];
+  float radius; // encloses the node and all its descendants
+  float error;  // simplification error in model units, 0 for leaves
+  uint32_t parent;
+  uint32_t firstChild;
+  uint32_t childCount;
+  uint32_t vertexCount;
+  uint32_t indexCount;
+  uint64_t offset; // vertices, then 32-bit indices local to the chunk
+};
+
+// ---- offline build ----
+
+class MeshStreamBuilder {
+public:
+  MeshStreamBuilder(const vector<Vertex> &vertices,
+                    const vector<unsigned int> &indices,
+                    size_t chunkTriangles = STREAM_CHUNK_TRIANGLES)
+      : source(vertices), sourceIndices(indices),
+        chunkTriangles(max(chunkTriangles, (size_t)LOD_MIN_TRIANGLES)) {}
+
+  // Builds the tree and writes it to path. Returns false on I/O failure.
+  bool write(const string &path) {
+    nodes.clear();
+    vector<uint32_t> triangles(sourceIndices.size() / 3);
+    for (size_t t = 0; t < triangles.size(); t++)
+      triangles[t] = (uint32_t)t;
+    centroids.resize(triangles.size());
+    for (size_t t = 0; t < triangles.size(); t++)
+      centroids[t] = (source[sourceIndices[t * 3]].Position +
+                      source[sourceIndices[t * 3 + 1]].Position +
+                      source[sourceIndices[t * 3 + 2]].Position) /
+                     3.0f;
+    remap.assign(source.size(), ~0u);
+    if (triangles.empty())
+      return false;
+
+    int root = build(triangles, 0, triangles.size());
+    return save(path, root);
+  }
+
+  size_t nodeCount() const { return nodes.size(); }
+
+private:
+  struct Node {
+    vector<Vertex> vertices;
+    vector<unsigned int> indices;
+    glm::vec4 sphere;
+    float error;
+    int children[2];
+  };
+
+  const vector<Vertex> &source;
+  const vector<unsigned int> &sourceIndices;
+  size_t chunkTriangles;
+  vector<glm::vec3> centroids;
+  vector<uint32_t> remap; // source vertex -> chunk vertex, ~0u when unused
+  vector<Node> nodes;
+
+  int build(vector<uint32_t> &triangles, size_t begin, size_t end) {
+    Node node;
+    node.children[0] = node.children[1] = -1;
+    node.error = 0.0f;
+
+    if (end - begin <= chunkTriangles) {
+      extractLeaf(triangles, begin, end, node);
+      node.sphere =
+          Mesh::boundingSphere(node.vertices.data(), node.vertices.size());
+      nodes.push_back(move(node));
+      return (int)nodes.size() - 1;
+    }
+
+    // split at the median centroid along the longest axis
+    glm::vec3 lo = centroids[triangles[begin]], hi = lo;
+    for (size_t i = begin; i < end; i++) {
+      lo = glm::min(lo, centroids[triangles[i]]);
+      hi = glm::max(hi, centroids[triangles[i]]);
+    }
+    glm::vec3 extent = hi - lo;
+    int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2)
+                                   : (extent.y > extent.z ? 1 : 2);
+    size_t mid = begin + (end - begin) / 2;
+    const vector<glm::vec3> &c = centroids;
+    nth_element(triangles.begin() + begin, triangles.begin() + mid,
+                triangles.begin() + end,
+                [&c, axis](uint32_t a, uint32_t b) {
+                  return c[a][axis] < c[b][axis];
+                });
+
+    node.children[0] = build(triangles, begin, mid);
+    node.children[1] = build(triangles, mid, end);
+    simplifyChildren(node);
+    nodes.push_back(move(node));
+    return (int)nodes.size() - 1;
+  }
+
+  void extractLeaf(const vector<uint32_t> &triangles, size_t begin,
+                   size_t end, Node &node) {
+    node.indices.reserve((end - begin) * 3);
+    for (size_t i = begin; i < end; i++)
+      for (int k = 0; k < 3; k++) {
+        unsigned int v = sourceIndices[triangles[i] * 3 + k];
+        if (remap[v] == ~0u) {
+          remap[v] = (uint32_t)node.vertices.size();
+          node.vertices.push_back(source[v]);
+        }
+        node.indices.push_back(remap[v]);
+      }
+    // reset only what this leaf touched
+    for (size_t i = begin; i < end; i++)
+      for (int k = 0; k < 3; k++)
+        remap[sourceIndices[triangles[i] * 3 + k]] = ~0u;
+  }
+
+  // Both children together, simplified down to one chunk.
+  void simplifyChildren(Node &node) {
+    const Node &a = nodes[node.children[0]];
+    const Node &b = nodes[node.children[1]];
+    vector<Vertex> merged(a.vertices);
+    merged.insert(merged.end(), b.vertices.begin(), b.vertices.end());
+    vector<unsigned int> mergedIndices(a.indices);
+    mergedIndices.reserve(a.indices.size() + b.indices.size());
+    for (size_t i = 0; i < b.indices.size(); i++)
+      mergedIndices.push_back(b.indices[i] + (unsigned int)a.vertices.size());
+
+    // the enclosing sphere of both children keeps the projected error
+    // monotonic from parent to child
+    glm::vec3 d = glm::vec3(b.sphere) - glm::vec3(a.sphere);
+    float distance = glm::length(d);
+    if (distance + b.sphere.w <= a.sphere.w)
+      node.sphere = a.sphere;
+    else if (distance + a.sphere.w <= b.sphere.w)
+      node.sphere = b.sphere;
+    else {
+      float radius = (distance + a.sphere.w + b.sphere.w) * 0.5f;
+      glm::vec3 center =
+          glm::vec3(a.sphere) + d * ((radius - a.sphere.w) / distance);
+      node.sphere = glm::vec4(center, radius);
+    }
+
+    MeshSimplifier simplifier(
+        (const float *)&merged[0].Position, (const float *)&merged[0].Normal,
+        sizeof(Vertex), merged.size(), mergedIndices.data(),
+        mergedIndices.size());
+    simplifier.simplify(chunkTriangles, node.sphere.w);
+    node.error = max(max(a.error, b.error), simplifier.error());
+
+    vector<unsigned int> kept;
+    simplifier.appendIndices(kept);
+    vector<uint32_t> compact(merged.size(), ~0u);
+    node.indices.reserve(kept.size());
+    for (size_t i = 0; i < kept.size(); i++) {
+      unsigned int v = kept[i];
+      if (compact[v] == ~0u) {
+        compact[v] = (uint32_t)node.vertices.size();
+        node.vertices.push_back(merged[v]);
+      }
+      node.indices.push_back(compact[v]);
+    }
+  }
+
+  // Writes the tree breadth-first so coarse nodes come first in the file
+  // and a node's children are adjacent.
+  bool save(const string &path, int root) {
+    vector<int> order(1, root);
+    vector<uint32_t> parents(1, ~0u);
+    for (size_t i = 0; i < order.size(); i++) {
+      const Node &n = nodes[order[i]];
+      for (int k = 0; k < 2; k++)
+        if (n.children[k] >= 0) {
+          order.push_back(n.children[k]);
+          parents.push_back((uint32_t)i);
+        }
+    }
+
+    MeshStreamHeader header;
+    header.magic = MESH_STREAM_MAGIC;
+    header.version = MESH_STREAM_VERSION;
+    header.nodeCount = (uint32_t)order.size();
+    header.vertexStride = (uint32_t)sizeof(Vertex);
+    for (int k = 0; k < 4; k++)
+      header.bounds[k] = nodes[root].sphere[k];
+
+    vector<MeshStreamNode> table(order.size());
+    uint64_t offset = align(sizeof(header) + table.size() * sizeof(table[0]));
+    uint32_t next = 1;
+    for (size_t i = 0; i < order.size(); i++) {
+      const Node &n = nodes[order[i]];
+      MeshStreamNode &t = table[i];
+      for (int k = 0; k < 3; k++)
+        t.center[k] = n.sphere[k];
+      t.radius = n.sphere.w;
+      t.error = n.error;
+      t.parent = parents[i];
+      t.childCount = (n.children[0] >= 0) + (n.children[1] >= 0);
+      t.firstChild = t.childCount ? next : 0;
+      next += t.childCount;
+      t.vertexCount = (uint32_t)n.vertices.size();
+      t.indexCount = (uint32_t)n.indices.size();
+      t.offset = offset;
+      offset = align(offset + n.vertices.size() * sizeof(Vertex) +
+                     n.indices.size() * sizeof(unsigned int));
+    }
+
+    ofstream out(path.c_str(), ios::binary | ios::trunc);
+    if (!out) {
+      cout << "ERROR::MESH_STREAM::CANNOT_WRITE " << path << endl;
+      return false;
+    }
+    out.write((const char *)&header, sizeof(header));
+    out.write((const char *)table.data(), table.size() * sizeof(table[0]));
+    for (size_t i = 0; i < order.size(); i++) {
+      const Node &n = nodes[order[i]];
+      pad(out, table[i].offset);
+      out.write((const char *)n.vertices.data(),
+                n.vertices.size() * sizeof(Vertex));
+      out.write((const char *)n.indices.data(),
+                n.indices.size() * sizeof(unsigned int));
+    }
+    return (bool)out;
+  }
+
+  static uint64_t align(uint64_t offset) { return (offset + 15) & ~15ull; }
+
+  static void pad(ofstream &out, uint64_t offset) {
+    static const char zeros[16] = {0};
+    uint64_t at = (uint64_t)out.tellp();
+    if (offset > at)
+      out.write(zeros, (streamsize)(offset - at));
+  }
+};
+
+// ---- run time ----
+
+struct MeshStreamStats {
+  size_t nodes;
+  size_t resident;
+  size_t loading;
+  size_t drawn;
+  size_t triangles; // drawn this frame
+  size_t evictions; // since creation
+};
+
+// One streamed mesh drawing from a shared fixed-size pool. All methods are
+// for the render thread; file reads happen on the pool's worker threads.
+class StreamedMesh {
+public:
+  StreamedMesh(const string &path, GeometryArena &pool, ThreadPool &workers)
+      : path(path), pool(pool), workers(workers), frame(0), inFlight(0),
+        evictions(0), rootReported(false), pendingJobs(0) {
+    file = make_shared<MappedFile>(path, MADV_RANDOM);
+    if (!file->valid() || file->length() < sizeof(MeshStreamHeader)) {
+      cout << "ERROR::MESH_STREAM::CANNOT_OPEN " << path << endl;
+      return;
+    }
+    MeshStreamHeader header;
+    memcpy(&header, file->bytes(), sizeof(header));
+    size_t tableEnd =
+        sizeof(header) + (size_t)header.nodeCount * sizeof(MeshStreamNode);
+    if (header.magic != MESH_STREAM_MAGIC ||
+        header.version != MESH_STREAM_VERSION ||
+        header.vertexStride != sizeof(Vertex) || header.nodeCount == 0 ||
+        tableEnd > file->length() || pool.format() != VERTEX_FORMAT_FLOAT) {
+      cout << "ERROR::MESH_STREAM::INVALID_FILE " << path << endl;
+      file.reset();
+      return;
+    }
+
+    nodes.resize(header.nodeCount);
+    memcpy(nodes.data(), file->bytes() + sizeof(header),
+           nodes.size() * sizeof(MeshStreamNode));
+    // children must come after their parent, which also rules out cycles
+    // that would send select() into endless recursion
+    for (size_t i = 0; i < nodes.size(); i++) {
+      const MeshStreamNode &n = nodes[i];
+      if (n.offset > file->length() ||
+          chunkBytes(n) > file->length() - n.offset ||
+          (n.childCount &&
+           (n.firstChild <= i ||
+            (size_t)n.firstChild + n.childCount > nodes.size()))) {
+        cout << "ERROR::MESH_STREAM::INVALID_FILE " << path << endl;
+        nodes.clear();
+        file.reset();
+        return;
+      }
+    }
+    state.assign(nodes.size(), NodeState());
+    sphere = glm::vec4(header.bounds[0], header.bounds[1], header.bounds[2],
+                       header.bounds[3]);
+  }
+
+  // Waits for reads in flight; they only touch the mapping and our queue.
+  ~StreamedMesh() {
+    while (pendingJobs.load() > 0)
+      this_thread::yield();
+    for (size_t i = 0; i < state.size(); i++)
+      if (state[i].handle != GEOMETRY_INVALID_HANDLE)
+        pool.free(state[i].handle);
+  }
+
+  StreamedMesh(const StreamedMesh &) = delete;
+  StreamedMesh &operator=(const StreamedMesh &) = delete;
+
+  bool valid() const { return !nodes.empty(); }
+  glm::vec4 bounds() const { return sphere; }
+
+  // Once per frame, before draw(): picks the chunks to draw for this view,
+  // requests missing ones, evicts unused ones if the pool is full and
+  // uploads finished reads within the frame's byte budget.
+  void update(const glm::mat4 &modelMatrix, const Camera &camera,
+              float viewportHeight, float pixelError = LOD_PIXEL_ERROR) {
+    if (!valid())
+      return;
+    frame++;
+    receive();
+
+    float scale = max(glm::length(glm::vec3(modelMatrix[0])),
+                      max(glm::length(glm::vec3(modelMatrix[1])),
+                          glm::length(glm::vec3(modelMatrix[2]))));
+    float pixelsPerDistance =
+        viewportHeight / (2.0f * tanf(glm::radians(camera.zoom) * 0.5f));
+    glm::vec3 eye = glm::vec3(glm::inverse(modelMatrix) *
+                              glm::vec4(camera.position, 1.0f));
+
+    drawList.clear();
+    wanted.clear();
+    select(0, eye, scale * pixelsPerDistance, pixelError);
+    if (state[0].status == NODE_ABSENT)
+      want(0, 1e30f);
+
+    request();
+  }
+
+  // Draws the chunks picked by the last update().
+  void draw(Shader &shader) {
+    if (drawList.empty())
+      return;
+    shader.setVec3(UNIFORM_NAME("positionScale"), glm::vec3(1.0f));
+    shader.setVec3(UNIFORM_NAME("positionOffset"), glm::vec3(0.0f));
+    shader.setBool(UNIFORM_NAME("octNormals"), false);
+
+    drawCounts.clear();
+    drawOffsets.clear();
+    drawBaseVertices.clear();
+    for (size_t i = 0; i < drawList.size(); i++) {
+      const GeometryRange &r = pool.range(state[drawList[i]].handle);
+      drawCounts.push_back((GLsizei)r.indexCount);
+      drawOffsets.push_back(
+          (const void *)(r.indexOffset * sizeof(unsigned int)));
+      drawBaseVertices.push_back((GLint)r.vertexOffset);
+    }
+    pool.bind();
+    glMultiDrawElementsBaseVertex(GL_TRIANGLES, drawCounts.data(),
+                                  GL_UNSIGNED_INT, drawOffsets.data(),
+                                  (GLsizei)drawCounts.size(),
+                                  drawBaseVertices.data());
+  }
+
+  MeshStreamStats stats() const {
+    MeshStreamStats s = {nodes.size(), 0, inFlight,
+                         drawList.size(), 0, evictions};
+    for (size_t i = 0; i < state.size(); i++)
+      s.resident += state[i].status == NODE_RESIDENT;
+    for (size_t i = 0; i < drawList.size(); i++)
+      s.triangles += nodes[drawList[i]].indexCount / 3;
+    return s;
+  }
+
+private:
+  // A NODE_BROKEN chunk failed its check and is never requested again.
+  enum NodeStatus { NODE_ABSENT, NODE_LOADING, NODE_RESIDENT, NODE_BROKEN };
+
+  struct NodeState {
+    NodeStatus status;
+    GeometryHandle handle;
+    uint64_t lastUsed; // frame the node was last drawn or kept as fallback
+
+    NodeState()
+        : status(NODE_ABSENT), handle(GEOMETRY_INVALID_HANDLE), lastUsed(0) {}
+  };
+
+  struct ReadResult {
+    uint32_t node;
+    bool valid; // every index is below the chunk's vertexCount
+  };
+
+  struct Request {
+    uint32_t node;
+    float priority; // projected error of what it would replace, in pixels
+
+    bool operator<(const Request &o) const { return priority > o.priority; }
+  };
+
+  string path;
+  GeometryArena &pool;
+  ThreadPool &workers;
+  shared_ptr<MappedFile> file; // shared with reads in flight
+  vector<MeshStreamNode> nodes;
+  vector<NodeState> state;
+  glm::vec4 sphere;
+
+  uint64_t frame;
+  size_t inFlight; // allocated, not yet uploaded
+  size_t evictions;
+  bool rootReported; // the root chunk did not fit in the pool
+  atomic<int> pendingJobs;
+  MPSCQueue<ReadResult> loaded; // read by a worker, waiting for upload
+  deque<uint32_t> uploads;
+
+  // reused every frame
+  vector<uint32_t> drawList;
+  vector<Request> wanted;
+  vector<GLsizei> drawCounts;
+  vector<const void *> drawOffsets;
+  vector<GLint> drawBaseVertices;
+
+  static size_t chunkBytes(const MeshStreamNode &n) {
+    return n.vertexCount * sizeof(Vertex) + n.indexCount * sizeof(unsigned);
+  }
+
+  float projectedError(uint32_t i, const glm::vec3 &eye,
+                       float pixelsPerUnitDistance) const {
+    const MeshStreamNode &n = nodes[i];
+    float distance =
+        max(glm::length(glm::vec3(n.center[0], n.center[1], n.center[2]) -
+                        eye) -
+                n.radius,
+            0.1f);
+    return n.error * pixelsPerUnitDistance / distance;
+  }
+
+  // Depth-first cut through the tree: refine a node while its error shows
+  // and all its children are resident, else draw it and ask for the
+  // children. Everything on the way down counts as used, so ancestors stay
+  // resident as fallbacks.
+  void select(uint32_t i, const glm::vec3 &eye, float pixelsPerUnitDistance,
+              float pixelError) {
+    NodeState &s = state[i];
+    if (s.status != NODE_RESIDENT)
+      return;
+    s.lastUsed = frame;
+
+    const MeshStreamNode &n = nodes[i];
+    float error = projectedError(i, eye, pixelsPerUnitDistance);
+    if (n.childCount == 0 || error <= pixelError) {
+      drawList.push_back(i);
+      return;
+    }
+
+    bool ready = true;
+    for (uint32_t c = n.firstChild; c < n.firstChild + n.childCount; c++) {
+      if (state[c].status == NODE_RESIDENT)
+        state[c].lastUsed = frame; // half a pair is kept for its sibling
+      else
+        ready = false;
+      if (state[c].status == NODE_ABSENT)
+        want(c, error);
+    }
+    if (!ready) {
+      drawList.push_back(i);
+      return;
+    }
+    for (uint32_t c = n.firstChild; c < n.firstChild + n.childCount; c++)
+      select(c, eye, pixelsPerUnitDistance, pixelError);
+  }
+
+  void want(uint32_t node, float priority) {
+    Request r = {node, priority};
+    wanted.push_back(r);
+  }
+
+  // Starts reads for the most visible missing chunks, making room in the
+  // pool by evicting chunks not used this frame, least recently used first.
+  void request() {
+    if (wanted.empty() || inFlight >= STREAM_MAX_IN_FLIGHT)
+      return;
+    sort(wanted.begin(), wanted.end());
+
+    vector<uint32_t> evictable;
+    bool listed = false;
+    for (size_t w = 0; w < wanted.size() && inFlight < STREAM_MAX_IN_FLIGHT;
+         w++) {
+      uint32_t i = wanted[w].node;
+      const MeshStreamNode &n = nodes[i];
+      GeometryHandle h = pool.tryAllocate(n.vertexCount, n.indexCount);
+      if (h == GEOMETRY_INVALID_HANDLE) {
+        if (!listed) {
+          listEvictable(evictable);
+          listed = true;
+        }
+        while (h == GEOMETRY_INVALID_HANDLE && !evictable.empty()) {
+          evict(evictable.back());
+          evictable.pop_back();
+          h = pool.tryAllocate(n.vertexCount, n.indexCount);
+        }
+        if (h == GEOMETRY_INVALID_HANDLE) {
+          // without its root the mesh draws nothing at all
+          if (i == 0 && !rootReported) {
+            cout << "ERROR::MESH_STREAM::ROOT_DOES_NOT_FIT " << path << endl;
+            rootReported = true;
+          }
+          return; // nothing left to give up for it
+        }
+      }
+
+      state[i].status = NODE_LOADING;
+      state[i].handle = h;
+      inFlight++;
+      read(i);
+    }
+  }
+
+  // Resident chunks not used this frame, the best eviction candidate last.
+  void listEvictable(vector<uint32_t> &out) const {
+    out.clear();
+    for (uint32_t i = 1; i < state.size(); i++) // the root always stays
+      if (state[i].status == NODE_RESIDENT && state[i].lastUsed < frame)
+        out.push_back(i);
+    const vector<NodeState> &s = state;
+    sort(out.begin(), out.end(), [&s](uint32_t a, uint32_t b) {
+      if (s[a].lastUsed != s[b].lastUsed)
+        return s[a].lastUsed > s[b].lastUsed;
+      return a < b; // deeper (later) nodes go first
+    });
+  }
+
+  void evict(uint32_t i) {
+    pool.free(state[i].handle);
+    state[i] = NodeState();
+    evictions++;
+  }
+
+  // Faults the chunk's pages in on a worker so the upload does not stall the
+  // render thread on disk. The indices are read in full on the way: the
+  // draw uses them relative to the chunk's first vertex in the shared pool,
+  // so one past vertexCount would read another chunk's vertices.
+  void read(uint32_t i) {
+    shared_ptr<MappedFile> mapping = file;
+    MPSCQueue<ReadResult> *queue = &loaded;
+    atomic<int> *pending = &pendingJobs;
+    size_t offset = (size_t)nodes[i].offset;
+    uint32_t vertexCount = nodes[i].vertexCount;
+    uint32_t indexCount = nodes[i].indexCount;
+    pending->fetch_add(1);
+    workers.submit([mapping, queue, pending, i, offset, vertexCount,
+                    indexCount]() {
+      const unsigned char *p = mapping->bytes() + offset;
+      size_t vertexBytes = (size_t)vertexCount * sizeof(Vertex);
+      size_t page = (size_t)sysconf(_SC_PAGESIZE);
+      volatile unsigned char sink = 0;
+      for (size_t b = 0; b < vertexBytes; b += page)
+        sink ^= p[b];
+      (void)sink;
+      ReadResult result = {i, true};
+      const unsigned char *indices = p + vertexBytes;
+      for (size_t k = 0; k < indexCount; k++) {
+        uint32_t index;
+        memcpy(&index, indices + k * sizeof(unsigned), sizeof(index));
+        result.valid &= index < vertexCount;
+      }
+      queue->push(result);
+      pending->fetch_sub(1);
+    });
+  }
+
+  // Uploads finished reads up to the per-frame budget and lets the kernel
+  // drop the file pages behind them.
+  void receive() {
+    ReadResult result;
+    while (loaded.pop(result)) {
+      if (result.valid) {
+        uploads.push_back(result.node);
+        continue;
+      }
+      const MeshStreamNode &n = nodes[result.node];
+      cout << "ERROR::MESH_STREAM::CORRUPT_CHUNK " << result.node << " in "
+           << path << endl;
+      pool.free(state[result.node].handle);
+      state[result.node] = NodeState();
+      state[result.node].status = NODE_BROKEN;
+      inFlight--;
+      release(n.offset, chunkBytes(n));
+    }
+
+    uint32_t i;
+    size_t budget = STREAM_UPLOAD_BYTES_PER_FRAME;
+    while (!uploads.empty()) {
+      i = uploads.front();
+      const MeshStreamNode &n = nodes[i];
+      size_t bytes = chunkBytes(n);
+      if (bytes > budget && budget < STREAM_UPLOAD_BYTES_PER_FRAME)
+        break; // a big chunk gets a frame to itself
+      uploads.pop_front();
+      budget -= min(budget, bytes);
+
+      const unsigned char *data = file->bytes() + n.offset;
+      size_t vertexBytes = n.vertexCount * sizeof(Vertex);
+      pool.uploadVertices(state[i].handle, 0, vertexBytes, data);
+      pool.uploadIndices(state[i].handle, 0, n.indexCount * sizeof(unsigned),
+                         data + vertexBytes);
+      state[i].status = NODE_RESIDENT;
+      state[i].lastUsed = frame;
+      inFlight--;
+      release(n.offset, bytes);
+    }
+  }
+
+  void release(uint64_t offset, size_t bytes) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t begin = (size_t)(offset + page - 1) / page * page;
+    size_t end = (size_t)(offset + bytes) / page * page;
+    if (end > begin)
+      madvise((void *)(file->bytes() + begin), end - begin, MADV_DONTNEED);
+  }
+};
+
+#endif
@@ -0,0 +1,211 @@
+#ifndef MESHLET_H
+#define MESHLET_H
+
+#include "mesh_cache.h"
+#include "scratch_arena.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+using namespace std;
+
+// Meshlets split each LOD's index range into small clusters with their own
+// bounding sphere and normal cone, so whole clusters that face away from the
+// camera or lie outside the frustum are dropped on the CPU before the draw.
+// Clusters are built greedily in the optimized triangle order, so they stay
+// spatially compact and the index buffer is not rewritten: a meshlet is just
+// a contiguous index range.
+
+const unsigned int MESHLET_MAX_VERTICES = 64;
+const unsigned int MESHLET_MAX_TRIANGLES = 124;
+
+// Cone culling is only worth it when the normals are this close together
+// (cosine of the widest normal against the axis).
+const float MESHLET_MIN_CONE_DOT = 0.1f;
+
+inline void finishMeshlet(Meshlet &m, const float *positions, size_t stride,
+                          const unsigned int *indices) {
+  const unsigned int *tri = indices + m.indexOffset;
+  size_t triangleCount = m.indexCount / 3;
+
+  glm::vec3 lo(positions[tri[0] * stride], positions[tri[0] * stride + 1],
+               positions[tri[0] * stride + 2]);
+  glm::vec3 hi = lo;
+  glm::vec3 axis(0.0f);
+  for (size_t t = 0; t < triangleCount; t++) {
+    glm::vec3 p[3];
+    for (int k = 0; k < 3; k++) {
+      const float *v = positions + tri[t * 3 + k] * stride;
+      p[k] = glm::vec3(v[0], v[1], v[2]);
+      lo = glm::min(lo, p[k]);
+      hi = glm::max(hi, p[k]);
+    }
+    glm::vec3 n = glm::cross(p[1] - p[0], p[2] - p[0]);
+    float len = glm::length(n);
+    if (len > 0.0f)
+      axis += n / len;
+  }
+
+  glm::vec3 center = (lo + hi) * 0.5f;
+  float radius = 0.0f;
+  for (size_t i = 0; i < m.indexCount; i++) {
+    const float *v = positions + tri[i] * stride;
+    radius = max(radius, glm::length(glm::vec3(v[0], v[1], v[2]) - center));
+  }
+
+  float axisLen = glm::length(axis);
+  axis = axisLen > 0.0f ? axis / axisLen : glm::vec3(0.0f, 0.0f, 1.0f);
+  float minDot = axisLen > 0.0f ? 1.0f : -1.0f;
+  for (size_t t = 0; t < triangleCount && minDot > MESHLET_MIN_CONE_DOT;
+       t++) {
+    const float *a = positions + tri[t * 3] * stride;
+    const float *b = positions + tri[t * 3 + 1] * stride;
+    const float *c = positions + tri[t * 3 + 2] * stride;
+    glm::vec3 pa(a[0], a[1], a[2]);
+    glm::vec3 n = glm::cross(glm::vec3(b[0], b[1], b[2]) - pa,
+                             glm::vec3(c[0], c[1], c[2]) - pa);
+    float len = glm::length(n);
+    if (len > 0.0f)
+      minDot = min(minDot, glm::dot(n / len, axis));
+  }
+
+  for (int k = 0; k < 3; k++) {
+    m.center[k] = center[k];
+    m.coneAxis[k] = axis[k];
+  }
+  m.radius = radius;
+  // sine of the cone's half-angle widened by 90 degrees; 1 never culls
+  m.coneCutoff = minDot > MESHLET_MIN_CONE_DOT
+                     ? sqrtf(max(1.0f - minDot * minDot, 0.0f))
+                     : 1.0f;
+}
+
+// Splits every LOD range of `indices` into meshlets, in index order.
+template <typename V>
+void buildMeshlets(const vector<V> &vertices,
+                   const vector<unsigned int> &indices,
+                   const vector<MeshLod> &lods, vector<Meshlet> &meshlets) {
+  meshlets.clear();
+  if (vertices.empty())
+    return;
+
+  const float *positions = (const float *)&vertices[0].Position;
+  const size_t stride = sizeof(V) / sizeof(float);
+
+  ScratchScope scope(importScratch());
+  // stamp[v] == current when v is already in the open meshlet
+  unsigned int *stamp =
+      importScratch().allocZeroed<unsigned int>(vertices.size());
+  unsigned int current = 0;
+
+  for (size_t l = 0; l < lods.size(); l++) {
+    size_t end = (size_t)lods[l].indexOffset + lods[l].indexCount;
+    Meshlet m = Meshlet();
+    m.indexOffset = lods[l].indexOffset;
+    unsigned int vertexCount = 0;
+    current++;
+
+    for (size_t i = lods[l].indexOffset; i + 2 < end; i += 3) {
+      unsigned int fresh = 0;
+      for (int k = 0; k < 3; k++)
+        fresh += stamp[indices[i + k]] != current;
+
+      if (vertexCount + fresh > MESHLET_MAX_VERTICES ||
+          m.indexCount / 3 >= MESHLET_MAX_TRIANGLES) {
+        finishMeshlet(m, positions, stride, indices.data());
+        meshlets.push_back(m);
+        m = Meshlet();
+        m.indexOffset = (uint32_t)i;
+        vertexCount = 0;
+        current++;
+      }
+
+      for (int k = 0; k < 3; k++) {
+        unsigned int &s = stamp[indices[i + k]];
+        if (s != current) {
+          s = current;
+          vertexCount++;
+        }
+      }
+      m.indexCount += 3;
+    }
+
+    if (m.indexCount > 0) {
+      finishMeshlet(m, positions, stride, indices.data());
+      meshlets.push_back(m);
+    }
+  }
+}
+
+// Per-frame culling state. begin() once per frame with the camera, then
+// setModel() per object; tests run in the object's model space so meshlet
+// bounds need no transform. Cone tests assume uniform scaling.
+class MeshletCuller {
+public:
+  size_t tested;
+  size_t frustumCulled;
+  size_t backfaceCulled;
+  size_t triangles; // submitted after culling
+
+  MeshletCuller() : viewProjection(1.0f), cameraWorld(0.0f) { resetStats(); }
+
+  void begin(const glm::mat4 &viewProj, const glm::vec3 &cameraPosition) {
+    viewProjection = viewProj;
+    cameraWorld = cameraPosition;
+    resetStats();
+  }
+
+  void setModel(const glm::mat4 &model) {
+    // Gribb-Hartmann: the planes of the combined matrix are in model space
+    glm::mat4 m = viewProjection * model;
+    for (int i = 0; i < 3; i++) {
+      for (int s = 0; s < 2; s++) {
+        glm::vec4 p;
+        for (int c = 0; c < 4; c++)
+          p[c] = m[c][3] + (s ? -m[c][i] : m[c][i]);
+        float len = glm::length(glm::vec3(p));
+        planes[i * 2 + s] = len > 0.0f ? p / len : p;
+      }
+    }
+    camera = glm::vec3(glm::inverse(model) * glm::vec4(cameraWorld, 1.0f));
+  }
+
+  bool visible(const Meshlet &m) {
+    tested++;
+    glm::vec3 center(m.center[0], m.center[1], m.center[2]);
+    for (int i = 0; i < 6; i++) {
+      if (glm::dot(glm::vec3(planes[i]), center) + planes[i].w < -m.radius) {
+        frustumCulled++;
+        return false;
+      }
+    }
+
+    // every triangle faces away when the view direction to the sphere stays
+    // inside the cone's back side
+    glm::vec3 d = center - camera;
+    glm::vec3 axis(m.coneAxis[0], m.coneAxis[1], m.coneAxis[2]);
+    if (glm::dot(d, axis) >= m.coneCutoff * glm::length(d) + m.radius) {
+      backfaceCulled++;
+      return false;
+    }
+
+    triangles += m.indexCount / 3;
+    return true;
+  }
+
+  void resetStats() {
+    tested = frustumCulled = backfaceCulled = triangles = 0;
+  }
+
+private:
+  glm::mat4 viewProjection;
+  glm::vec3 cameraWorld;
+  glm::vec4 planes[6];
+  glm::vec3 camera; // in the current model's space
+};
+
+#endif
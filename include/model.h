@@ -1,8 +1,20 @@
 #ifndef MODEL_H
 #define MODEL_H
 
+#include "geometry_arena.h"
+#include "mapped_io.h"
+#include "mesh_cache.h"
+#include "mesh_codec.h"
+#include "mesh_normals.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplify.h"
+#include "meshlet.h"
+#include "obj_parser.h"
 #include "shaders.h"
+#include "uniform_buffer.h"
+#include "vertex_packing.h"
 #include <assimp/Importer.hpp>
+#include <assimp/config.h>
 #include <assimp/postprocess.h>
 #include <assimp/scene.h>
 #include <glad/glad.h>
@@ -10,128 +22,662 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <iostream>
 #include <string>
+#include <strings.h>
 #include <vector>
 
 #include <algorithm>
 #include <limits>
+#include <memory>
 
 using namespace std;
 
-struct Vertex {
-  glm::vec3 Position;
-  glm::vec3 Normal;
-};
+// Vertices must be shared between faces for the vertex cache pass to matter.
+// Only what main.vert consumes is imported: positions and normals. Other
+// vertex components are stripped before vertices are joined, and missing
+// normals are generated by generateNormals() rather than Assimp.
+const unsigned int MODEL_IMPORT_FLAGS = aiProcess_Triangulate |
+                                        aiProcess_RemoveComponent |
+                                        aiProcess_JoinIdenticalVertices;
+const int MODEL_REMOVED_COMPONENTS =
+    aiComponent_TANGENTS_AND_BITANGENTS | aiComponent_COLORS |
+    aiComponent_TEXCOORDS | aiComponent_BONEWEIGHTS;
+
+// Sets an importer up the way model loading uses it: mapped file reads and
+// the component stripping MODEL_IMPORT_FLAGS relies on.
+inline void configureImporter(Assimp::Importer &importer) {
+  importer.SetIOHandler(new MappedIOSystem()); // owned by the importer
+  importer.SetPropertyInteger(AI_CONFIG_PP_RVC_FLAGS,
+                              MODEL_REMOVED_COMPONENTS);
+}
+
+// Case-insensitive check of a file name's extension (including the dot).
+inline bool hasExtension(const string &path, const char *extension) {
+  size_t length = strlen(extension);
+  return path.size() >= length &&
+         !strcasecmp(path.c_str() + path.size() - length, extension);
+}
 
+// GPU geometry lives in a shared GeometryArena; a Mesh only holds its
+// handle and the per-mesh data needed to draw and cull it.
 class Mesh {
 public:
   vector<Vertex> vertices;
   vector<unsigned int> indices;
-  unsigned int VAO, VBO, EBO;
+  GeometryArena *arena;
+  GeometryHandle geometry;
+  unsigned int indexCount;
+  VertexFormat format;
+  VertexQuantization quantization;
+  vector<MeshLod> lods;
+  vector<Meshlet> meshlets; // sorted by indexOffset, empty if not clustered
+  glm::vec4 bounds;    // bounding sphere in mesh space
+  glm::mat4 transform; // mesh space -> model space (the source node's)
+
+  // Takes the arrays over instead of copying them. The CPU-side copy is
+  // only kept when asked for; the GPU has everything needed to draw.
+  // arena must hold VERTEX_FORMAT_FLOAT vertices.
+  Mesh(GeometryArena &arena, vector<Vertex> &&vertices,
+       vector<unsigned int> &&indices, bool keepCpuData = false)
+      : vertices(move(vertices)), indices(move(indices)), arena(&arena),
+        format(VERTEX_FORMAT_FLOAT), transform(1.0f) {
+    setupMesh(this->vertices.data(), this->vertices.size(),
+              this->indices.data(), this->indices.size());
+    bounds = boundingSphere(this->vertices.data(), this->vertices.size());
+    if (!keepCpuData)
+      releaseCpuData();
+  }
+
+  // Uploads directly from caller-owned memory (e.g. a mapped mesh cache)
+  // without keeping a CPU-side copy. vertexData holds Vertex or
+  // PackedVertex entries depending on the arena's format; null data only
+  // reserves the space.
+  Mesh(GeometryArena &arena, const void *vertexData, size_t vertexCount,
+       const unsigned int *indexData, size_t indexCount,
+       const VertexQuantization &quantization = VertexQuantization())
+      : arena(&arena), format(arena.format()), quantization(quantization),
+        bounds(0.0f), transform(1.0f) {
+    setupMesh(vertexData, vertexCount, indexData, indexCount);
+  }
+
+  size_t vertexStride() const {
+    return format == VERTEX_FORMAT_PACKED ? sizeof(PackedVertex)
+                                          : sizeof(Vertex);
+  }
+
+  void releaseCpuData() {
+    vector<Vertex>().swap(vertices);
+    vector<unsigned int>().swap(indices);
+  }
+
+  // Returns the geometry to the arena. Copies of a Mesh share the handle,
+  // so only the owner calls this.
+  void release() {
+    if (geometry != GEOMETRY_INVALID_HANDLE)
+      arena->free(geometry);
+    geometry = GEOMETRY_INVALID_HANDLE;
+  }
+
+  // lod is clamped to the levels this mesh has. With a culler, only the
+  // meshlets that pass it are submitted.
+  void Draw(Shader &shader, int lod = 0, MeshletCuller *culler = nullptr) {
+    shader.setVec3(UNIFORM_NAME("positionScale"), quantization.scale);
+    shader.setVec3(UNIFORM_NAME("positionOffset"), quantization.offset);
+    shader.setBool(UNIFORM_NAME("octNormals"), format == VERTEX_FORMAT_PACKED);
 
-  Mesh(vector<Vertex> vertices, vector<unsigned int> indices) {
-    this->vertices = vertices;
-    this->indices = indices;
-    setupMesh();
+    const MeshLod &level = lods[min(lod, (int)lods.size() - 1)];
+    const GeometryRange &range = arena->range(geometry);
+    arena->bind();
+    if (culler && !meshlets.empty())
+      drawMeshlets(level, range, *culler);
+    else
+      glDrawElementsBaseVertex(
+          GL_TRIANGLES, level.indexCount, GL_UNSIGNED_INT,
+          (void *)((range.indexOffset + level.indexOffset) *
+                   sizeof(unsigned int)),
+          (GLint)range.vertexOffset);
   }
 
-  void Draw(Shader &shader) {
-    glBindVertexArray(VAO);
-    glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
+  static glm::vec4 boundingSphere(const Vertex *v, size_t count) {
+    if (count == 0)
+      return glm::vec4(0.0f);
+    glm::vec3 lo = v[0].Position, hi = v[0].Position;
+    for (size_t i = 1; i < count; i++) {
+      lo = glm::min(lo, v[i].Position);
+      hi = glm::max(hi, v[i].Position);
+    }
+    glm::vec3 center = (lo + hi) * 0.5f;
+    float radius = 0.0f;
+    for (size_t i = 0; i < count; i++)
+      radius = max(radius, glm::length(v[i].Position - center));
+    return glm::vec4(center, radius);
   }
 
 private:
-  void setupMesh() {
-    glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
-    glGenBuffers(1, &EBO);
+  // reused every frame so culling does not allocate
+  vector<GLsizei> drawCounts;
+  vector<const void *> drawOffsets;
+  vector<GLint> drawBaseVertices;
+
+  // Culls this level's meshlets and submits the survivors as one
+  // glMultiDrawElementsBaseVertex, merging neighbours that are adjacent in
+  // the index buffer into a single range.
+  void drawMeshlets(const MeshLod &level, const GeometryRange &range,
+                    MeshletCuller &culler) {
+    drawCounts.clear();
+    drawOffsets.clear();
+
+    uint32_t end = level.indexOffset + level.indexCount;
+    vector<Meshlet>::const_iterator it = lower_bound(
+        meshlets.begin(), meshlets.end(), level.indexOffset,
+        [](const Meshlet &m, uint32_t offset) {
+          return m.indexOffset < offset;
+        });
+    uint32_t rangeEnd = 0;
+    for (; it != meshlets.end() && it->indexOffset < end; ++it) {
+      if (!culler.visible(*it))
+        continue;
+      if (!drawCounts.empty() && rangeEnd == it->indexOffset) {
+        drawCounts.back() += it->indexCount;
+      } else {
+        drawCounts.push_back(it->indexCount);
+        drawOffsets.push_back(
+            (const void *)((range.indexOffset + it->indexOffset) *
+                           sizeof(unsigned int)));
+      }
+      rangeEnd = it->indexOffset + it->indexCount;
+    }
+
+    if (drawCounts.empty())
+      return;
+    drawBaseVertices.assign(drawCounts.size(), (GLint)range.vertexOffset);
+    glMultiDrawElementsBaseVertex(GL_TRIANGLES, drawCounts.data(),
+                                  GL_UNSIGNED_INT, drawOffsets.data(),
+                                  (GLsizei)drawCounts.size(),
+                                  drawBaseVertices.data());
+  }
+
+  void setupMesh(const void *vertexData, size_t vertexCount,
+                 const unsigned int *indexData, size_t numIndices) {
+    indexCount = (unsigned int)numIndices;
+    MeshLod full = {0, indexCount, 0.0f, 0.0f};
+    lods.assign(1, full);
+
+    geometry = arena->allocate(vertexCount, numIndices);
+    if (vertexData)
+      arena->uploadVertices(geometry, 0, vertexCount * vertexStride(),
+                            vertexData);
+    if (indexData)
+      arena->uploadIndices(geometry, 0, numIndices * sizeof(unsigned int),
+                           indexData);
+  }
+};
+
+// CPU-side result of importing one mesh. Either owns its arrays or points
+// into a mapped cache file kept alive by the owning ModelData.
+struct MeshData {
+  vector<Vertex> vertices;
+  vector<unsigned int> indices;
+  const Vertex *mappedVertices;
+  const unsigned int *mappedIndices;
+  size_t vertexCount;
+  size_t indexCount;
+
+  // LOD 0 is the full mesh; coarser levels follow it in the index array.
+  vector<MeshLod> lods;
+  vector<Meshlet> meshlets;
+  glm::vec4 bounds;
+  // Accumulated transform of the node the mesh hangs off in the source
+  // file; identity for formats without a node hierarchy.
+  glm::mat4 transform;
+
+  // Filled when the model is decoded as VERTEX_FORMAT_PACKED.
+  VertexFormat format;
+  vector<PackedVertex> packed;
+  VertexQuantization quantization;
 
-    glBindVertexArray(VAO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex),
-                 &vertices[0], GL_STATIC_DRAW);
+  MeshData()
+      : mappedVertices(nullptr), mappedIndices(nullptr), vertexCount(0),
+        indexCount(0), bounds(0.0f), transform(1.0f),
+        format(VERTEX_FORMAT_FLOAT) {}
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int),
-                 &indices[0], GL_STATIC_DRAW);
+  // GL mesh for this data with arena space of the right size; the contents
+  // are uploaded separately. The arena must match `format`.
+  Mesh allocate(GeometryArena &arena) const {
+    Mesh mesh(arena, nullptr, vertexCount, nullptr, indexCount,
+              quantization);
+    if (!lods.empty())
+      mesh.lods = lods;
+    mesh.meshlets = meshlets;
+    mesh.bounds = bounds;
+    mesh.transform = transform;
+    return mesh;
+  }
+
+  // What goes into the vertex buffer, in the mesh's format.
+  const void *uploadData() const {
+    if (format == VERTEX_FORMAT_PACKED)
+      return packed.data();
+    return vertexData();
+  }
+  size_t vertexStride() const {
+    return format == VERTEX_FORMAT_PACKED ? sizeof(PackedVertex)
+                                          : sizeof(Vertex);
+  }
 
-    // Position attribute
-    glEnableVertexAttribArray(0);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)0);
+  const Vertex *vertexData() const {
+    return mappedVertices ? mappedVertices : vertices.data();
+  }
+  const unsigned int *indexData() const {
+    return mappedIndices ? mappedIndices : indices.data();
+  }
 
-    // Normal attribute
-    glEnableVertexAttribArray(1);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                          (void *)offsetof(Vertex, Normal));
+  // View of the processed mesh as stored by MeshCache and the .mshz writer.
+  MeshCacheBlob blob() const {
+    MeshCacheBlob b;
+    b.vertices = vertexData();
+    b.vertexCount = (uint32_t)vertexCount;
+    b.indices = indexData();
+    b.indexCount = (uint32_t)indexCount;
+    for (int k = 0; k < 4; k++)
+      b.bounds[k] = bounds[k];
+    b.lodCount = (uint32_t)lods.size();
+    b.lods = lods.data();
+    b.meshletCount = (uint32_t)meshlets.size();
+    b.meshlets = meshlets.data();
+    for (int k = 0; k < 16; k++)
+      b.transform[k] = transform[k / 4][k % 4];
+    return b;
+  }
 
-    glBindVertexArray(0);
+  // Drops the vertex and index arrays once they are on the GPU.
+  void releaseArrays() {
+    vector<Vertex>().swap(vertices);
+    vector<unsigned int>().swap(indices);
+    vector<PackedVertex>().swap(packed);
+    mappedVertices = nullptr;
+    mappedIndices = nullptr;
   }
 };
 
+struct ModelData {
+  string path;
+  vector<MeshData> meshes;
+  shared_ptr<MeshCache> cache;
+  bool ok;
+
+  ModelData() : ok(false) {}
+};
+
 class Model {
 public:
-  Model(const char *path) { loadModel(path); }
+  Model() : sphere(0.0f), loaded(false), broken(false) {}
+
+  // Synchronous load in the arena's vertex format.
+  Model(const char *path, GeometryArena &arena)
+      : sphere(0.0f), loaded(false), broken(false) {
+    ModelData data = decode(path, arena.format());
+    reserveMeshes(data.meshes.size());
+    for (size_t i = 0; i < data.meshes.size(); i++) {
+      MeshData &m = data.meshes[i];
+      Mesh mesh(arena, m.uploadData(), m.vertexCount, m.indexData(),
+                m.indexCount, m.quantization);
+      if (!m.lods.empty())
+        mesh.lods = move(m.lods);
+      mesh.meshlets = move(m.meshlets);
+      mesh.bounds = m.bounds;
+      mesh.transform = m.transform;
+      addMesh(move(mesh));
+      m.releaseArrays();
+    }
+    markReady();
+  }
+
+  ~Model() {
+    for (size_t i = 0; i < meshes.size(); i++)
+      meshes[i].release();
+  }
+
+  Model(const Model &) = delete;
+  Model &operator=(const Model &) = delete;
+
+  // Without draw entries every mesh is drawn with the Objects entry the
+  // caller selected, ignoring node transforms (fine for single-node models
+  // such as the placeholder). With them, mesh i is drawn with entry
+  // firstDraw + i of `draws`, whose model matrix is world[i], e.g. from a
+  // SceneGraph node per mesh; the culler needs world as well.
+  void Draw(Shader &shader, int lod = 0, MeshletCuller *culler = nullptr,
+            const glm::mat4 *world = nullptr,
+            ObjectUniformBuffer *draws = nullptr, uint32_t firstDraw = 0) {
+    for (unsigned int i = 0; i < meshes.size(); i++) {
+      if (draws)
+        draws->select(shader, firstDraw + i);
+      if (world && culler)
+        culler->setModel(world[i]);
+      meshes[i].Draw(shader, lod, culler);
+    }
+  }
+
+  void reserveMeshes(size_t count) { meshes.reserve(count); }
+
+  void addMesh(Mesh &&mesh) {
+    // the model's sphere is in model space, so take the node transform in
+    const glm::mat4 &t = mesh.transform;
+    glm::vec4 b(glm::vec3(t * glm::vec4(glm::vec3(mesh.bounds), 1.0f)),
+                mesh.bounds.w * max(max(glm::length(glm::vec3(t[0])),
+                                        glm::length(glm::vec3(t[1]))),
+                                    glm::length(glm::vec3(t[2]))));
+    meshes.push_back(move(mesh));
+
+    // grow the model's sphere to enclose the new mesh
+    if (meshes.size() == 1) {
+      sphere = b;
+    } else {
+      glm::vec3 c(sphere), d = glm::vec3(b) - c;
+      float dist = glm::length(d);
+      if (dist + b.w > sphere.w) {
+        float radius = (sphere.w + dist + b.w) * 0.5f;
+        if (dist > 0.0f)
+          c += d * ((radius - sphere.w) / dist);
+        sphere = glm::vec4(c, radius);
+      }
+    }
+  }
+
+  glm::vec4 bounds() const { return sphere; }
+
+  size_t meshCount() const { return meshes.size(); }
+  const glm::mat4 &meshTransform(size_t i) const {
+    return meshes[i].transform;
+  }
+
+  // Arena space held by this model's meshes.
+  size_t gpuBytes() const {
+    size_t total = 0;
+    for (size_t i = 0; i < meshes.size(); i++) {
+      const Mesh &m = meshes[i];
+      if (m.geometry == GEOMETRY_INVALID_HANDLE)
+        continue;
+      const GeometryRange &r = m.arena->range(m.geometry);
+      total += r.vertexCount * m.vertexStride() +
+               r.indexCount * sizeof(unsigned int);
+    }
+    return total;
+  }
 
-  void Draw(Shader &shader) {
-    for (unsigned int i = 0; i < meshes.size(); i++)
-      meshes[i].Draw(shader);
+  int lodCount() const {
+    size_t count = 0;
+    for (size_t i = 0; i < meshes.size(); i++)
+      count = max(count, meshes[i].lods.size());
+    return (int)count;
+  }
+
+  // Worst deviation of any mesh at this level, in model units.
+  float lodError(int lod) const {
+    float error = 0.0f;
+    for (size_t i = 0; i < meshes.size(); i++) {
+      const vector<MeshLod> &l = meshes[i].lods;
+      error = max(error, l[min(lod, (int)l.size() - 1)].error);
+    }
+    return error;
+  }
+  const Mesh &lastMesh() const { return meshes.back(); }
+  void markReady() { loaded = true; }
+  bool ready() const { return loaded; }
+  // The import failed; the model never becomes ready.
+  void markFailed() { broken = true; }
+  bool failed() const { return broken; }
+
+  // Imports a model into CPU memory without touching GL, so it is safe to
+  // call from worker threads. Serves from the mesh cache when it is valid
+  // and refreshes the cache after an Assimp import otherwise; useCache =
+  // false always imports and leaves the cache alone. OBJ files are parsed
+  // natively, spread over pool when one is given. Packed .mshz files
+  // (mesh_codec.h) are already processed and are only decompressed; so
+  // are models whose .mshz is found in a mounted asset archive.
+  static ModelData decode(const string &path,
+                          VertexFormat format = VERTEX_FORMAT_FLOAT,
+                          bool useCache = true, ThreadPool *pool = nullptr) {
+    ModelData data = decodeFloat(path, pool, useCache);
+    if (format == VERTEX_FORMAT_PACKED)
+      for (size_t i = 0; i < data.meshes.size(); i++)
+        packMesh(data.meshes[i], path.c_str());
+    return data;
+  }
+
+  // Just the import: raw vertex and index arrays with normals filled in,
+  // without LODs, reordering or meshlets. For tools that build their own
+  // representation from the source geometry.
+  static bool importMeshes(const string &path, vector<MeshData> &meshes,
+                           ThreadPool *pool = nullptr) {
+    if (!importObj(path, pool, meshes) && !importAssimp(path, meshes))
+      return false;
+    for (size_t i = 0; i < meshes.size(); i++)
+      generateNormals(meshes[i].vertices, meshes[i].indices,
+                      NORMAL_CREASE_ANGLE, pool);
+    return true;
   }
 
 private:
   vector<Mesh> meshes;
-  string directory;
+  glm::vec4 sphere;
+  bool loaded;
+  bool broken;
+
+  // Fast path for Wavefront OBJ: one mesh, parsed in parallel. Anything the
+  // native parser rejects goes through Assimp instead.
+  static bool importObj(const string &path, ThreadPool *pool,
+                        vector<MeshData> &meshes) {
+    if (!hasExtension(path, ".obj"))
+      return false;
+    MeshData mesh;
+    ObjParser parser(pool);
+    if (!parser.parse(path, mesh.vertices, mesh.indices) ||
+        mesh.indices.empty())
+      return false;
+    meshes.push_back(move(mesh));
+    return true;
+  }
 
-  void loadModel(string path) {
+  static bool importAssimp(const string &path, vector<MeshData> &meshes) {
     Assimp::Importer importer;
-    const aiScene *scene =
-        importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenNormals |
-                                    aiProcess_CalcTangentSpace);
+    configureImporter(importer);
+    const aiScene *scene = importer.ReadFile(path, MODEL_IMPORT_FLAGS);
 
     if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE ||
         !scene->mRootNode) {
       cout << "ERROR::ASSIMP::" << importer.GetErrorString() << endl;
-      return;
+      return false;
+    }
+
+    meshes.reserve(scene->mNumMeshes);
+    processNode(scene->mRootNode, scene, glm::mat4(1.0f), meshes);
+    return true;
+  }
+
+  static ModelData decodeFloat(const string &path, ThreadPool *pool,
+                               bool useCache) {
+    ModelData data;
+    data.path = path;
+    if (hasExtension(path, ".mshz")) {
+      data.ok = decodeContainer(path, pool, data.meshes);
+      return data;
+    }
+    // Archives built with asset_pack --meshes carry models preprocessed.
+    if (assetFiles().archived(path + ".mshz")) {
+      data.ok = decodeContainer(path + ".mshz", pool, data.meshes);
+      return data;
+    }
+
+    // Warm start: point straight into the mapped cache file.
+    data.cache = make_shared<MeshCache>(path, MODEL_IMPORT_FLAGS,
+                                        (uint32_t)sizeof(Vertex));
+    vector<MeshCacheBlob> blobs;
+    if (useCache && data.cache->load(blobs)) {
+      data.meshes.reserve(blobs.size());
+      for (size_t i = 0; i < blobs.size(); i++) {
+        MeshData mesh;
+        mesh.mappedVertices = (const Vertex *)blobs[i].vertices;
+        mesh.mappedIndices = blobs[i].indices;
+        mesh.vertexCount = blobs[i].vertexCount;
+        mesh.indexCount = blobs[i].indexCount;
+        mesh.lods.assign(blobs[i].lods, blobs[i].lods + blobs[i].lodCount);
+        mesh.meshlets.assign(blobs[i].meshlets,
+                             blobs[i].meshlets + blobs[i].meshletCount);
+        mesh.bounds = glm::vec4(blobs[i].bounds[0], blobs[i].bounds[1],
+                                blobs[i].bounds[2], blobs[i].bounds[3]);
+        mesh.transform = matrixFromColumns(blobs[i].transform);
+        data.meshes.push_back(move(mesh));
+      }
+      data.ok = true;
+      return data;
+    }
+
+    if (!importMeshes(path, data.meshes, pool))
+      return data;
+
+    for (size_t i = 0; i < data.meshes.size(); i++) {
+      MeshData &m = data.meshes[i];
+      generateLods(m.vertices, m.indices, m.lods);
+      optimizeMesh(m.vertices, m.indices, m.lods, path.c_str());
+      buildMeshlets(m.vertices, m.indices, m.lods, m.meshlets);
+      m.vertexCount = m.vertices.size();
+      m.indexCount = m.indices.size();
+      m.bounds = Mesh::boundingSphere(m.vertices.data(), m.vertices.size());
+    }
+
+    if (!useCache) {
+      data.ok = true;
+      return data;
+    }
+
+    blobs.clear();
+    blobs.reserve(data.meshes.size());
+    for (size_t i = 0; i < data.meshes.size(); i++)
+      blobs.push_back(data.meshes[i].blob());
+    data.cache->store(blobs);
+    data.ok = true;
+    return data;
+  }
+
+  static bool decodeContainer(const string &path, ThreadPool *pool,
+                              vector<MeshData> &meshes) {
+    AssetData file = assetFiles().read(path);
+    if (!file.valid()) {
+      cout << "ERROR::MESH_CODEC::CANNOT_OPEN " << path << endl;
+      return false;
+    }
+    MeshContainer container;
+    if (!container.open(file.bytes, file.size))
+      return false;
+    if (container.vertexStride() != sizeof(Vertex)) {
+      cout << "ERROR::MESH_CODEC::VERTEX_FORMAT_MISMATCH " << path << endl;
+      return false;
+    }
+
+    uint32_t count = container.meshCount();
+    meshes.resize(count);
+    vector<void *> vertices(count);
+    vector<unsigned int *> indices(count);
+    for (uint32_t i = 0; i < count; i++) {
+      const MeshContainerMesh &e = container.mesh(i);
+      MeshData &m = meshes[i];
+      m.vertices.resize(e.vertexCount);
+      m.indices.resize(e.indexCount);
+      m.vertexCount = e.vertexCount;
+      m.indexCount = e.indexCount;
+      m.lods.assign(container.lods(i), container.lods(i) + e.lodCount);
+      m.meshlets.assign(container.meshlets(i),
+                        container.meshlets(i) + e.meshletCount);
+      m.bounds =
+          glm::vec4(e.bounds[0], e.bounds[1], e.bounds[2], e.bounds[3]);
+      m.transform = matrixFromColumns(e.transform);
+      vertices[i] = m.vertices.data();
+      indices[i] = m.indices.data();
+    }
+    if (!container.decode(vertices.data(), indices.data(), pool)) {
+      meshes.clear();
+      return false;
     }
-    directory = path.substr(0, path.find_last_of('/'));
+    return true;
+  }
+
+  // Quantizes in place and drops the float copy.
+  static void packMesh(MeshData &m, const char *label) {
+    PackingError error;
+    packVertices(m.vertexData(), m.vertexCount, m.packed, m.quantization,
+                 &error);
+    reportPackingError(label, m.vertexCount, sizeof(Vertex), error);
+    m.format = VERTEX_FORMAT_PACKED;
+    vector<Vertex>().swap(m.vertices);
+    m.mappedVertices = nullptr;
+  }
 
-    processNode(scene->mRootNode, scene);
+  static glm::mat4 matrixFromColumns(const float *m) {
+    glm::mat4 out;
+    for (int k = 0; k < 16; k++)
+      out[k / 4][k % 4] = m[k];
+    return out;
   }
 
-  void processNode(aiNode *node, const aiScene *scene) {
+  // aiMatrix4x4 is row-major: a1..a4 is the first row.
+  static glm::mat4 toGlm(const aiMatrix4x4 &m) {
+    const float rows[16] = {m.a1, m.a2, m.a3, m.a4, m.b1, m.b2, m.b3, m.b4,
+                            m.c1, m.c2, m.c3, m.c4, m.d1, m.d2, m.d3, m.d4};
+    glm::mat4 out;
+    for (int k = 0; k < 16; k++)
+      out[k % 4][k / 4] = rows[k];
+    return out;
+  }
+
+  // Meshes keep their node's transform relative to the root, so parts of
+  // multi-node files stay where the file puts them.
+  static void processNode(aiNode *node, const aiScene *scene,
+                          const glm::mat4 &parent, vector<MeshData> &out) {
+    glm::mat4 transform = parent * toGlm(node->mTransformation);
     for (unsigned int i = 0; i < node->mNumMeshes; i++) {
       aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
-      meshes.push_back(processMesh(mesh, scene));
+      out.push_back(processMesh(mesh, scene));
+      out.back().transform = transform;
     }
     for (unsigned int i = 0; i < node->mNumChildren; i++) {
-      processNode(node->mChildren[i], scene);
+      processNode(node->mChildren[i], scene, transform, out);
     }
   }
 
-  Mesh processMesh(aiMesh *mesh, const aiScene *scene) {
-    vector<Vertex> vertices;
-    vector<unsigned int> indices;
+  // Sizes both arrays exactly up front and fills them in place; the LOD
+  // chain appended later reserves its own growth.
+  static MeshData processMesh(aiMesh *mesh, const aiScene *scene) {
+    MeshData data;
+    vector<Vertex> &vertices = data.vertices;
+    vector<unsigned int> &indices = data.indices;
 
+    vertices.resize(mesh->mNumVertices);
+    const bool hasNormals = mesh->HasNormals();
     for (unsigned int i = 0; i < mesh->mNumVertices; i++) {
-      Vertex vertex;
+      Vertex &vertex = vertices[i];
       vertex.Position = glm::vec3(mesh->mVertices[i].x, mesh->mVertices[i].y,
                                   mesh->mVertices[i].z);
 
-      if (mesh->HasNormals())
+      if (hasNormals)
         vertex.Normal = glm::vec3(mesh->mNormals[i].x, mesh->mNormals[i].y,
                                   mesh->mNormals[i].z);
       else
-        vertex.Normal = glm::vec3(0.0f, 1.0f, 0.0f);
-
-      vertices.push_back(vertex);
+        vertex.Normal = glm::vec3(0.0f); // filled by generateNormals()
     }
 
+    size_t indexCount = 0;
+    for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+      indexCount += mesh->mFaces[i].mNumIndices;
+    indices.resize(indexCount);
+    unsigned int *out = indices.data();
     for (unsigned int i = 0; i < mesh->mNumFaces; i++) {
-      aiFace face = mesh->mFaces[i];
-      for (unsigned int j = 0; j < face.mNumIndices; j++)
-        indices.push_back(face.mIndices[j]);
+      const aiFace &face = mesh->mFaces[i];
+      out = copy(face.mIndices, face.mIndices + face.mNumIndices, out);
     }
 
-    return Mesh(vertices, indices);
+    data.vertexCount = vertices.size();
+    data.indexCount = indices.size();
+    return data;
   }
 };
 
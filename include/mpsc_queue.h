@@ -0,0 +1,55 @@
+#ifndef MPSC_QUEUE_H
+#define MPSC_QUEUE_H
+
+#include <atomic>
+#include <utility>
+
+using namespace std;
+
+// Unbounded lock-free multi-producer single-consumer queue (Vyukov). Any
+// thread may push; only one thread may pop. A push that is still in flight
+// is simply not visible to the consumer until it completes.
+template <typename T> class MPSCQueue {
+public:
+  MPSCQueue() : head(new Node()), tail(head.load(memory_order_relaxed)) {}
+
+  ~MPSCQueue() {
+    T discard;
+    while (pop(discard)) {
+    }
+    delete tail;
+  }
+
+  MPSCQueue(const MPSCQueue &) = delete;
+  MPSCQueue &operator=(const MPSCQueue &) = delete;
+
+  void push(T value) {
+    Node *node = new Node();
+    node->value = move(value);
+    Node *prev = head.exchange(node, memory_order_acq_rel);
+    prev->next.store(node, memory_order_release);
+  }
+
+  // Consumer side only.
+  bool pop(T &out) {
+    Node *next = tail->next.load(memory_order_acquire);
+    if (!next)
+      return false;
+    out = move(next->value);
+    delete tail;
+    tail = next;
+    return true;
+  }
+
+private:
+  struct Node {
+    atomic<Node *> next;
+    T value;
+    Node() : next(nullptr) {}
+  };
+
+  atomic<Node *> head;
+  Node *tail;
+};
+
+#endif
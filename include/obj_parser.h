@@ -0,0 +1,392 @@
+#ifndef OBJ_PARSER_H
+#define OBJ_PARSER_H
+
+#include "asset_archive.h"
+#include "thread_pool.h"
+#include "vertex_packing.h"
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Wavefront OBJ reader for the formats our assets use: v, vn and f lines,
+// everything else (vt, groups, materials, smoothing) is skipped. The file is
+// read through assetFiles(), memory-mapped or from an archive, and cut into
+// line-aligned chunks that are parsed in parallel:
+//  1. count v / vn lines per chunk, so every chunk knows where its
+//     positions go and can resolve negative (relative) indices;
+//  2. parse floats and triangulated faces straight into shared arrays;
+//  3. merge identical (position, normal) corners through a hash table into
+//     the final vertex and index arrays, in first-use order.
+// Corners of faces without vn come out with a zero normal, shared per
+// position, for generateNormals() to fill in.
+
+const size_t OBJ_MIN_CHUNK_BYTES = 1 << 20;
+
+// Decimal float parser. The digits are accumulated in an integer; when that
+// fits a double exactly (up to 2^53) and the power of ten is exact (up to
+// 1e22), one multiply or divide gives the correctly rounded double, and the
+// conversion to float matches strtof except for decimals within 2^-29 ulp
+// of a halfway point between two floats, which can round one ulp the other
+// way. Longer mantissas and larger exponents go to strtof (C locale, which
+// the app never changes). Exporters write 6 to 9 digits, so nearly every
+// value takes the fast path.
+inline bool objParseFloat(const char *&p, const char *end, float &out) {
+  static const double powers[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                  1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                                  1e18, 1e19, 1e20, 1e21, 1e22};
+  while (p < end && (*p == ' ' || *p == '\t'))
+    p++;
+  const char *token = p;
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+'))
+    negative = *p++ == '-';
+
+  uint64_t mantissa = 0;
+  int digits = 0, exponent = 0;
+  const char *start = p;
+  for (; p < end && *p >= '0' && *p <= '9'; p++) {
+    if (digits < 19) {
+      mantissa = mantissa * 10 + (*p - '0');
+      if (mantissa)
+        digits++;
+    } else {
+      exponent++;
+    }
+  }
+  if (p < end && *p == '.') {
+    p++;
+    for (; p < end && *p >= '0' && *p <= '9'; p++) {
+      if (digits < 19) {
+        mantissa = mantissa * 10 + (*p - '0');
+        if (mantissa)
+          digits++;
+        exponent--;
+      }
+    }
+  }
+  if (p == start || (p == start + 1 && *start == '.'))
+    return false;
+
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    const char *e = p + 1;
+    bool expNegative = false;
+    if (e < end && (*e == '-' || *e == '+'))
+      expNegative = *e++ == '-';
+    if (e < end && *e >= '0' && *e <= '9') {
+      int value = 0;
+      for (; e < end && *e >= '0' && *e <= '9'; e++)
+        value = value < 10000 ? value * 10 + (*e - '0') : value;
+      exponent += expNegative ? -value : value;
+      p = e;
+    }
+  }
+
+  if (mantissa > (1ull << 53) || exponent < -22 || exponent > 22) {
+    out = strtof(string(token, p).c_str(), nullptr);
+    return true;
+  }
+  double v = (double)mantissa;
+  if (exponent < 0)
+    v /= powers[-exponent];
+  else if (exponent > 0)
+    v *= powers[exponent];
+  out = (float)(negative ? -v : v);
+  return true;
+}
+
+inline bool objParseInt(const char *&p, const char *end, long &out) {
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+'))
+    negative = *p++ == '-';
+  const char *start = p;
+  long v = 0;
+  for (; p < end && *p >= '0' && *p <= '9'; p++)
+    v = v * 10 + (*p - '0');
+  out = negative ? -v : v;
+  return p != start;
+}
+
+class ObjParser {
+public:
+  explicit ObjParser(ThreadPool *pool = nullptr) : pool(pool) {}
+
+  // Appends nothing on failure; the caller falls back to Assimp.
+  bool parse(const string &path, vector<Vertex> &vertices,
+             vector<unsigned int> &indices) {
+    AssetData file = assetFiles().read(path);
+    if (!file.valid()) {
+      cout << "ERROR::OBJ::CANNOT_OPEN " << path << endl;
+      return false;
+    }
+    const char *data = (const char *)file.bytes;
+    size_t length = file.size;
+
+    splitChunks(data, length);
+    parallelFor(pool, chunks.size(), [this](size_t i) { count(chunks[i]); });
+
+    size_t positionCount = 0, normalCount = 0;
+    for (size_t i = 0; i < chunks.size(); i++) {
+      chunks[i].positionBase = positionCount;
+      chunks[i].normalBase = normalCount;
+      positionCount += chunks[i].positionLines;
+      normalCount += chunks[i].normalLines;
+    }
+    positions.resize(positionCount);
+    normals.resize(normalCount);
+
+    parallelFor(pool, chunks.size(),
+                [this](size_t i) { parseChunk(chunks[i]); });
+    for (size_t i = 0; i < chunks.size(); i++) {
+      if (!chunks[i].error.empty()) {
+        cout << "ERROR::OBJ::" << chunks[i].error << " in " << path << endl;
+        return false;
+      }
+    }
+
+    merge(vertices, indices);
+    release();
+    return !indices.empty();
+  }
+
+private:
+  // A corner of a triangle: position index and normal index (~0u if none).
+  struct Corner {
+    uint32_t position;
+    uint32_t normal;
+  };
+
+  struct Chunk {
+    const char *begin;
+    const char *end;
+    size_t positionLines, normalLines;
+    size_t positionBase, normalBase;
+    vector<Corner> corners; // three per triangle
+    string error;
+  };
+
+  ThreadPool *pool;
+  vector<Chunk> chunks;
+  vector<glm::vec3> positions;
+  vector<glm::vec3> normals;
+
+  void splitChunks(const char *data, size_t length) {
+    size_t workers = pool ? pool->size() + 1 : 1;
+    size_t count =
+        max<size_t>(1, min(workers * 4, length / OBJ_MIN_CHUNK_BYTES));
+    chunks.assign(count, Chunk());
+
+    const char *end = data + length;
+    const char *p = data;
+    for (size_t i = 0; i < count; i++) {
+      const char *q = i + 1 == count ? end : data + length * (i + 1) / count;
+      if (q < p)
+        q = p;
+      // move the split just past the next newline
+      const char *nl = q < end ? (const char *)memchr(q, '\n', end - q) : end;
+      q = nl ? min(nl + 1, end) : end;
+      if (i + 1 == count)
+        q = end;
+      chunks[i].begin = p;
+      chunks[i].end = q;
+      chunks[i].positionLines = chunks[i].normalLines = 0;
+      p = q;
+    }
+  }
+
+  static const char *skipSpace(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t'))
+      p++;
+    return p;
+  }
+
+  static const char *lineEnd(const char *p, const char *end) {
+    const char *nl = (const char *)memchr(p, '\n', end - p);
+    return nl ? nl : end;
+  }
+
+  enum LineKind { LINE_OTHER, LINE_POSITION, LINE_NORMAL, LINE_FACE };
+
+  // Both passes classify lines with this, so their counts always agree.
+  static LineKind classify(const char *s, const char *e) {
+    if (e - s < 3 || (s[1] != ' ' && s[1] != '\t' && s[1] != 'n'))
+      return LINE_OTHER;
+    if (s[0] == 'v' && s[1] != 'n')
+      return LINE_POSITION;
+    if (s[0] == 'v' && (s[2] == ' ' || s[2] == '\t'))
+      return LINE_NORMAL;
+    if (s[0] == 'f' && s[1] != 'n')
+      return LINE_FACE;
+    return LINE_OTHER;
+  }
+
+  static void count(Chunk &c) {
+    for (const char *p = c.begin; p < c.end;) {
+      const char *e = lineEnd(p, c.end);
+      LineKind kind = classify(skipSpace(p, e), e);
+      c.positionLines += kind == LINE_POSITION;
+      c.normalLines += kind == LINE_NORMAL;
+      p = e + 1;
+    }
+  }
+
+  // Turns a 1-based or negative OBJ index into a 0-based one.
+  static bool resolve(long index, size_t seen, size_t total, uint32_t &out) {
+    long resolved = index > 0 ? index - 1 : (long)seen + index;
+    if (index == 0 || resolved < 0 || (size_t)resolved >= total)
+      return false;
+    out = (uint32_t)resolved;
+    return true;
+  }
+
+  void parseChunk(Chunk &c) {
+    size_t positionIndex = c.positionBase;
+    size_t normalIndex = c.normalBase;
+    vector<Corner> polygon;
+    c.corners.reserve((c.end - c.begin) / 16);
+
+    for (const char *p = c.begin; p < c.end;) {
+      const char *e = lineEnd(p, c.end);
+      const char *s = skipSpace(p, e);
+      p = e + 1;
+      LineKind kind = classify(s, e);
+
+      if (kind == LINE_POSITION) {
+        glm::vec3 &v = positions[positionIndex++];
+        s += 2;
+        if (!objParseFloat(s, e, v.x) || !objParseFloat(s, e, v.y) ||
+            !objParseFloat(s, e, v.z)) {
+          c.error = "BAD_VERTEX";
+          return;
+        }
+      } else if (kind == LINE_NORMAL) {
+        glm::vec3 &n = normals[normalIndex++];
+        s += 3;
+        if (!objParseFloat(s, e, n.x) || !objParseFloat(s, e, n.y) ||
+            !objParseFloat(s, e, n.z)) {
+          c.error = "BAD_NORMAL";
+          return;
+        }
+      } else if (kind == LINE_FACE) {
+        polygon.clear();
+        s += 2;
+        for (;;) {
+          s = skipSpace(s, e);
+          if (s >= e || *s == '\r' || *s == '#')
+            break;
+          long v, n = 0, t;
+          Corner corner;
+          corner.normal = ~0u;
+          if (!objParseInt(s, e, v) ||
+              !resolve(v, positionIndex, positions.size(), corner.position)) {
+            c.error = "BAD_FACE_INDEX";
+            return;
+          }
+          if (s < e && *s == '/') {
+            s++;
+            if (s < e && *s != '/')
+              objParseInt(s, e, t); // texture coordinates are not used
+            if (s < e && *s == '/') {
+              s++;
+              if (!objParseInt(s, e, n) ||
+                  !resolve(n, normalIndex, normals.size(), corner.normal)) {
+                c.error = "BAD_FACE_INDEX";
+                return;
+              }
+            }
+          }
+          polygon.push_back(corner);
+        }
+        // fan triangulation, like aiProcess_Triangulate for convex faces
+        for (size_t k = 2; k < polygon.size(); k++) {
+          c.corners.push_back(polygon[0]);
+          c.corners.push_back(polygon[k - 1]);
+          c.corners.push_back(polygon[k]);
+        }
+      }
+    }
+  }
+
+  static uint32_t floatBits(float f) {
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    return u;
+  }
+
+  static uint64_t hashKey(uint32_t position, const glm::vec3 &n) {
+    uint64_t h = position * 0x9e3779b97f4a7c15ULL;
+    h ^= (floatBits(n.x) + 0x7f4a7c15ULL) * 0xbf58476d1ce4e5b9ULL;
+    h ^= (floatBits(n.y) + 0x94d049bbULL) * 0x94d049bb133111ebULL;
+    h ^= (floatBits(n.z) + 0x2545f491ULL) * 0xff51afd7ed558ccdULL;
+    return h ^ (h >> 31);
+  }
+
+  // Open-addressing dedup over all corners, in file order.
+  void merge(vector<Vertex> &vertices, vector<unsigned int> &indices) {
+    size_t cornerCount = 0;
+    for (size_t i = 0; i < chunks.size(); i++)
+      cornerCount += chunks[i].corners.size();
+
+    size_t capacity = 16;
+    while (capacity < cornerCount * 2)
+      capacity *= 2;
+    const uint32_t empty = ~0u;
+    vector<uint32_t> table(capacity, empty);
+    vector<uint32_t> vertexPosition;
+
+    vertices.clear();
+    vertices.reserve(min(cornerCount, positions.size() * 2));
+    vertexPosition.reserve(vertices.capacity());
+    indices.resize(cornerCount);
+
+    size_t out = 0;
+    for (size_t i = 0; i < chunks.size(); i++) {
+      const vector<Corner> &corners = chunks[i].corners;
+      for (size_t k = 0; k < corners.size(); k++) {
+        const Corner &c = corners[k];
+        glm::vec3 normal =
+            c.normal == ~0u ? glm::vec3(0.0f) : normals[c.normal];
+
+        size_t slot = hashKey(c.position, normal) & (capacity - 1);
+        for (;;) {
+          uint32_t id = table[slot];
+          if (id == empty) {
+            id = (uint32_t)vertices.size();
+            Vertex v;
+            v.Position = positions[c.position];
+            v.Normal = normal;
+            vertices.push_back(v);
+            vertexPosition.push_back(c.position);
+            table[slot] = id;
+            indices[out++] = id;
+            break;
+          }
+          if (vertexPosition[id] == c.position &&
+              vertices[id].Normal == normal) {
+            indices[out++] = id;
+            break;
+          }
+          slot = (slot + 1) & (capacity - 1);
+        }
+      }
+    }
+    indices.resize(out);
+  }
+
+  void release() {
+    vector<Chunk>().swap(chunks);
+    vector<glm::vec3>().swap(positions);
+    vector<glm::vec3>().swap(normals);
+  }
+};
+
+#endif
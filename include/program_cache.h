@@ -0,0 +1,206 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include "mapped_file.h"
+#include "mesh_cache.h"
+
+#include <glad/glad.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Linked program binaries on disk, so a warm start skips compiling and
+// linking. A binary is only good for the driver that wrote it: the file
+// name is a hash of the shader sources (ShaderSource::hash, computed at
+// build time for embedded shaders), the preprocessor defines and the GL
+// vendor, renderer and version strings, so any change to those simply
+// selects another file. A binary the driver refuses is ignored and the
+// program is built from source and cached again.
+//
+// File layout: ProgramCacheHeader, then the driver's binary.
+
+const char PROGRAM_CACHE_DIR[] = "cache/programs";
+const uint32_t PROGRAM_CACHE_MAGIC = 0x47525054; // "TPRG"
+// Bump whenever Shader changes what it does to sources before compiling.
+const uint32_t PROGRAM_CACHE_VERSION = 1;
+
+// GL 4.1 / ARB_get_program_binary; not in the GL 3.3 loader.
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+struct ProgramCacheHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t key;
+  uint32_t binaryFormat;
+  uint32_t length; // of the binary that follows
+};
+
+class ProgramCache {
+public:
+  ProgramCache()
+      : getProgramBinary(nullptr), programBinary(nullptr),
+        programParameteri(nullptr), driverHash(0) {}
+
+  // Fetches the program binary entry points with the loader GLAD used.
+  // Without GL 4.1 or ARB_get_program_binary, or when the driver offers no
+  // binary formats, the cache stays disabled and every program is built
+  // from source.
+  bool init(GLADloadproc load) {
+    GLint major = 0, minor = 0, formats = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    if (major * 10 + minor < 41 && !hasExtension("GL_ARB_get_program_binary"))
+      return false;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    if (formats <= 0)
+      return false;
+
+    getProgramBinary = (GetProgramBinaryProc)load("glGetProgramBinary");
+    programBinary = (ProgramBinaryProc)load("glProgramBinary");
+    programParameteri = (ProgramParameteriProc)load("glProgramParameteri");
+    if (!getProgramBinary || !programBinary || !programParameteri) {
+      getProgramBinary = nullptr;
+      return false;
+    }
+
+    const GLenum names[] = {GL_VENDOR, GL_RENDERER, GL_VERSION};
+    string driver;
+    for (int i = 0; i < 3; i++) {
+      const GLubyte *s = glGetString(names[i]);
+      driver += s ? (const char *)s : "";
+      driver += '\n';
+    }
+    driverHash = hashString(driver, PROGRAM_CACHE_VERSION);
+    return true;
+  }
+
+  bool enabled() const { return getProgramBinary != nullptr; }
+
+  uint64_t key(uint64_t vertexHash, uint64_t fragmentHash,
+               const string &defines) const {
+    uint64_t sources[2] = {vertexHash, fragmentHash};
+    return hashString(defines, hashBytes(sources, sizeof(sources), driverHash));
+  }
+
+  // Creates a linked program from the binary cached under `key`. Returns 0
+  // when there is none or the driver rejects it.
+  GLuint load(uint64_t key) {
+    MappedFile file(path(key), MADV_WILLNEED);
+    if (!file.valid() || file.length() < sizeof(ProgramCacheHeader))
+      return 0;
+    ProgramCacheHeader header;
+    memcpy(&header, file.bytes(), sizeof(header));
+    if (header.magic != PROGRAM_CACHE_MAGIC ||
+        header.version != PROGRAM_CACHE_VERSION || header.key != key ||
+        file.length() - sizeof(header) < header.length)
+      return 0;
+
+    GLuint program = glCreateProgram();
+    programBinary(program, header.binaryFormat,
+                  file.bytes() + sizeof(header), (GLsizei)header.length);
+    GLint linked = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!linked) {
+      // e.g. a driver update that kept its version string; an unknown
+      // format also raises GL_INVALID_ENUM, which is not ours to report
+      glDeleteProgram(program);
+      while (glGetError() != GL_NO_ERROR)
+        ;
+      return 0;
+    }
+    return program;
+  }
+
+  // Call before glLinkProgram on programs that will be store()d.
+  void prepare(GLuint program) {
+    programParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+  }
+
+  // Writes the binary of a linked program. Goes through a temporary file and
+  // rename, as MeshCache does.
+  bool store(uint64_t key, GLuint program) {
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0 || !makeDirs(PROGRAM_CACHE_DIR))
+      return false;
+    vector<char> binary((size_t)length);
+    GLsizei written = 0;
+    GLenum format = 0;
+    getProgramBinary(program, length, &written, &format, binary.data());
+    if (written <= 0)
+      return false;
+
+    ProgramCacheHeader header = {PROGRAM_CACHE_MAGIC, PROGRAM_CACHE_VERSION,
+                                 key, format, (uint32_t)written};
+    static atomic<unsigned> tmpCounter(0);
+    string cachePath = path(key);
+    string tmpPath = cachePath + ".tmp." + to_string(getpid()) + "." +
+                     to_string(tmpCounter++);
+    ofstream out(tmpPath.c_str(), ios::binary | ios::trunc);
+    if (!out)
+      return false;
+    out.write((const char *)&header, sizeof(header));
+    out.write(binary.data(), written);
+    out.close();
+
+    if (!out || rename(tmpPath.c_str(), cachePath.c_str()) != 0) {
+      remove(tmpPath.c_str());
+      cout << "ERROR::PROGRAM_CACHE::WRITE_FAILED " << cachePath << endl;
+      return false;
+    }
+    return true;
+  }
+
+private:
+  typedef void(APIENTRYP GetProgramBinaryProc)(GLuint, GLsizei, GLsizei *,
+                                               GLenum *, void *);
+  typedef void(APIENTRYP ProgramBinaryProc)(GLuint, GLenum, const void *,
+                                            GLsizei);
+  typedef void(APIENTRYP ProgramParameteriProc)(GLuint, GLenum, GLint);
+
+  GetProgramBinaryProc getProgramBinary;
+  ProgramBinaryProc programBinary;
+  ProgramParameteriProc programParameteri;
+  uint64_t driverHash;
+
+  static string path(uint64_t key) {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)key);
+    return string(PROGRAM_CACHE_DIR) + "/" + name;
+  }
+
+  static bool hasExtension(const char *name) {
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; i++) {
+      const GLubyte *e = glGetStringi(GL_EXTENSIONS, (GLuint)i);
+      if (e && !strcmp((const char *)e, name))
+        return true;
+    }
+    return false;
+  }
+};
+
+// Shared by every Shader; disabled until init() succeeds.
+inline ProgramCache &programCache() {
+  static ProgramCache cache;
+  return cache;
+}
+
+#endif
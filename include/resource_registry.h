@@ -0,0 +1,396 @@
+#ifndef RESOURCE_REGISTRY_H
+#define RESOURCE_REGISTRY_H
+
+#include "asset_archive.h"
+#include "asset_manager.h"
+#include "mapped_file.h"
+#include "mesh_cache.h"
+#include "mpsc_queue.h"
+#include "thread_pool.h"
+
+#include <glad/glad.h>
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Number of frames an unreferenced resource is kept before its GL objects
+// are released. Something dropped and requested again within that window is
+// revived instead of reloaded.
+const unsigned int RESOURCE_GRACE_FRAMES = 3;
+
+struct ResourceStats {
+  int models;
+  int cubemaps;
+  int references; // handles held outside the registry
+  int pendingDeletes;
+  size_t modelBytes;
+  size_t cubemapBytes;
+};
+
+// Shares models and cubemaps between everything that asks for them. A request
+// is matched by canonical path and load options straight away, so one asset
+// placed many times is imported and uploaded once. Copies under another name
+// are matched by content: archived files by their size and crc, loose files
+// by a hash computed on a worker, since hashing a large file would stall the
+// frame. A copy seen for the first time is loaded while it is hashed; once
+// the hash is in, its paths move to the resource already holding that
+// content and the copy lives on only as long as the handles already given
+// out. The registry keeps its own reference; collect() frees resources
+// nobody else holds any more, on the render thread, after a short grace
+// period.
+class ResourceRegistry {
+public:
+  ResourceRegistry(ThreadPool &pool, AssetManager &assets,
+                   unsigned int graceFrames = RESOURCE_GRACE_FRAMES)
+      : pool(pool), assets(assets), graceFrames(graceFrames), nextId(1),
+        pendingJobs(0) {}
+
+  // Waits for in-flight hash jobs, which push into our queue.
+  ~ResourceRegistry() {
+    while (pendingJobs > 0)
+      this_thread::yield();
+    for (map<uint64_t, Entry<Cubemap> >::iterator it =
+             cubemaps.entries.begin();
+         it != cubemaps.entries.end(); ++it)
+      deleteCubemap(*it->second.resource);
+  }
+
+  ResourceRegistry(const ResourceRegistry &) = delete;
+  ResourceRegistry &operator=(const ResourceRegistry &) = delete;
+
+  shared_ptr<Model> model(const string &path,
+                          VertexFormat format = VERTEX_FORMAT_FLOAT) {
+    string canonical = canonicalPath(path);
+    string pathKey = canonical + "\n" + to_string((int)format) + "\n" +
+                     to_string(MODEL_IMPORT_FLAGS);
+    shared_ptr<Model> found = lookup(models, pathKey);
+    if (found)
+      return found;
+
+    // packed models in an archive are what decode() actually reads
+    vector<string> files(1, assetFiles().archived(path + ".mshz")
+                                ? path + ".mshz"
+                                : assetFiles().archived(path) ? path
+                                                              : canonical);
+    uint64_t options = hashString(pathKey.substr(canonical.size()));
+    uint64_t content;
+    bool known = contentKey(files, options, content);
+    if (known && (found = lookupContent(models, pathKey, content)))
+      return found;
+
+    shared_ptr<Model> model = assets.requestModel(path, format);
+    uint64_t id = insert(models, pathKey, known, content, model);
+    if (!known)
+      hashLater(false, id, files, options);
+    return model;
+  }
+
+  shared_ptr<Cubemap> cubemap(const char *faces[6]) {
+    string pathKey;
+    vector<string> files(6);
+    for (int i = 0; i < 6; i++) {
+      string canonical = canonicalPath(faces[i]);
+      pathKey += canonical + "\n";
+      files[i] = assetFiles().archived(faces[i]) ? faces[i] : canonical;
+    }
+    shared_ptr<Cubemap> found = lookup(cubemaps, pathKey);
+    if (found)
+      return found;
+
+    uint64_t content;
+    bool known = contentKey(files, 0, content);
+    if (known && (found = lookupContent(cubemaps, pathKey, content)))
+      return found;
+
+    shared_ptr<Cubemap> cubemap = assets.requestCubemap(faces);
+    uint64_t id = insert(cubemaps, pathKey, known, content, cubemap);
+    if (!known)
+      hashLater(true, id, files, 0);
+    return cubemap;
+  }
+
+  // Render thread, once per frame after AssetManager::update().
+  void collect() {
+    HashResult r;
+    while (hashes.pop(r)) {
+      for (size_t i = 0; i < r.files.size(); i++)
+        if (r.hashed[i])
+          fileHashes[r.files[i]] = r.hashes[i];
+      uint64_t content;
+      if (!contentKey(r.files, r.seed, content))
+        continue; // missing or unreadable: matched by path only
+      if (r.cubemap)
+        merge(cubemaps, r.id, content);
+      else
+        merge(models, r.id, content);
+    }
+
+    dropFailedModels();
+    collectTable(models, [](Model &) {});
+    collectTable(cubemaps, [](Cubemap &c) { deleteCubemap(c); });
+  }
+
+  ResourceStats stats() const {
+    ResourceStats s = {0, 0, 0, 0, 0, 0};
+    for (map<uint64_t, Entry<Model> >::const_iterator it =
+             models.entries.begin();
+         it != models.entries.end(); ++it) {
+      s.models++;
+      s.references += (int)it->second.resource.use_count() - 1;
+      s.pendingDeletes += it->second.idleFrames > 0;
+      s.modelBytes += it->second.resource->gpuBytes();
+    }
+    for (map<uint64_t, Entry<Cubemap> >::const_iterator it =
+             cubemaps.entries.begin();
+         it != cubemaps.entries.end(); ++it) {
+      s.cubemaps++;
+      s.references += (int)it->second.resource.use_count() - 1;
+      s.pendingDeletes += it->second.idleFrames > 0;
+      s.cubemapBytes += it->second.resource->bytes;
+    }
+    return s;
+  }
+
+private:
+  template <typename T> struct Entry {
+    shared_ptr<T> resource;
+    unsigned int idleFrames; // frames since the last outside reference
+    bool hashed;             // content is known
+    uint64_t content;
+  };
+
+  template <typename T> struct Table {
+    map<uint64_t, Entry<T> > entries; // by id
+    map<string, uint64_t> paths;      // path key -> id
+    map<uint64_t, uint64_t> contents; // content key -> id
+  };
+
+  // Content hashes by canonical path, redone only when the file changes.
+  struct FileHash {
+    uint64_t size;
+    int64_t mtime;
+    uint64_t hash;
+  };
+
+  // Hashes of one request's files, computed on a worker.
+  struct HashResult {
+    bool cubemap;
+    uint64_t id;
+    uint64_t seed;
+    vector<string> files;
+    vector<FileHash> hashes;
+    vector<bool> hashed;
+  };
+
+  ThreadPool &pool;
+  AssetManager &assets;
+  unsigned int graceFrames;
+  uint64_t nextId;
+  Table<Model> models;
+  Table<Cubemap> cubemaps;
+  map<string, FileHash> fileHashes;
+  MPSCQueue<HashResult> hashes;
+  atomic<int> pendingJobs; // hash jobs submitted and not yet finished
+
+  template <typename T>
+  shared_ptr<T> lookup(Table<T> &table, const string &pathKey) {
+    map<string, uint64_t>::iterator p = table.paths.find(pathKey);
+    if (p == table.paths.end())
+      return shared_ptr<T>();
+    Entry<T> &e = table.entries[p->second];
+    e.idleFrames = 0;
+    return e.resource;
+  }
+
+  // A new path whose content is already loaded under another one.
+  template <typename T>
+  shared_ptr<T> lookupContent(Table<T> &table, const string &pathKey,
+                              uint64_t content) {
+    map<uint64_t, uint64_t>::iterator c = table.contents.find(content);
+    if (c == table.contents.end())
+      return shared_ptr<T>();
+    table.paths[pathKey] = c->second;
+    Entry<T> &e = table.entries[c->second];
+    e.idleFrames = 0;
+    return e.resource;
+  }
+
+  template <typename T>
+  uint64_t insert(Table<T> &table, const string &pathKey, bool hashed,
+                  uint64_t content, const shared_ptr<T> &resource) {
+    uint64_t id = nextId++;
+    Entry<T> e;
+    e.resource = resource;
+    e.idleFrames = 0;
+    e.hashed = hashed;
+    e.content = content;
+    table.entries[id] = e;
+    table.paths[pathKey] = id;
+    if (hashed)
+      table.contents[content] = id;
+    return id;
+  }
+
+  // The hash of entry `id` came in. If another entry already holds that
+  // content, id's paths move over to it; id is then reachable only through
+  // the handles given out before and is collected once they are dropped.
+  template <typename T>
+  void merge(Table<T> &table, uint64_t id, uint64_t content) {
+    typename map<uint64_t, Entry<T> >::iterator e = table.entries.find(id);
+    if (e == table.entries.end())
+      return; // collected while it was hashed
+    map<uint64_t, uint64_t>::iterator c = table.contents.find(content);
+    if (c == table.contents.end()) {
+      e->second.hashed = true;
+      e->second.content = content;
+      table.contents[content] = id;
+      return;
+    }
+    for (map<string, uint64_t>::iterator p = table.paths.begin();
+         p != table.paths.end(); ++p)
+      if (p->second == id)
+        p->second = c->second;
+  }
+
+  // Queues hashing of the files a request reads; collect() picks it up.
+  void hashLater(bool cubemap, uint64_t id, const vector<string> &files,
+                 uint64_t seed) {
+    MPSCQueue<HashResult> *queue = &hashes;
+    atomic<int> *pending = &pendingJobs;
+    pending->fetch_add(1);
+    pool.submit([queue, pending, cubemap, id, files, seed]() {
+      HashResult r;
+      r.cubemap = cubemap;
+      r.id = id;
+      r.seed = seed;
+      r.files = files;
+      r.hashes.resize(files.size());
+      r.hashed.resize(files.size());
+      for (size_t i = 0; i < files.size(); i++) {
+        FileHash &h = r.hashes[i];
+        if (!statFile(files[i], h.size, h.mtime))
+          continue; // archived, or missing
+        MappedFile file(files[i], MADV_SEQUENTIAL);
+        if (!file.valid())
+          continue;
+        h.hash = hashBytes(file.bytes(), file.length());
+        r.hashed[i] = true;
+      }
+      queue->push(r);
+      pending->fetch_sub(1);
+    });
+  }
+
+  // Combined content key of a request's files, if it is known without
+  // reading them: archive entries carry a crc, and loose files hashed
+  // before are reused while their size and mtime are unchanged.
+  bool contentKey(const vector<string> &files, uint64_t seed,
+                  uint64_t &key) {
+    key = seed;
+    for (size_t i = 0; i < files.size(); i++) {
+      uint64_t file;
+      if (!fileKey(files[i], file))
+        return false;
+      key = hashBytes(&file, sizeof(file), key + i);
+    }
+    return true;
+  }
+
+  bool fileKey(const string &file, uint64_t &key) {
+    uint64_t size;
+    uint32_t crc;
+    if (assetFiles().archivedChecksum(file, size, crc)) {
+      uint64_t checksum[2] = {size, crc};
+      key = hashBytes(checksum, sizeof(checksum));
+      return true;
+    }
+    int64_t mtime;
+    map<string, FileHash>::iterator it = fileHashes.find(file);
+    if (it == fileHashes.end() || !statFile(file, size, mtime) ||
+        it->second.size != size || it->second.mtime != mtime)
+      return false;
+    key = it->second.hash;
+    return true;
+  }
+
+  // Entries only the registry references age by one frame; once past the
+  // grace period they are destroyed here, where GL calls are safe. Nothing
+  // else can hold a reference by then: workers and uploads keep their own
+  // until they finish.
+  template <typename T, typename Release>
+  void collectTable(Table<T> &table, Release release) {
+    typename map<uint64_t, Entry<T> >::iterator it = table.entries.begin();
+    while (it != table.entries.end()) {
+      Entry<T> &e = it->second;
+      if (e.resource.use_count() > 1) {
+        e.idleFrames = 0;
+        ++it;
+        continue;
+      }
+      if (++e.idleFrames <= graceFrames) {
+        ++it;
+        continue;
+      }
+
+      release(*e.resource);
+      forget(table, it->first);
+      table.entries.erase(it++);
+    }
+  }
+
+  // Forgets models whose import failed, so the next request for the path
+  // tries again instead of getting the broken model. Holders keep theirs
+  // (drawn as the placeholder) until they let go.
+  void dropFailedModels() {
+    map<uint64_t, Entry<Model> >::iterator it = models.entries.begin();
+    while (it != models.entries.end()) {
+      if (!it->second.resource->failed()) {
+        ++it;
+        continue;
+      }
+      forget(models, it->first);
+      models.entries.erase(it++);
+    }
+  }
+
+  // Removes the path and content keys that lead to entry `id`.
+  template <typename T> static void forget(Table<T> &table, uint64_t id) {
+    for (map<string, uint64_t>::iterator p = table.paths.begin();
+         p != table.paths.end();)
+      if (p->second == id)
+        table.paths.erase(p++);
+      else
+        ++p;
+    const Entry<T> &e = table.entries[id];
+    if (e.hashed) {
+      map<uint64_t, uint64_t>::iterator c = table.contents.find(e.content);
+      if (c != table.contents.end() && c->second == id)
+        table.contents.erase(c);
+    }
+  }
+
+  static void deleteCubemap(Cubemap &c) {
+    if (c.texture) {
+      glDeleteTextures(1, &c.texture);
+      c.texture = 0;
+    }
+  }
+
+  static string canonicalPath(const string &path) {
+    char resolved[PATH_MAX];
+    if (realpath(path.c_str(), resolved))
+      return resolved;
+    return path;
+  }
+};
+
+#endif
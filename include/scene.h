@@ -0,0 +1,196 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "asset_archive.h"
+
+#include <glm/glm.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Per-object material and animation settings, edited live from the UI.
+struct TransmittanceVars {
+  bool useReflection = true;
+  bool useRefraction = true;
+  bool useFresnel = true;
+  bool useDispersion = true;
+
+  float IOR = 1.52f;
+  float dispersionStrength = 0.01f;
+  float fresnelBase = 0.04f;
+
+  bool rotate = true;
+  float rotateSpeedDeg = 30.0f;
+  float rotateAngleDeg = 0.0f;
+
+  glm::vec3 position = glm::vec3(0.0f);
+  glm::vec3 scale = glm::vec3(1.0f);
+  glm::vec3 rotAxis = glm::vec3(0, 1, 0);
+
+  glm::vec3 baseRotationDeg = glm::vec3(0.0f);
+};
+
+struct SceneEntry {
+  string name;
+  string model; // asset path
+  TransmittanceVars p;
+};
+
+struct SceneDescription {
+  vector<SceneEntry> objects;
+  bool hasCamera;
+  glm::vec3 cameraPosition;
+  float cameraYaw, cameraPitch;
+
+  SceneDescription()
+      : hasCamera(false), cameraPosition(0.0f), cameraYaw(-90.0f),
+        cameraPitch(0.0f) {}
+};
+
+// Scene files (.scene) are line based; '#' starts a comment:
+//
+//   camera X Y Z YAW PITCH
+//   object NAME MODEL [key=value ...]
+//
+// Names and model paths cannot contain spaces. Object keys, all optional:
+// position, scale, axis (x,y,z lists); ior, dispersion, f0, speed, angle;
+// reflection, refraction, fresnel, dispersive, rotate (0 or 1). Anything
+// not given keeps its TransmittanceVars default.
+
+inline bool parseSceneVec3(const string &value, glm::vec3 &out) {
+  return sscanf(value.c_str(), "%f,%f,%f", &out.x, &out.y, &out.z) == 3;
+}
+
+inline bool parseSceneFloat(const string &value, float &out) {
+  char *end;
+  out = strtof(value.c_str(), &end);
+  return end != value.c_str() && *end == '\0';
+}
+
+inline bool parseSceneFlag(const string &value, bool &out) {
+  if (value != "0" && value != "1")
+    return false;
+  out = value == "1";
+  return true;
+}
+
+inline bool parseSceneKey(const string &key, const string &value,
+                          TransmittanceVars &p) {
+  if (key == "position")
+    return parseSceneVec3(value, p.position);
+  if (key == "scale")
+    return parseSceneVec3(value, p.scale);
+  if (key == "axis")
+    return parseSceneVec3(value, p.rotAxis);
+  if (key == "ior")
+    return parseSceneFloat(value, p.IOR);
+  if (key == "dispersion")
+    return parseSceneFloat(value, p.dispersionStrength);
+  if (key == "f0")
+    return parseSceneFloat(value, p.fresnelBase);
+  if (key == "speed")
+    return parseSceneFloat(value, p.rotateSpeedDeg);
+  if (key == "angle")
+    return parseSceneFloat(value, p.rotateAngleDeg);
+  if (key == "reflection")
+    return parseSceneFlag(value, p.useReflection);
+  if (key == "refraction")
+    return parseSceneFlag(value, p.useRefraction);
+  if (key == "fresnel")
+    return parseSceneFlag(value, p.useFresnel);
+  if (key == "dispersive")
+    return parseSceneFlag(value, p.useDispersion);
+  if (key == "rotate")
+    return parseSceneFlag(value, p.rotate);
+  return false;
+}
+
+// Reads a scene through assetFiles(), so it can live in an archive. Stops
+// at the first malformed line.
+inline bool loadScene(const string &path, SceneDescription &scene) {
+  AssetData file = assetFiles().read(path);
+  if (!file.valid()) {
+    cout << "ERROR::SCENE::CANNOT_OPEN " << path << endl;
+    return false;
+  }
+
+  istringstream in(string((const char *)file.bytes, file.size));
+  string line;
+  for (int lineNumber = 1; getline(in, line); lineNumber++) {
+    size_t comment = line.find('#');
+    if (comment != string::npos)
+      line.erase(comment);
+    istringstream words(line);
+    string kind;
+    if (!(words >> kind))
+      continue;
+
+    bool ok = true;
+    if (kind == "camera") {
+      glm::vec3 &c = scene.cameraPosition;
+      ok = (bool)(words >> c.x >> c.y >> c.z >> scene.cameraYaw >>
+                  scene.cameraPitch);
+      scene.hasCamera = ok;
+    } else if (kind == "object") {
+      SceneEntry entry;
+      ok = (bool)(words >> entry.name >> entry.model);
+      string pair;
+      while (ok && words >> pair) {
+        size_t eq = pair.find('=');
+        ok = eq != string::npos &&
+             parseSceneKey(pair.substr(0, eq), pair.substr(eq + 1), entry.p);
+      }
+      if (ok)
+        scene.objects.push_back(entry);
+    } else {
+      ok = false;
+    }
+
+    if (!ok) {
+      cout << "ERROR::SCENE::BAD_LINE " << path << ":" << lineNumber << endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+inline bool saveScene(const string &path, const SceneDescription &scene) {
+  FILE *f = fopen(path.c_str(), "w");
+  if (!f) {
+    cout << "ERROR::SCENE::CANNOT_WRITE " << path << endl;
+    return false;
+  }
+  fprintf(f, "# Lab 2 scene, %zu objects\n", scene.objects.size());
+  if (scene.hasCamera)
+    fprintf(f, "camera %g %g %g %g %g\n", scene.cameraPosition.x,
+            scene.cameraPosition.y, scene.cameraPosition.z, scene.cameraYaw,
+            scene.cameraPitch);
+  for (size_t i = 0; i < scene.objects.size(); i++) {
+    const SceneEntry &e = scene.objects[i];
+    const TransmittanceVars &p = e.p;
+    fprintf(f,
+            "object %s %s position=%g,%g,%g scale=%g,%g,%g axis=%g,%g,%g "
+            "ior=%g dispersion=%g f0=%g speed=%g angle=%g reflection=%d "
+            "refraction=%d fresnel=%d dispersive=%d rotate=%d\n",
+            e.name.c_str(), e.model.c_str(), p.position.x, p.position.y,
+            p.position.z, p.scale.x, p.scale.y, p.scale.z, p.rotAxis.x,
+            p.rotAxis.y, p.rotAxis.z, p.IOR, p.dispersionStrength,
+            p.fresnelBase, p.rotateSpeedDeg, p.rotateAngleDeg,
+            (int)p.useReflection, (int)p.useRefraction, (int)p.useFresnel,
+            (int)p.useDispersion, (int)p.rotate);
+  }
+  bool ok = !ferror(f);
+  if (fclose(f) != 0 || !ok) {
+    cout << "ERROR::SCENE::CANNOT_WRITE " << path << endl;
+    return false;
+  }
+  return true;
+}
+
+#endif
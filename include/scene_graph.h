@@ -0,0 +1,135 @@
+#ifndef SCENE_GRAPH_H
+#define SCENE_GRAPH_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+typedef uint32_t SceneNode;
+const SceneNode SCENE_NODE_NONE = 0xffffffffu;
+
+// Transform hierarchy with cached world matrices. Nodes live in flat arrays
+// indexed by SceneNode; a parent must exist before its children, so index
+// order is always a valid parent-before-child update order.
+//
+// setLocal() only marks a node dirty. update() then recomputes the world
+// matrix of each dirty node and of everything below it, once, so a frame's
+// transform work is proportional to the subtrees that moved rather than to
+// the size of the scene. A root's local matrix is its world matrix: it is
+// stored once and takes effect immediately.
+class SceneGraph {
+public:
+  SceneGraph() : updated(0), rootsPlaced(0) {}
+
+  SceneNode add(SceneNode parent = SCENE_NODE_NONE,
+                const glm::mat4 &local = glm::mat4(1.0f)) {
+    SceneNode node = (SceneNode)worlds.size();
+    locals.push_back(local);
+    worlds.push_back(parent == SCENE_NODE_NONE ? local
+                                               : worlds[parent] * local);
+    parents.push_back(parent);
+    firstChild.push_back(SCENE_NODE_NONE);
+    nextSibling.push_back(SCENE_NODE_NONE);
+    dirty.push_back(0);
+    if (parent != SCENE_NODE_NONE) {
+      nextSibling[node] = firstChild[parent];
+      firstChild[parent] = node;
+      // the parent may have moved since its world matrix was last computed
+      if (dirty[parent])
+        markDirty(node);
+    }
+    return node;
+  }
+
+  void setLocal(SceneNode node, const glm::mat4 &local) {
+    if (parents[node] != SCENE_NODE_NONE) {
+      locals[node] = local;
+      markDirty(node);
+      return;
+    }
+    worlds[node] = local;
+    rootsPlaced++;
+    for (SceneNode c = firstChild[node]; c != SCENE_NODE_NONE;
+         c = nextSibling[c])
+      markDirty(c);
+  }
+
+  // setLocal() for `count` roots in one pass: place(j, m) writes the
+  // matrix of nodes[j] straight into its world matrix m.
+  template <class Place>
+  void placeRoots(const SceneNode *nodes, size_t count, Place place) {
+    for (size_t j = 0; j < count; j++) {
+      place(j, worlds[nodes[j]]);
+      for (SceneNode c = firstChild[nodes[j]]; c != SCENE_NODE_NONE;
+           c = nextSibling[c])
+        markDirty(c);
+    }
+    rootsPlaced += count;
+  }
+
+  const glm::mat4 &local(SceneNode node) const {
+    return parents[node] == SCENE_NODE_NONE ? worlds[node] : locals[node];
+  }
+  // Valid as of the last update(). World matrices of consecutive nodes are
+  // contiguous, so children added together can be read as one array.
+  const glm::mat4 &world(SceneNode node) const { return worlds[node]; }
+  SceneNode parent(SceneNode node) const { return parents[node]; }
+  size_t size() const { return worlds.size(); }
+
+  // World matrices recomputed by the last update(), moved roots included.
+  size_t lastUpdated() const { return updated; }
+
+  void update() {
+    updated = rootsPlaced;
+    rootsPlaced = 0;
+    // ancestors have lower indices, so they are handled first and clear
+    // the flags of any dirty nodes below them; nodes marked in a loop over
+    // the scene usually arrive in order already
+    if (!is_sorted(pending.begin(), pending.end()))
+      sort(pending.begin(), pending.end());
+    for (size_t i = 0; i < pending.size(); i++)
+      if (dirty[pending[i]])
+        updateSubtree(pending[i]);
+    pending.clear();
+  }
+
+private:
+  vector<glm::mat4> locals; // unused for roots
+  vector<glm::mat4> worlds;
+  vector<SceneNode> parents;
+  vector<SceneNode> firstChild;
+  vector<SceneNode> nextSibling;
+  vector<unsigned char> dirty; // never set for roots
+  vector<SceneNode> pending;   // dirty nodes, in the order they were marked
+  vector<SceneNode> stack;
+  size_t updated;
+  size_t rootsPlaced; // since the last update()
+
+  void markDirty(SceneNode node) {
+    if (!dirty[node]) {
+      dirty[node] = 1;
+      pending.push_back(node);
+    }
+  }
+
+  // The parent of `top` is up to date by the time it is reached.
+  void updateSubtree(SceneNode top) {
+    stack.assign(1, top);
+    while (!stack.empty()) {
+      SceneNode node = stack.back();
+      stack.pop_back();
+      worlds[node] = worlds[parents[node]] * locals[node];
+      dirty[node] = 0;
+      updated++;
+      for (SceneNode c = firstChild[node]; c != SCENE_NODE_NONE;
+           c = nextSibling[c])
+        stack.push_back(c);
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,429 @@
+#ifndef SCENE_STORE_H
+#define SCENE_STORE_H
+
+#include "lod.h"
+#include "mesh_stream.h"
+#include "model.h"
+#include "scene.h"
+#include "scene_graph.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+// Index into SceneStore::models or SceneStore::streams.
+typedef uint32_t ResourceHandle;
+const ResourceHandle RESOURCE_HANDLE_NONE = 0xffffffffu;
+
+// SceneStore's slot for an object that does not spin.
+const uint32_t SPIN_SLOT_NONE = 0xffffffffu;
+
+// sin(2 pi t) for t in turns (t > -1000), to about 1e-6. Range reduction
+// and the polynomial use no branches or library calls, so loops over
+// arrays of angles vectorize.
+inline float sinTurns(float t) {
+  t -= (float)(int)(t + 1024.5f) - 1024.0f; // [-0.5, 0.5]
+  // fold onto [-0.25, 0.25] with sin(x) = sin(pi - x)
+  t = min(t, 0.5f - t);
+  t = max(t, -0.5f - t);
+  float x = t * 6.28318530718f, x2 = x * x;
+  return x * (1.0f +
+              x2 * (-1.0f / 6 +
+                    x2 * (1.0f / 120 +
+                          x2 * (-1.0f / 5040 +
+                                x2 * (1.0f / 362880 +
+                                      x2 * (-1.0f / 39916800))))));
+}
+
+// Shading settings of TransmittanceVars; objects refer to one by index.
+struct Material {
+  bool useReflection;
+  bool useRefraction;
+  bool useFresnel;
+  bool useDispersion;
+  float IOR;
+  float dispersionStrength;
+  float fresnelBase;
+
+  explicit Material(const TransmittanceVars &p = TransmittanceVars())
+      : useReflection(p.useReflection), useRefraction(p.useRefraction),
+        useFresnel(p.useFresnel), useDispersion(p.useDispersion), IOR(p.IOR),
+        dispersionStrength(p.dispersionStrength),
+        fresnelBase(p.fresnelBase) {}
+};
+
+// Scene objects as structure-of-arrays component tables: object i is entry
+// i of every per-object array. Each per-frame pass touches only the arrays
+// it needs, so animation, placement and culling stream through packed
+// floats instead of striding over whole objects. Models and streams are
+// shared and referenced by handle.
+//
+// Objects are root nodes of `graph`; each mesh of an object's model becomes
+// a child node once the model is ready (Model::Draw takes their matrices).
+//
+// Objects that spin also have a slot in a second, packed set of arrays
+// holding just what their per-frame placement reads, so update() streams
+// through those alone; static objects cost nothing until moved.
+class SceneStore {
+public:
+  // Placement; axis is normalized. Call moved() after editing these.
+  vector<glm::vec3> position;
+  vector<glm::vec3> scale;
+  vector<glm::vec3> axis;
+  // Rendering
+  vector<uint32_t> material;
+  vector<ResourceHandle> model;  // RESOURCE_HANDLE_NONE when streamed
+  vector<ResourceHandle> stream; // RESOURCE_HANDLE_NONE for models
+  vector<SceneNode> node;
+  vector<SceneNode> firstPart;   // SCENE_NODE_NONE until the model is ready
+  vector<glm::vec4> localBounds; // model-space sphere; w < 0 if unknown
+  vector<glm::vec4> bounds;      // world-space sphere; w < 0 if unknown
+  vector<LodState> lod;
+
+  vector<string> name; // UI only
+
+  vector<Material> materials;
+  vector<shared_ptr<Model>> models;
+  vector<shared_ptr<StreamedMesh>> streams;
+  SceneGraph graph;
+
+  size_t size() const { return position.size(); }
+
+  // Same model, same handle.
+  ResourceHandle addModel(const shared_ptr<Model> &m) {
+    unordered_map<const Model *, ResourceHandle>::iterator it =
+        modelHandles.find(m.get());
+    if (it != modelHandles.end())
+      return it->second;
+    ResourceHandle h = (ResourceHandle)models.size();
+    models.push_back(m);
+    modelReady.push_back(0);
+    modelHandles[m.get()] = h;
+    return h;
+  }
+
+  ResourceHandle addStream(const shared_ptr<StreamedMesh> &s) {
+    streams.push_back(s);
+    return (ResourceHandle)(streams.size() - 1);
+  }
+
+  uint32_t addMaterial(const Material &m) {
+    materials.push_back(m);
+    return (uint32_t)(materials.size() - 1);
+  }
+
+  // Adds an object drawing a model, with its own material built from p.
+  size_t add(const string &objectName, const TransmittanceVars &p,
+             ResourceHandle modelHandle) {
+    size_t i = addObject(objectName, p);
+    model[i] = modelHandle;
+    waiting.push_back((uint32_t)i);
+    return i;
+  }
+
+  size_t addStreamed(const string &objectName, const TransmittanceVars &p,
+                     ResourceHandle streamHandle) {
+    size_t i = addObject(objectName, p);
+    stream[i] = streamHandle;
+    localBounds[i] = streams[streamHandle]->bounds();
+    boundsChanged(i);
+    return i;
+  }
+
+  void moved(size_t i) {
+    if (!dirty[i])
+      movedList.push_back((uint32_t)i);
+    dirty[i] = 1;
+  }
+
+  // Spin about axis, in degrees in [0, 360] and degrees per second.
+  float angle(size_t i) const {
+    return spinSlot[i] == SPIN_SLOT_NONE ? angles[i]
+                                         : spinTurns[spinSlot[i]] * 360.0f;
+  }
+  float spin(size_t i) const { return speeds[i]; }
+
+  // 0 stops the object at its current angle.
+  void setSpin(size_t i, float degreesPerSecond) {
+    uint32_t slot = spinSlot[i];
+    speeds[i] = degreesPerSecond;
+    if (slot != SPIN_SLOT_NONE && degreesPerSecond != 0.0f) {
+      spinRate[slot] = degreesPerSecond / 360;
+    } else if (slot != SPIN_SLOT_NONE) {
+      angles[i] = spinTurns[slot] * 360.0f;
+      removeSpinSlot(slot);
+    } else if (degreesPerSecond != 0.0f) {
+      addSpinSlot(i);
+    }
+    moved(i);
+  }
+
+  const glm::mat4 &world(size_t i) const { return graph.world(node[i]); }
+
+  // Advances animation by dt seconds, rebuilds the matrices of objects
+  // that spun or moved, attaches the parts of newly ready models and
+  // brings the world matrices up to date.
+  void update(float dt) {
+    // moved objects: spinning ones get their slot refreshed and are placed
+    // below, static ones are placed here
+    for (size_t j = 0; j < movedList.size(); j++) {
+      uint32_t i = movedList[j];
+      if (spinSlot[i] != SPIN_SLOT_NONE) {
+        packSpinSlot(spinSlot[i]);
+      } else {
+        float turns = angles[i] * (1.0f / 360);
+        glm::mat4 m;
+        placement(axis[i], scale[i], position[i], sinTurns(turns + 0.25f),
+                  sinTurns(turns), m);
+        graph.setLocal(node[i], m);
+        placeBounds(i, m);
+      }
+      dirty[i] = 0;
+    }
+    movedList.clear();
+
+    attachParts();
+
+    // animation, wrapping the angle back into [0, 1] turns either way
+    // round for steps of up to 1024 turns, then its sines
+    size_t n = spinObject.size();
+    cosine.resize(n);
+    sine.resize(n);
+    float *t = spinTurns.data(), *c = cosine.data(), *s = sine.data();
+    const float *r = spinRate.data();
+    for (size_t j = 0; j < n; j++) {
+      float next = t[j] + r[j] * dt;
+      t[j] = next - ((float)(int)(next + 1024.0f) - 1024.0f);
+    }
+    for (size_t j = 0; j < n; j++) {
+      s[j] = sinTurns(t[j]);
+      c[j] = sinTurns(t[j] + 0.25f);
+    }
+
+    // placements and bounds, written straight into the world matrices
+    const glm::vec3 *u = spinAxis.data(), *k = spinScale.data(),
+                    *p = spinPosition.data();
+    const glm::vec4 *b = spinBounds.data();
+    const uint32_t *object = spinObject.data();
+    glm::vec4 *worldBounds = bounds.data();
+    graph.placeRoots(spinNode.data(), n, [&](size_t j, glm::mat4 &m) {
+      placement(u[j], k[j], p[j], c[j], s[j], m);
+      if (b[j].w >= 0.0f)
+        worldBounds[object[j]] = sphere(m, b[j]);
+    });
+    graph.update();
+  }
+
+  // Objects whose bounding sphere reaches into the view frustum, plus
+  // those whose bounds are not known yet (still loading), in index order.
+  void cull(const glm::mat4 &viewProjection, vector<uint32_t> &visible) const {
+    // Gribb-Hartmann planes of the combined matrix, in world space
+    glm::vec4 planes[6];
+    for (int i = 0; i < 3; i++) {
+      for (int side = 0; side < 2; side++) {
+        glm::vec4 p;
+        for (int c = 0; c < 4; c++)
+          p[c] = viewProjection[c][3] + (side ? -viewProjection[c][i]
+                                              : viewProjection[c][i]);
+        float len = glm::length(glm::vec3(p));
+        planes[i * 2 + side] = len > 0.0f ? p / len : p;
+      }
+    }
+
+    visible.clear();
+    const glm::vec4 *b = bounds.data();
+    for (size_t i = 0, n = size(); i < n; i++) {
+      // signed distance to the nearest plane, without early outs
+      float nearest = 1e30f;
+      for (int k = 0; k < 6; k++)
+        nearest = min(nearest, planes[k].x * b[i].x + planes[k].y * b[i].y +
+                                   planes[k].z * b[i].z + planes[k].w);
+      if (nearest >= -b[i].w || b[i].w < 0.0f)
+        visible.push_back((uint32_t)i);
+    }
+  }
+
+private:
+  vector<float> angles;             // degrees; current unless spinning
+  vector<float> speeds;             // degrees per second
+  vector<unsigned char> dirty;      // placement edited since last update
+  vector<uint32_t> movedList;       // objects with dirty set
+  vector<unsigned char> modelReady; // per model handle
+  vector<uint32_t> waiting;         // objects whose model is not ready
+  unordered_map<const Model *, ResourceHandle> modelHandles;
+
+  // Spinning objects: slot j of each array, in no particular order.
+  vector<uint32_t> spinSlot; // per object; SPIN_SLOT_NONE when static
+  vector<uint32_t> spinObject;
+  vector<SceneNode> spinNode;
+  vector<float> spinTurns; // angle in turns, [0, 1]
+  vector<float> spinRate;  // turns per second
+  vector<glm::vec3> spinAxis, spinScale, spinPosition;
+  vector<glm::vec4> spinBounds; // localBounds, radius scaled; w < 0 unknown
+  vector<float> cosine, sine;   // of spinTurns, filled by update()
+
+  void addSpinSlot(size_t i) {
+    spinSlot[i] = (uint32_t)spinObject.size();
+    spinObject.push_back((uint32_t)i);
+    spinNode.push_back(node[i]);
+    spinTurns.push_back(angles[i] / 360);
+    spinRate.push_back(speeds[i] / 360);
+    spinAxis.push_back(axis[i]);
+    spinScale.push_back(scale[i]);
+    spinPosition.push_back(position[i]);
+    spinBounds.push_back(scaledBounds(i));
+  }
+
+  // Copies the placement of slot j's object after moved().
+  void packSpinSlot(uint32_t j) {
+    size_t i = spinObject[j];
+    spinAxis[j] = axis[i];
+    spinScale[j] = scale[i];
+    spinPosition[j] = position[i];
+    spinBounds[j] = scaledBounds(i);
+  }
+
+  // Moves the last slot into j.
+  void removeSpinSlot(uint32_t j) {
+    size_t last = spinObject.size() - 1;
+    spinSlot[spinObject[j]] = SPIN_SLOT_NONE;
+    if (j != last) {
+      spinSlot[spinObject[last]] = j;
+      spinObject[j] = spinObject[last];
+      spinNode[j] = spinNode[last];
+      spinTurns[j] = spinTurns[last];
+      spinRate[j] = spinRate[last];
+      spinAxis[j] = spinAxis[last];
+      spinScale[j] = spinScale[last];
+      spinPosition[j] = spinPosition[last];
+      spinBounds[j] = spinBounds[last];
+    }
+    spinObject.pop_back();
+    spinNode.pop_back();
+    spinTurns.pop_back();
+    spinRate.pop_back();
+    spinAxis.pop_back();
+    spinScale.pop_back();
+    spinPosition.pop_back();
+    spinBounds.pop_back();
+  }
+
+  size_t addObject(const string &objectName, const TransmittanceVars &p) {
+    size_t i = size();
+    float length = glm::length(p.rotAxis);
+    position.push_back(p.position);
+    scale.push_back(p.scale);
+    axis.push_back(length > 0.0f ? p.rotAxis / length : glm::vec3(0, 1, 0));
+    float turns = p.rotateAngleDeg / 360;
+    turns -= floorf(turns);
+    angles.push_back(turns * 360.0f);
+    speeds.push_back(p.rotate ? p.rotateSpeedDeg : 0.0f);
+    material.push_back(addMaterial(Material(p)));
+    model.push_back(RESOURCE_HANDLE_NONE);
+    stream.push_back(RESOURCE_HANDLE_NONE);
+    firstPart.push_back(SCENE_NODE_NONE);
+    localBounds.push_back(glm::vec4(0.0f, 0.0f, 0.0f, -1.0f));
+    bounds.push_back(glm::vec4(0.0f, 0.0f, 0.0f, -1.0f));
+    lod.push_back(LodState());
+    name.push_back(objectName);
+    dirty.push_back(0);
+    glm::mat4 m;
+    placement(axis[i], scale[i], position[i], sinTurns(turns + 0.25f),
+              sinTurns(turns), m);
+    node.push_back(graph.add(SCENE_NODE_NONE, m));
+    spinSlot.push_back(SPIN_SLOT_NONE);
+    if (speeds[i] != 0.0f)
+      addSpinSlot(i);
+    return i;
+  }
+
+  // translate(position) * rotate(angle, u) * scale(k) into m, without the
+  // general matrix products glm would do.
+  // c and s are the cosine and sine of the spin angle.
+  static void placement(const glm::vec3 &u, const glm::vec3 &k,
+                        const glm::vec3 &position, float c, float s,
+                        glm::mat4 &m) {
+    glm::vec3 t = u * (1.0f - c);
+    m[0] = glm::vec4(c + t.x * u.x, t.x * u.y + s * u.z, t.x * u.z - s * u.y,
+                     0.0f) *
+           k.x;
+    m[1] = glm::vec4(t.y * u.x - s * u.z, c + t.y * u.y, t.y * u.z + s * u.x,
+                     0.0f) *
+           k.y;
+    m[2] = glm::vec4(t.z * u.x + s * u.y, t.z * u.y - s * u.x, c + t.z * u.z,
+                     0.0f) *
+           k.z;
+    m[3] = glm::vec4(position, 1.0f);
+  }
+
+  // localBounds[i] with the radius scaled by placement(): its rotation is
+  // orthonormal, so the largest axis scale is scale[i]'s largest component.
+  glm::vec4 scaledBounds(size_t i) const {
+    const glm::vec4 &b = localBounds[i];
+    const glm::vec3 &s = scale[i];
+    if (b.w < 0.0f)
+      return b;
+    return glm::vec4(glm::vec3(b),
+                     b.w * max(max(fabsf(s.x), fabsf(s.y)), fabsf(s.z)));
+  }
+
+  // World sphere of b, from scaledBounds(), under placement m.
+  static glm::vec4 sphere(const glm::mat4 &m, const glm::vec4 &b) {
+    return glm::vec4(glm::vec3(m[3]) + glm::vec3(m[0]) * b.x +
+                         glm::vec3(m[1]) * b.y + glm::vec3(m[2]) * b.z,
+                     b.w);
+  }
+
+  void placeBounds(size_t i, const glm::mat4 &m) {
+    if (localBounds[i].w >= 0.0f)
+      bounds[i] = sphere(m, scaledBounds(i));
+  }
+
+  // After localBounds[i] changed; a spinning object's world sphere follows
+  // in the next update().
+  void boundsChanged(size_t i) {
+    if (spinSlot[i] != SPIN_SLOT_NONE)
+      spinBounds[spinSlot[i]] = scaledBounds(i);
+    else
+      placeBounds(i, graph.local(node[i]));
+  }
+
+  // Checks each model handle once; only when one turned ready are the
+  // waiting objects scanned.
+  void attachParts() {
+    bool anyReady = false;
+    for (size_t h = 0; h < models.size(); h++)
+      if (!modelReady[h] && models[h]->ready())
+        modelReady[h] = anyReady = true;
+    if (!anyReady)
+      return;
+
+    size_t kept = 0;
+    for (size_t w = 0; w < waiting.size(); w++) {
+      uint32_t i = waiting[w];
+      if (!modelReady[model[i]]) {
+        waiting[kept++] = i;
+        continue;
+      }
+      const Model &m = *models[model[i]];
+      for (size_t k = 0; k < m.meshCount(); k++) {
+        SceneNode part = graph.add(node[i], m.meshTransform(k));
+        if (k == 0)
+          firstPart[i] = part;
+      }
+      localBounds[i] = m.bounds();
+      boundsChanged(i);
+    }
+    waiting.resize(kept);
+  }
+};
+
+#endif
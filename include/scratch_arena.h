@@ -0,0 +1,130 @@
+#ifndef SCRATCH_ARENA_H
+#define SCRATCH_ARENA_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+// Bump allocator for import-time temporaries. Memory is handed out in stack
+// order and given back with ScratchScope, but the blocks themselves are kept,
+// so after the first import a worker thread stops hitting the heap for
+// adjacency tables, remaps and the like. Only for trivially destructible
+// types; nothing is constructed or destroyed.
+class ScratchArena {
+public:
+  ScratchArena() : current(0), used(0) {}
+
+  ~ScratchArena() {
+    for (size_t i = 0; i < blocks.size(); i++)
+      ::free(blocks[i].data);
+  }
+
+  ScratchArena(const ScratchArena &) = delete;
+  ScratchArena &operator=(const ScratchArena &) = delete;
+
+  // Uninitialized, 16-byte aligned storage for count elements.
+  template <typename T> T *alloc(size_t count) {
+    return (T *)allocBytes(count * sizeof(T));
+  }
+
+  // Zero-filled variant.
+  template <typename T> T *allocZeroed(size_t count) {
+    T *p = alloc<T>(count);
+    memset(p, 0, count * sizeof(T));
+    return p;
+  }
+
+  struct Mark {
+    size_t block;
+    size_t used;
+  };
+
+  Mark mark() const {
+    Mark m = {current, used};
+    return m;
+  }
+
+  // Frees everything allocated since m. When the arena empties and had to
+  // chain blocks, they are merged so the next import fits in one.
+  void release(const Mark &m) {
+    current = m.block;
+    used = m.used;
+    if (current == 0 && used == 0 && blocks.size() > 1) {
+      size_t total = 0;
+      for (size_t i = 0; i < blocks.size(); i++) {
+        total += blocks[i].size;
+        ::free(blocks[i].data);
+      }
+      blocks.clear();
+      addBlock(total);
+    }
+  }
+
+  size_t capacity() const {
+    size_t total = 0;
+    for (size_t i = 0; i < blocks.size(); i++)
+      total += blocks[i].size;
+    return total;
+  }
+
+private:
+  struct Block {
+    char *data;
+    size_t size;
+  };
+
+  vector<Block> blocks;
+  size_t current; // block being bumped
+  size_t used;    // bytes used in it
+
+  void *allocBytes(size_t bytes) {
+    bytes = (bytes + 15) & ~size_t(15);
+    while (current < blocks.size() && used + bytes > blocks[current].size) {
+      current++;
+      used = 0;
+    }
+    if (current == blocks.size()) {
+      size_t size = blocks.empty() ? size_t(1) << 20 : blocks.back().size * 2;
+      addBlock(size > bytes ? size : bytes);
+      used = 0;
+    }
+    void *p = blocks[current].data + used;
+    used += bytes;
+    return p;
+  }
+
+  // malloc already returns 16-byte aligned memory on the platforms we build
+  // for.
+  void addBlock(size_t size) {
+    Block b;
+    b.data = (char *)malloc(size);
+    b.size = size;
+    blocks.push_back(b);
+  }
+};
+
+// Releases everything allocated from the arena during its lifetime.
+class ScratchScope {
+public:
+  explicit ScratchScope(ScratchArena &arena)
+      : arena(arena), start(arena.mark()) {}
+  ~ScratchScope() { arena.release(start); }
+
+  ScratchScope(const ScratchScope &) = delete;
+  ScratchScope &operator=(const ScratchScope &) = delete;
+
+private:
+  ScratchArena &arena;
+  ScratchArena::Mark start;
+};
+
+// One arena per thread, reused across imports.
+inline ScratchArena &importScratch() {
+  static thread_local ScratchArena arena;
+  return arena;
+}
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef SHADER_SOURCE_H
+#define SHADER_SOURCE_H
+
+#include "mesh_cache.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// A shader stage preprocessed and hashed at build time (shader_embed).
+struct EmbeddedShader {
+  const char *path; // as passed to Shader, e.g. "shaders/main.vert"
+  const char *source;
+  size_t length;
+  uint64_t hash; // shaderHash(source)
+};
+
+// Reads a whole file into `out`; false if it cannot be read.
+typedef function<bool(const string &path, string &out)> ShaderFileReader;
+
+// Identifies a preprocessed source, e.g. for the program binary cache.
+inline uint64_t shaderHash(const char *source, size_t length) {
+  return hashBytes(source, length);
+}
+
+// Expands `#include "file"` lines, which GLSL itself does not have. Paths
+// are relative to the including file. A file is inserted at most once per
+// expansion, so shared declarations need no include guards. Included files
+// must not have a #version line. Errors are reported and return false.
+inline bool expandShaderIncludes(const string &path,
+                                 const ShaderFileReader &read, string &out,
+                                 vector<string> &included) {
+  for (size_t i = 0; i < included.size(); i++)
+    if (included[i] == path)
+      return true;
+  included.push_back(path);
+
+  string text;
+  if (!read(path, text)) {
+    cout << "ERROR::SHADER::SOURCE_NOT_FOUND " << path << endl;
+    return false;
+  }
+  size_t slash = path.rfind('/');
+  string dir = slash == string::npos ? "" : path.substr(0, slash + 1);
+
+  for (size_t pos = 0; pos < text.size();) {
+    size_t end = text.find('\n', pos);
+    if (end == string::npos)
+      end = text.size();
+    size_t p = text.find_first_not_of(" \t", pos);
+    if (p < end && text.compare(p, 8, "#include") == 0) {
+      size_t open = text.find('"', p + 8);
+      size_t close = open < end ? text.find('"', open + 1) : string::npos;
+      if (close >= end) {
+        cout << "ERROR::SHADER::BAD_INCLUDE " << path << endl;
+        return false;
+      }
+      if (!expandShaderIncludes(dir + text.substr(open + 1, close - open - 1),
+                                read, out, included))
+        return false;
+    } else {
+      out.append(text, pos, end - pos);
+      out += '\n';
+    }
+    pos = end + 1;
+  }
+  return true;
+}
+
+inline bool expandShaderIncludes(const string &path,
+                                 const ShaderFileReader &read, string &out) {
+  vector<string> included;
+  out.clear();
+  return expandShaderIncludes(path, read, out, included);
+}
+
+#ifdef EMBEDDED_SHADERS
+#include "embedded_shaders.h"
+#else
+const EmbeddedShader *const EMBEDDED_SHADER_TABLE = nullptr;
+const size_t EMBEDDED_SHADER_COUNT = 0;
+#endif
+
+// The embedded copy of `path`, or nullptr.
+inline const EmbeddedShader *findEmbeddedShader(const string &path) {
+  for (size_t i = 0; i < EMBEDDED_SHADER_COUNT; i++)
+    if (path == EMBEDDED_SHADER_TABLE[i].path)
+      return &EMBEDDED_SHADER_TABLE[i];
+  return nullptr;
+}
+
+#endif
@@ -6,52 +6,263 @@
 
 #include <glad/glad.h>
 
-#include <fstream>
+#include "asset_archive.h"
+#include "program_cache.h"
+#include "shader_source.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
 #include <iostream>
-#include <sstream>
+#include <memory>
 #include <string>
+#include <type_traits>
+#include <vector>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
 using namespace std;
 
+// FNV-1a of a uniform name; constexpr so literal names can be hashed by the
+// compiler.
+constexpr uint32_t uniformHash(const char *s, uint32_t h = 2166136261u) {
+  return *s ? uniformHash(s + 1, (h ^ (unsigned char)*s) * 16777619u) : h;
+}
+
+// A uniform name and its hash. String literals convert implicitly and are
+// hashed where they are used (no allocation, no driver call);
+// UNIFORM_NAME("x") hashes at compile time, for hot paths.
+struct UniformName {
+  uint32_t hash;
+  const char *name;
+
+  constexpr UniformName(const char *name)
+      : hash(uniformHash(name)), name(name) {}
+  constexpr UniformName(uint32_t hash, const char *name)
+      : hash(hash), name(name) {}
+};
+
+#define UNIFORM_NAME(s)                                                      \
+  UniformName(integral_constant<uint32_t, uniformHash(s)>::value, s)
+
+// Location of a uniform, typed by the value it takes. Location -1 (not
+// active in the program) makes setting it a no-op, as in GL.
+template <typename T> struct Uniform {
+  GLint location;
+
+  Uniform() : location(-1) {}
+  explicit Uniform(GLint location) : location(location) {}
+};
+
+// GLSL types a Uniform<T> may refer to.
+inline bool uniformTypeMatches(bool *, GLenum type) { return type == GL_BOOL; }
+inline bool uniformTypeMatches(int *, GLenum type) {
+  return type == GL_INT || type == GL_BOOL || type == GL_SAMPLER_2D ||
+         type == GL_SAMPLER_CUBE;
+}
+inline bool uniformTypeMatches(float *, GLenum type) {
+  return type == GL_FLOAT;
+}
+inline bool uniformTypeMatches(glm::vec3 *, GLenum type) {
+  return type == GL_FLOAT_VEC3;
+}
+inline bool uniformTypeMatches(glm::mat4 *, GLenum type) {
+  return type == GL_FLOAT_MAT4;
+}
+
+// Text of one shader stage with its includes expanded.
+struct ShaderSource {
+  const EmbeddedShader *embedded; // if set, the text is embedded[0].source
+  string text;
+  uint64_t hash; // shaderHash() of the text
+  bool valid;
+
+  ShaderSource() : embedded(nullptr), hash(0), valid(false) {}
+  ShaderSource(const char *source, size_t length)
+      : embedded(nullptr), text(source, length),
+        hash(shaderHash(source, length)), valid(true) {}
+
+  const char *data() const {
+    return embedded ? embedded->source : text.data();
+  }
+  size_t length() const { return embedded ? embedded->length : text.size(); }
+};
+
+// Where shader text comes from; the first that applies wins:
+//  - $LAB2_SHADER_DIR (development): that directory on disk, read on every
+//    launch, so shaders can be edited without rebuilding;
+//  - the copies embedded at build time, already expanded and hashed: no
+//    file I/O, whatever the working directory;
+//  - assetFiles(), mounted archives or loose files, for builds without
+//    embedded shaders (the tools).
+inline ShaderSource loadShaderSource(const string &path) {
+  ShaderSource source;
+  const char *dir = getenv("LAB2_SHADER_DIR");
+  ShaderFileReader read;
+  string file = path;
+  if (dir && *dir) {
+    file = string(dir) + "/" + path.substr(path.rfind('/') + 1);
+    read = [](const string &p, string &out) {
+      MappedFile f(p);
+      if (!f.valid())
+        return false;
+      out.assign((const char *)f.bytes(), f.length());
+      return true;
+    };
+  } else if ((source.embedded = findEmbeddedShader(path))) {
+    source.hash = source.embedded->hash;
+    source.valid = true;
+    return source;
+  } else {
+    read = [](const string &p, string &out) {
+      AssetData f = assetFiles().read(p);
+      if (!f.valid())
+        return false;
+      out.assign((const char *)f.bytes, f.size);
+      return true;
+    };
+  }
+  source.valid = expandShaderIncludes(file, read, source.text);
+  source.hash = shaderHash(source.text.data(), source.text.size());
+  return source;
+}
+
+// One active uniform of a linked program.
+struct ShaderUniform {
+  uint32_t hash;
+  GLint location;
+  GLenum type;
+  GLint size; // array length, 1 for non-arrays
+  string name;
+};
+
 class Shader {
 public:
   // the program ID
   unsigned int ID;
-  GLuint cubeMapTexture;
 
-  // constructor reads and builds the shader
-  Shader(const char *vertexPath, const char *fragmentPath) {
-    string vertexCode;
-    string fragmentCode;
-    ifstream vShaderFile;
-    ifstream fShaderFile;
-
-    vShaderFile.exceptions(ifstream::failbit | ifstream::badbit);
-    fShaderFile.exceptions(ifstream::failbit | ifstream::badbit);
+  // constructor reads and builds the shader; `defines` ("#define X 1\n"
+  // lines) is inserted after each stage's #version line
+  Shader(const char *vertexPath, const char *fragmentPath,
+         const string &defines = "") {
+    // embedded at build time, or read from disk (see loadShaderSource)
+    ShaderSource vertexSource = loadShaderSource(vertexPath);
+    ShaderSource fragmentSource = loadShaderSource(fragmentPath);
+    if (!vertexSource.valid || !fragmentSource.valid)
+      cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << endl;
 
-    // read shader file
-    try {
-      vShaderFile.open(vertexPath);
-      fShaderFile.open(fragmentPath);
-      stringstream vShaderStream, fShaderStream;
+    build(vertexSource, fragmentSource, defines);
+  };
 
-      vShaderStream << vShaderFile.rdbuf();
-      fShaderStream << fShaderFile.rdbuf();
+  // Builds from GLSL source in memory.
+  static Shader fromSource(const char *vertexSource, const char *fragmentSource,
+                           const string &defines = "") {
+    return fromSource(ShaderSource(vertexSource, strlen(vertexSource)),
+                      ShaderSource(fragmentSource, strlen(fragmentSource)),
+                      defines);
+  }
+  static Shader fromSource(const ShaderSource &vertexSource,
+                           const ShaderSource &fragmentSource,
+                           const string &defines = "") {
+    Shader shader;
+    shader.build(vertexSource, fragmentSource, defines);
+    return shader;
+  }
 
-      vShaderFile.close();
-      fShaderFile.close();
+  // use/activate the shader
+  void use() { glUseProgram(ID); };
 
-      vertexCode = vShaderStream.str();
-      fragmentCode = fShaderStream.str();
-    } catch (ifstream::failure &e) {
-      cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << endl;
+  // Typed handle for a uniform, to fetch once and set every frame. Unknown
+  // names give an inactive handle; a type mismatch is reported.
+  template <typename T> Uniform<T> uniform(UniformName name) const {
+    const ShaderUniform *u = find(name);
+    if (!u || strcmp(u->name.c_str(), name.name) != 0)
+      return Uniform<T>();
+    if (!uniformTypeMatches((T *)nullptr, u->type)) {
+      cout << "ERROR::SHADER::UNIFORM_TYPE_MISMATCH " << name.name << endl;
+      return Uniform<T>();
     }
+    return Uniform<T>(u->location);
+  }
+
+  void set(Uniform<bool> u, bool value) const {
+    glUniform1i(u.location, (int)value);
+  }
+  void set(Uniform<int> u, int value) const { glUniform1i(u.location, value); }
+  void set(Uniform<float> u, float value) const {
+    glUniform1f(u.location, value);
+  }
+  void set(Uniform<glm::vec3> u, const glm::vec3 &value) const {
+    glUniform3fv(u.location, 1, glm::value_ptr(value));
+  }
+  void set(Uniform<glm::mat4> u, const glm::mat4 &value) const {
+    glUniformMatrix4fv(u.location, 1, GL_FALSE, glm::value_ptr(value));
+  }
 
-    const char *vShaderCode = vertexCode.c_str();
-    const char *fShaderCode = fragmentCode.c_str();
+  // utility uniform functions: by name, looked up in the reflected table
+  // without strings or driver calls
+  void setBool(UniformName name, bool value) const {
+    glUniform1i(location(name), (int)value);
+  };
+
+  void setInt(UniformName name, int value) const {
+    glUniform1i(location(name), value);
+  };
+  void setFloat(UniformName name, float value) const {
+    glUniform1f(location(name), value);
+  };
+  void setVec3(UniformName name, const glm::vec3 &value) const {
+    glUniform3fv(location(name), 1, glm::value_ptr(value));
+  };
+  void setMat4(UniformName name, const glm::mat4 &mat) const {
+    glUniformMatrix4fv(location(name), 1, GL_FALSE, glm::value_ptr(mat));
+  };
+
+  // -1 for names that are not active uniforms of the program.
+  GLint location(UniformName name) const {
+    const ShaderUniform *u = find(name);
+    return u ? u->location : -1;
+  }
+
+  const vector<ShaderUniform> &activeUniforms() const { return uniforms; }
+
+  // Points uniform block `name` at a buffer binding point and checks that
+  // the block is the size the buffer behind it provides (std140 mismatches
+  // show up here). Blocks the program does not use are ignored.
+  void bindBlock(const char *name, GLuint binding, size_t size) const {
+    GLuint index = glGetUniformBlockIndex(ID, name);
+    if (index == GL_INVALID_INDEX)
+      return;
+    glUniformBlockBinding(ID, index, binding);
+    GLint blockSize = 0;
+    glGetActiveUniformBlockiv(ID, index, GL_UNIFORM_BLOCK_DATA_SIZE,
+                              &blockSize);
+    if ((size_t)blockSize != size)
+      cout << "ERROR::SHADER::UNIFORM_BLOCK_SIZE_MISMATCH " << name << " "
+           << blockSize << " " << size << endl;
+  }
+
+private:
+  vector<ShaderUniform> uniforms; // sorted by hash
+
+  Shader() : ID(0) {}
+
+  // Links the program, or loads it from the program binary cache.
+  void build(const ShaderSource &vertexSource,
+             const ShaderSource &fragmentSource, const string &defines) {
+    ProgramCache &cache = programCache();
+    uint64_t key = 0;
+    if (cache.enabled()) {
+      key = cache.key(vertexSource.hash, fragmentSource.hash, defines);
+      ID = cache.load(key);
+      if (ID) {
+        reflectUniforms();
+        return;
+      }
+    }
 
     // compile shaders
     unsigned int vertex, fragment;
@@ -59,7 +270,8 @@ public:
     char infoLog[512];
 
     vertex = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertex, 1, &vShaderCode, nullptr);
+    setSource(vertex, vertexSource.data(), (GLint)vertexSource.length(),
+              defines);
     glCompileShader(vertex);
 
     glGetShaderiv(vertex, GL_COMPILE_STATUS, &success);
@@ -69,7 +281,8 @@ public:
     }
 
     fragment = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragment, 1, &fShaderCode, nullptr);
+    setSource(fragment, fragmentSource.data(),
+              (GLint)fragmentSource.length(), defines);
     glCompileShader(fragment);
 
     glGetShaderiv(fragment, GL_COMPILE_STATUS, &success);
@@ -82,6 +295,8 @@ public:
     ID = glCreateProgram();
     glAttachShader(ID, vertex);
     glAttachShader(ID, fragment);
+    if (cache.enabled())
+      cache.prepare(ID);
     glLinkProgram(ID);
 
     glGetProgramiv(ID, GL_LINK_STATUS, &success);
@@ -93,73 +308,117 @@ public:
 
     glDeleteShader(vertex);
     glDeleteShader(fragment);
-  };
 
-  // use/activate the shader
-  void use() { glUseProgram(ID); };
+    if (success) {
+      if (cache.enabled())
+        cache.store(key, ID);
+      reflectUniforms();
+    }
+  }
 
-  GLuint loadCubemap(const char *faces[6]) {
-    GLuint textureID;
-    glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
-
-    int width, height, nrChannels;
-    stbi_set_flip_vertically_on_load(false);
-    for (GLuint i = 0; i < 6; i++) {
-      unsigned char *data =
-          stbi_load(faces[i], &width, &height, &nrChannels, 0);
-      if (data) {
-        GLenum format = GL_RGB;
-        GLenum internalFormat = GL_RGB;
-
-        if (nrChannels == 4) {
-          format = GL_RGBA;
-          internalFormat = GL_RGBA; // simplest fix (no sRGB yet)
-        } else if (nrChannels == 3) {
-          format = GL_RGB;
-          internalFormat = GL_RGB;
-        } else if (nrChannels == 1) {
-          format = GL_RED;
-          internalFormat = GL_RED;
-        }
-
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, internalFormat,
-                     width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        stbi_image_free(data);
-      } else {
-        std::cout << "Cubemap texture failed to load at path: " << faces[i]
-                  << std::endl;
-        stbi_image_free(data);
-      }
+  // Passes the source in three pieces so `defines` lands right after the
+  // #version line, which has to come first.
+  static void setSource(GLuint shader, const char *code, GLint length,
+                        const string &defines) {
+    GLint head = 0;
+    if (length >= 8 && !strncmp(code, "#version", 8)) {
+      const char *eol = (const char *)memchr(code, '\n', (size_t)length);
+      head = eol ? (GLint)(eol - code + 1) : length;
     }
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    const char *parts[3] = {code, defines.c_str(), code + head};
+    GLint lengths[3] = {head, (GLint)defines.size(), length - head};
+    glShaderSource(shader, 3, parts, lengths);
+  }
 
-    return textureID;
-  };
+  // Uniforms are looked up by hash alone; reflectUniforms() makes sure the
+  // program's names do not collide.
+  const ShaderUniform *find(UniformName name) const {
+    vector<ShaderUniform>::const_iterator it = lower_bound(
+        uniforms.begin(), uniforms.end(), name.hash,
+        [](const ShaderUniform &u, uint32_t hash) { return u.hash < hash; });
+    return it != uniforms.end() && it->hash == name.hash ? &*it : nullptr;
+  }
 
-  // utility uniform functions
-  void setBool(const string &name, bool value) const {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
-  };
+  // Reads every active uniform once, right after linking. Uniforms inside
+  // blocks have no location and are skipped; arrays are listed as "a[0]"
+  // and stored as "a".
+  void reflectUniforms() {
+    GLint count = 0, maxLength = 0;
+    glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+    vector<char> buffer(max(maxLength, 1));
+    for (GLint i = 0; i < count; i++) {
+      GLsizei length = 0;
+      ShaderUniform u;
+      glGetActiveUniform(ID, (GLuint)i, (GLsizei)buffer.size(), &length,
+                         &u.size, &u.type, buffer.data());
+      u.name.assign(buffer.data(), length);
+      u.location = glGetUniformLocation(ID, u.name.c_str());
+      if (u.location < 0)
+        continue;
+      size_t bracket = u.name.find('[');
+      if (bracket != string::npos)
+        u.name.erase(bracket);
+      u.hash = uniformHash(u.name.c_str());
+      uniforms.push_back(u);
+    }
+    sort(uniforms.begin(), uniforms.end(),
+         [](const ShaderUniform &a, const ShaderUniform &b) {
+           return a.hash < b.hash;
+         });
+    for (size_t i = 1; i < uniforms.size(); i++)
+      if (uniforms[i].hash == uniforms[i - 1].hash)
+        cout << "ERROR::SHADER::UNIFORM_HASH_COLLISION " << uniforms[i].name
+             << " " << uniforms[i - 1].name << endl;
+  }
+};
 
-  void setInt(const string &name, int value) const {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
-  };
-  void setFloat(const string &name, float value) const {
-    glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
-  };
-  void setVec3(const string &name, const glm::vec3 &value) const {
-    glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1,
-                 glm::value_ptr(value));
-  };
-  void setMat4(const string &name, const glm::mat4 &mat) const {
-    glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE,
-                       glm::value_ptr(mat));
-  };
+// Specializations of one vertex/fragment pair. Bit i of a variant key
+// switches macro i on: every macro is defined as true or false, so shaders
+// test them with a plain if and the compiler drops the dead branches. A
+// variant is compiled, or loaded from the program cache, the first time it
+// is asked for, so only combinations in use are ever built. The sources
+// are loaded once.
+class ShaderVariants {
+public:
+  // setup runs once on each new variant, e.g. to bind its uniform blocks.
+  ShaderVariants(const char *vertexPath, const char *fragmentPath,
+                 const vector<string> &macros,
+                 function<void(Shader &)> setup = nullptr)
+      : vertexSource(loadShaderSource(vertexPath)),
+        fragmentSource(loadShaderSource(fragmentPath)), macros(macros),
+        setup(setup), variants((size_t)1 << macros.size()), builtCount(0) {
+    if (!vertexSource.valid || !fragmentSource.valid)
+      cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << endl;
+  }
+
+  Shader &get(uint32_t key) {
+    unique_ptr<Shader> &variant = variants[key];
+    if (!variant) {
+      string defines;
+      for (size_t i = 0; i < macros.size(); i++)
+        defines += "#define " + macros[i] +
+                   ((key >> i) & 1 ? " true\n" : " false\n");
+      variant.reset(new Shader(
+          Shader::fromSource(vertexSource, fragmentSource, defines)));
+      if (setup)
+        setup(*variant);
+      builtCount++;
+    }
+    return *variant;
+  }
+
+  // Variants compiled so far, out of size() possible.
+  size_t built() const { return builtCount; }
+  size_t size() const { return variants.size(); }
+
+private:
+  ShaderSource vertexSource;
+  ShaderSource fragmentSource;
+  vector<string> macros;
+  function<void(Shader &)> setup;
+  vector<unique_ptr<Shader>> variants;
+  size_t builtCount;
 };
 
 #endif
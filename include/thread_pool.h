@@ -0,0 +1,125 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Fixed set of worker threads pulling jobs from a shared FIFO. Jobs must not
+// touch GL; results go back to the render thread through a queue.
+class ThreadPool {
+public:
+  explicit ThreadPool(unsigned int threadCount = 0) : stopping(false) {
+    if (threadCount == 0) {
+      threadCount = thread::hardware_concurrency();
+      // leave a core for the render thread
+      threadCount = threadCount > 1 ? threadCount - 1 : 1;
+    }
+    for (unsigned int i = 0; i < threadCount; i++)
+      workers.push_back(thread(&ThreadPool::workerLoop, this));
+  }
+
+  ~ThreadPool() {
+    {
+      lock_guard<mutex> lock(jobsMutex);
+      stopping = true;
+    }
+    jobsReady.notify_all();
+    for (size_t i = 0; i < workers.size(); i++)
+      workers[i].join();
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  void submit(function<void()> job) {
+    {
+      lock_guard<mutex> lock(jobsMutex);
+      jobs.push_back(move(job));
+    }
+    jobsReady.notify_one();
+  }
+
+  size_t size() const { return workers.size(); }
+
+private:
+  vector<thread> workers;
+  deque<function<void()>> jobs;
+  mutex jobsMutex;
+  condition_variable jobsReady;
+  bool stopping;
+
+  void workerLoop() {
+    for (;;) {
+      function<void()> job;
+      {
+        unique_lock<mutex> lock(jobsMutex);
+        jobsReady.wait(lock, [this] { return stopping || !jobs.empty(); });
+        if (stopping && jobs.empty())
+          return;
+        job = move(jobs.front());
+        jobs.pop_front();
+      }
+      job();
+    }
+  }
+};
+
+// Runs fn(0) .. fn(count - 1) spread over the pool and returns when all are
+// done. The calling thread works through the indices too, so this is safe to
+// call from inside a pool job: if every worker is busy, the caller simply
+// does all the work itself. Helpers that start late find nothing left and
+// return without touching fn. A null pool runs everything inline.
+inline void parallelFor(ThreadPool *pool, size_t count,
+                        const function<void(size_t)> &fn) {
+  if (!pool || count <= 1) {
+    for (size_t i = 0; i < count; i++)
+      fn(i);
+    return;
+  }
+
+  struct State {
+    atomic<size_t> next;
+    atomic<size_t> done;
+    size_t count;
+    const function<void(size_t)> *fn;
+    mutex doneMutex;
+    condition_variable allDone;
+  };
+  shared_ptr<State> state = make_shared<State>();
+  state->next = 0;
+  state->done = 0;
+  state->count = count;
+  state->fn = &fn;
+
+  auto work = [](State &s) {
+    for (;;) {
+      size_t i = s.next.fetch_add(1);
+      if (i >= s.count)
+        return;
+      (*s.fn)(i);
+      if (s.done.fetch_add(1) + 1 == s.count) {
+        lock_guard<mutex> lock(s.doneMutex);
+        s.allDone.notify_all();
+      }
+    }
+  };
+
+  size_t helpers = min(pool->size(), count - 1);
+  for (size_t h = 0; h < helpers; h++)
+    pool->submit([state, work]() { work(*state); });
+  work(*state);
+
+  unique_lock<mutex> lock(state->doneMutex);
+  state->allDone.wait(lock, [&state] { return state->done == state->count; });
+}
+
+#endif
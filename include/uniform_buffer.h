@@ -0,0 +1,181 @@
+#ifndef UNIFORM_BUFFER_H
+#define UNIFORM_BUFFER_H
+
+#include "shaders.h"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+// Binding points and array length of the uniform blocks declared in
+// shaders/uniforms.glsl.
+const GLuint FRAME_BLOCK_BINDING = 0;
+const GLuint OBJECT_BLOCK_BINDING = 1;
+// 128 entries of 80 bytes: within the 16 KB every GL 3.3 implementation
+// allows per block. Must match the array length in the shaders.
+const uint32_t OBJECT_BLOCK_CAPACITY = 128;
+
+// std140 layout of the Frame block.
+struct FrameData {
+  glm::mat4 projection;
+  glm::mat4 view;
+  glm::vec4 cameraPos; // w unused
+};
+
+enum ObjectFlag {
+  OBJECT_REFLECTION = 1,
+  OBJECT_REFRACTION = 2,
+  OBJECT_FRESNEL = 4,
+  OBJECT_DISPERSION = 8
+};
+
+// Macros that specialize main.frag (ShaderVariants), in ObjectFlag order.
+const char *const OBJECT_FLAG_MACROS[] = {"USE_REFLECTION", "USE_REFRACTION",
+                                          "USE_FRESNEL", "USE_DISPERSION"};
+const size_t OBJECT_FLAG_COUNT = 4;
+
+// The flags that change what main.frag computes, as a variant key: Fresnel
+// only blends reflection with refraction, and dispersion only splits
+// refraction, so they are dropped when that path is off.
+inline uint32_t shadingVariant(int32_t flags) {
+  if (!(flags & OBJECT_REFRACTION))
+    flags &= ~(OBJECT_FRESNEL | OBJECT_DISPERSION);
+  if (!(flags & OBJECT_REFLECTION))
+    flags &= ~OBJECT_FRESNEL;
+  return (uint32_t)flags;
+}
+
+// std140 layout of one entry of the Objects block's array.
+struct ObjectData {
+  glm::mat4 model;
+  float refractiveIndex;
+  float dispersionStrength;
+  float fresnelBase;
+  int32_t flags; // ObjectFlag bits
+};
+
+static_assert(sizeof(FrameData) == 144, "FrameData must match std140");
+static_assert(sizeof(ObjectData) == 80, "ObjectData must match std140");
+
+// Points a program's Frame and Objects blocks at their binding points.
+inline void bindUniformBlocks(const Shader &shader) {
+  shader.bindBlock("Frame", FRAME_BLOCK_BINDING, sizeof(FrameData));
+  shader.bindBlock("Objects", OBJECT_BLOCK_BINDING,
+                   OBJECT_BLOCK_CAPACITY * sizeof(ObjectData));
+}
+
+// The Frame block: camera state, uploaded once per frame and bound once.
+class FrameUniformBuffer {
+public:
+  FrameUniformBuffer() : buffer(0) {
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameData), nullptr,
+                 GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_BLOCK_BINDING, buffer);
+  }
+
+  ~FrameUniformBuffer() { glDeleteBuffers(1, &buffer); }
+
+  FrameUniformBuffer(const FrameUniformBuffer &) = delete;
+  FrameUniformBuffer &operator=(const FrameUniformBuffer &) = delete;
+
+  void upload(const FrameData &data) {
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameData), &data);
+  }
+
+private:
+  GLuint buffer;
+};
+
+// The Objects block: one entry per draw, collected for the whole frame and
+// uploaded with a single glBufferSubData. A draw then costs one
+// glUniform1i (the entry's index in the block) instead of a call per
+// uniform. Entries are grouped in windows of OBJECT_BLOCK_CAPACITY, the
+// most one block binding can see; a window is rebound with
+// glBindBufferRange when a draw's entry is outside the bound one. Any
+// program that went through bindUniformBlocks() can draw with the entries.
+class ObjectUniformBuffer {
+public:
+  ObjectUniformBuffer()
+      : buffer(0), allocated(0), count(0), boundWindow(NO_WINDOW) {
+    // window offsets must be multiples of the binding alignment; the
+    // padding between windows is whole (unused) entries
+    GLint alignment = 1;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    windowStride = OBJECT_BLOCK_CAPACITY;
+    while (windowStride * sizeof(ObjectData) % (size_t)max(alignment, 1))
+      windowStride++;
+    glGenBuffers(1, &buffer);
+  }
+
+  ~ObjectUniformBuffer() { glDeleteBuffers(1, &buffer); }
+
+  ObjectUniformBuffer(const ObjectUniformBuffer &) = delete;
+  ObjectUniformBuffer &operator=(const ObjectUniformBuffer &) = delete;
+
+  void clear() {
+    entries.clear();
+    count = 0;
+  }
+
+  // Returns the draw index to pass to select().
+  uint32_t add(const ObjectData &data) {
+    uint32_t index = count++;
+    size_t slot = index / OBJECT_BLOCK_CAPACITY * windowStride +
+                  index % OBJECT_BLOCK_CAPACITY;
+    if (entries.size() <= slot)
+      entries.resize(slot + 1);
+    entries[slot] = data;
+    return index;
+  }
+
+  uint32_t size() const { return count; }
+
+  // Orphans the buffer and uploads every entry added since clear().
+  void upload() {
+    boundWindow = NO_WINDOW;
+    if (entries.empty())
+      return;
+    // the last window is bound at full length, so it must fit in the buffer
+    size_t windows = (count - 1) / OBJECT_BLOCK_CAPACITY + 1;
+    size_t bytes = windows * windowStride * sizeof(ObjectData);
+    if (bytes > allocated)
+      allocated = max(bytes, allocated * 2);
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glBufferData(GL_UNIFORM_BUFFER, allocated, nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, entries.size() * sizeof(ObjectData),
+                    entries.data());
+  }
+
+  // Makes draw `index` the entry the shader reads. The shader must be
+  // current; the window binding is shared by all programs.
+  void select(const Shader &shader, uint32_t index) {
+    uint32_t window = index / OBJECT_BLOCK_CAPACITY;
+    if (window != boundWindow) {
+      glBindBufferRange(GL_UNIFORM_BUFFER, OBJECT_BLOCK_BINDING, buffer,
+                        window * windowStride * sizeof(ObjectData),
+                        OBJECT_BLOCK_CAPACITY * sizeof(ObjectData));
+      boundWindow = window;
+    }
+    shader.setInt(UNIFORM_NAME("objectIndex"),
+                  (int)(index % OBJECT_BLOCK_CAPACITY));
+  }
+
+private:
+  static const uint32_t NO_WINDOW = 0xffffffffu;
+
+  GLuint buffer;
+  size_t allocated;           // bytes
+  size_t windowStride;        // entries from one window to the next
+  vector<ObjectData> entries; // laid out as in the buffer
+  uint32_t count;
+  uint32_t boundWindow;
+};
+
+#endif
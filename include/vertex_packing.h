@@ -0,0 +1,190 @@
+#ifndef VERTEX_PACKING_H
+#define VERTEX_PACKING_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <vector>
+
+using namespace std;
+
+// Compact vertex layout: 12 bytes instead of the 24 of two vec3s.
+//  - position: three 16-bit unsigned normalized values over the mesh AABB
+//    (the fourth keeps attributes 4-byte aligned)
+//  - normal: octahedral encoding in two 16-bit signed integers
+// main.vert undoes both with positionScale/positionOffset and octDecode().
+
+enum VertexFormat { VERTEX_FORMAT_FLOAT, VERTEX_FORMAT_PACKED };
+
+struct Vertex {
+  glm::vec3 Position;
+  glm::vec3 Normal;
+};
+
+struct PackedVertex {
+  uint16_t position[4];
+  int16_t normal[2];
+};
+
+// Maps unit-range positions back onto the mesh bounds.
+struct VertexQuantization {
+  glm::vec3 scale;
+  glm::vec3 offset;
+
+  VertexQuantization() : scale(1.0f), offset(0.0f) {}
+};
+
+const float OCT_NORMAL_RANGE = 32767.0f;
+
+inline glm::vec2 octEncode(glm::vec3 n) {
+  n /= fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+  glm::vec2 e(n.x, n.y);
+  if (n.z < 0.0f) {
+    e.x = (1.0f - fabsf(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+    e.y = (1.0f - fabsf(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+  }
+  return e;
+}
+
+// Mirrors octDecode() in main.vert.
+inline glm::vec3 octDecode(glm::vec2 e) {
+  glm::vec3 n(e.x, e.y, 1.0f - fabsf(e.x) - fabsf(e.y));
+  float t = max(-n.z, 0.0f);
+  n.x += n.x >= 0.0f ? -t : t;
+  n.y += n.y >= 0.0f ? -t : t;
+  return glm::normalize(n);
+}
+
+inline uint16_t quantizeUnorm(float v) {
+  return (uint16_t)lrintf(glm::clamp(v, 0.0f, 1.0f) * 65535.0f);
+}
+
+// Picks the best of the rounded neighbours, which noticeably lowers the
+// worst-case angular error over plain rounding.
+inline void encodeNormal(const glm::vec3 &n, int16_t out[2]) {
+  glm::vec2 e = octEncode(n) * OCT_NORMAL_RANGE;
+  float bestErr = -2.0f;
+  for (int dx = 0; dx < 2; dx++) {
+    for (int dy = 0; dy < 2; dy++) {
+      float qx = glm::clamp(floorf(e.x) + dx, -OCT_NORMAL_RANGE,
+                            OCT_NORMAL_RANGE);
+      float qy = glm::clamp(floorf(e.y) + dy, -OCT_NORMAL_RANGE,
+                            OCT_NORMAL_RANGE);
+      float err =
+          glm::dot(octDecode(glm::vec2(qx, qy) / OCT_NORMAL_RANGE), n);
+      if (err > bestErr) {
+        bestErr = err;
+        out[0] = (int16_t)qx;
+        out[1] = (int16_t)qy;
+      }
+    }
+  }
+}
+
+// Geometric error introduced by packing, measured on the decoded values.
+struct PackingError {
+  float maxPosition;   // world units
+  float maxPositionRel; // fraction of the AABB diagonal
+  float maxNormalDeg;
+  float meanNormalDeg;
+  float maxRefractDeg; // deviation of a 45 degree ray refracted at IOR 1.52
+};
+
+inline glm::vec3 refractDir(const glm::vec3 &I, const glm::vec3 &N,
+                            float eta) {
+  float d = glm::dot(N, I);
+  float k = 1.0f - eta * eta * (1.0f - d * d);
+  if (k < 0.0f)
+    return glm::vec3(0.0f);
+  return I * eta - N * (eta * d + sqrtf(k));
+}
+
+// atan2 form stays accurate for the tiny angles quantization produces.
+inline float angleDeg(const glm::vec3 &a, const glm::vec3 &b) {
+  return glm::degrees(atan2f(glm::length(glm::cross(a, b)), glm::dot(a, b)));
+}
+
+template <typename V>
+void packVertices(const V *src, size_t count, vector<PackedVertex> &dst,
+                  VertexQuantization &q, PackingError *error = nullptr) {
+  dst.resize(count);
+  q = VertexQuantization();
+  if (count == 0)
+    return;
+
+  glm::vec3 lo = src[0].Position, hi = src[0].Position;
+  for (size_t i = 1; i < count; i++) {
+    lo = glm::min(lo, src[i].Position);
+    hi = glm::max(hi, src[i].Position);
+  }
+  q.offset = lo;
+  q.scale = glm::max(hi - lo, glm::vec3(1e-20f));
+  glm::vec3 inv = glm::vec3(1.0f) / q.scale;
+
+  PackingError err = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+  double normalSum = 0.0;
+  const float ior = 1.52f;
+
+  for (size_t i = 0; i < count; i++) {
+    glm::vec3 u = (src[i].Position - q.offset) * inv;
+    PackedVertex &p = dst[i];
+    p.position[0] = quantizeUnorm(u.x);
+    p.position[1] = quantizeUnorm(u.y);
+    p.position[2] = quantizeUnorm(u.z);
+    p.position[3] = 0;
+
+    glm::vec3 n = src[i].Normal;
+    float len = glm::length(n);
+    n = len > 0.0f ? n / len : glm::vec3(0.0f, 1.0f, 0.0f);
+    encodeNormal(n, p.normal);
+
+    if (!error)
+      continue;
+
+    glm::vec3 decoded =
+        q.offset + glm::vec3(p.position[0], p.position[1], p.position[2]) /
+                       65535.0f * q.scale;
+    err.maxPosition =
+        max(err.maxPosition, glm::length(decoded - src[i].Position));
+
+    glm::vec3 dn =
+        octDecode(glm::vec2(p.normal[0], p.normal[1]) / OCT_NORMAL_RANGE);
+    float a = angleDeg(n, dn);
+    err.maxNormalDeg = max(err.maxNormalDeg, a);
+    normalSum += a;
+
+    // a ray hitting the surface at 45 degrees, in the plane of the normal
+    glm::vec3 t = fabsf(n.y) < 0.9f ? glm::vec3(0, 1, 0) : glm::vec3(1, 0, 0);
+    t = glm::normalize(glm::cross(n, t));
+    glm::vec3 I = glm::normalize(t - n);
+    err.maxRefractDeg = max(err.maxRefractDeg,
+                            angleDeg(refractDir(I, n, 1.0f / ior),
+                                     refractDir(I, dn, 1.0f / ior)));
+  }
+
+  if (error) {
+    float diagonal = glm::length(hi - lo);
+    err.maxPositionRel = diagonal > 0.0f ? err.maxPosition / diagonal : 0.0f;
+    err.meanNormalDeg = (float)(normalSum / count);
+    *error = err;
+  }
+}
+
+inline void reportPackingError(const char *label, size_t vertexCount,
+                               size_t floatStride, const PackingError &e) {
+  char line[256];
+  snprintf(line, sizeof(line),
+           "VERTEX_PACKING::%s %zu vertices, %zu -> %zu bytes/vertex, "
+           "position error %.2e (%.4f%% of extent), normal error max %.4f "
+           "mean %.4f deg, refraction deviation max %.4f deg",
+           label, vertexCount, floatStride, sizeof(PackedVertex),
+           e.maxPosition, e.maxPositionRel * 100.0f, e.maxNormalDeg,
+           e.meanNormalDeg, e.maxRefractDeg);
+  cout << line << endl;
+}
+
+#endif
@@ -4,17 +4,19 @@ out vec4 FragColor;
 in vec3 Normal;
 in vec3 Position;
 
-uniform vec3 cameraPos;
-uniform samplerCube skybox;
+#include "uniforms.glsl"
 
-uniform float refractiveIndex;
-uniform float fresnelBase;          
-uniform float dispersionStrength;
+uniform samplerCube skybox;
 
-uniform bool useDispersion;
-uniform bool useFresnel;
-uniform bool useRefraction;
-uniform bool useReflection;
+// Feature switches. ShaderVariants defines each one as true or false to
+// build a specialized program; the uber-shader (no defines) reads them from
+// the object's flags at run time.
+#ifndef USE_REFLECTION
+#define USE_REFLECTION ((object.flags & 1) != 0)
+#define USE_REFRACTION ((object.flags & 2) != 0)
+#define USE_FRESNEL ((object.flags & 4) != 0)
+#define USE_DISPERSION ((object.flags & 8) != 0)
+#endif
 
 float fresnelSchlick(float cosTheta, float F0)
 {
@@ -23,8 +25,17 @@ float fresnelSchlick(float cosTheta, float F0)
 
 void main()
 {
+    ObjectData object = objects[objectIndex];
+    float refractiveIndex = object.refractiveIndex;
+    float fresnelBase = object.fresnelBase;
+    float dispersionStrength = object.dispersionStrength;
+    bool useReflection = USE_REFLECTION;
+    bool useRefraction = USE_REFRACTION;
+    bool useFresnel = USE_FRESNEL;
+    bool useDispersion = USE_DISPERSION;
+
     vec3 normal = normalize(Normal);
-    vec3 I = normalize(Position - cameraPos);
+    vec3 I = normalize(Position - cameraPos.xyz);
 
 
     vec3 reflectedColor = vec3(0.0);
@@ -1,17 +1,35 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aOctNormal;
 
 out vec3 Normal;
 out vec3 Position;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+#include "uniforms.glsl"
+
+// Packed meshes store positions as unorm16 over their bounds and normals
+// octahedral-encoded; float meshes use scale 1, offset 0.
+uniform vec3 positionScale;
+uniform vec3 positionOffset;
+uniform bool octNormals;
+
+vec3 octDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.x += n.x >= 0.0 ? -t : t;
+    n.y += n.y >= 0.0 ? -t : t;
+    return normalize(n);
+}
 
 void main()
 {
-    Normal = mat3(transpose(inverse(model))) * aNormal;
-    Position = vec3(model * vec4(aPos, 1.0));
+    vec3 localPos = aPos * positionScale + positionOffset;
+    vec3 localNormal = octNormals ? octDecode(aOctNormal / 32767.0) : aNormal;
+    mat4 model = objects[objectIndex].model;
+
+    Normal = mat3(transpose(inverse(model))) * localNormal;
+    Position = vec3(model * vec4(localPos, 1.0));
     gl_Position = projection * view * vec4(Position, 1.0);
 }  
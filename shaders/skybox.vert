@@ -3,8 +3,7 @@ layout (location = 0) in vec3 aPos;
 
 out vec3 textureDir;
 
-uniform mat4 projection;
-uniform mat4 view;
+#include "uniforms.glsl"
 
 void main()
 {
@@ -0,0 +1,25 @@
+// std140 blocks filled by uniform_buffer.h: the camera once per frame, and
+// one ObjectData per draw, picked by objectIndex. Included by the stages
+// (#include is expanded by shader_source.h, not by GL).
+layout (std140) uniform Frame
+{
+    mat4 projection;
+    mat4 view;
+    vec4 cameraPos;
+};
+
+struct ObjectData
+{
+    mat4 model;
+    float refractiveIndex;
+    float dispersionStrength;
+    float fresnelBase;
+    int flags; // 1 reflection, 2 refraction, 4 Fresnel, 8 dispersion
+};
+
+layout (std140) uniform Objects
+{
+    ObjectData objects[128]; // OBJECT_BLOCK_CAPACITY
+};
+
+uniform int objectIndex;
@@ -14,9 +14,19 @@
 
 #include <string>
 
+#include "asset_manager.h"
 #include "camera.h"
+#include "cubemap_cache.h"
+#include "lod.h"
+#include "mesh_stream.h"
+#include "meshlet.h"
 #include "model.h"
+#include "resource_registry.h"
+#include "scene.h"
+#include "scene_store.h"
 #include "shaders.h"
+#include "thread_pool.h"
+#include "uniform_buffer.h"
 
 using namespace std;
 
@@ -42,7 +52,19 @@ const char *dockFaces[6] = {
 
 const char **cubemapOptions[] = {dockFaces, vaticanFaces};
 const char *cubemapNames[] = {"Dock", "Vatican"};
+const int cubemapCount = IM_ARRAYSIZE(cubemapNames);
 int currentCubemap = 0;
+float lodPixelError = LOD_PIXEL_ERROR;
+bool meshletCulling = true;
+bool specializedShaders = true; // per-material variants, else the uber-shader
+
+// Select a skybox and warm up its neighbours in the combo so the next switch
+// is already resident.
+void selectCubemap(CubemapCache &cache, int index) {
+  cache.select(cubemapOptions[index]);
+  cache.prefetch(cubemapOptions[(index + 1) % cubemapCount]);
+  cache.prefetch(cubemapOptions[(index + cubemapCount - 1) % cubemapCount]);
+}
 
 // --- globals for input ---
 Camera *gCamera = nullptr;
@@ -50,35 +72,23 @@ float gLastX = 0.0f;
 float gLastY = 0.0f;
 bool gFirstMouse = true;
 
-struct TransmittanceVars {
-  bool useReflection = true;
-  bool useRefraction = true;
-  bool useFresnel = true;
-  bool useDispersion = true;
-
-  float IOR = 1.52f;
-  float dispersionStrength = 0.01f;
-  float fresnelBase = 0.04f;
-
-  bool rotate = true;
-  float rotateSpeedDeg = 30.0f;
-  float rotateAngleDeg = 0.0f;
-
-  glm::vec3 position = glm::vec3(0.0f);
-  glm::vec3 scale = glm::vec3(1.0f);
-  glm::vec3 rotAxis = glm::vec3(0, 1, 0);
-
-  glm::vec3 baseRotationDeg = glm::vec3(0.0f);
-};
-
-struct SceneObject {
-  std::string name;
-  Model model;
-  TransmittanceVars p;
+int32_t materialFlags(const Material &m) {
+  return (m.useReflection ? OBJECT_REFLECTION : 0) |
+         (m.useRefraction ? OBJECT_REFRACTION : 0) |
+         (m.useFresnel ? OBJECT_FRESNEL : 0) |
+         (m.useDispersion ? OBJECT_DISPERSION : 0);
+}
 
-  SceneObject(const std::string &n, const std::string &path)
-      : name(n), model(path.c_str()) {}
-};
+// Objects block entry for one draw with the given material.
+ObjectData objectData(const glm::mat4 &model, const Material &m) {
+  ObjectData d;
+  d.model = model;
+  d.refractiveIndex = m.IOR;
+  d.dispersionStrength = m.dispersionStrength;
+  d.fresnelBase = m.fresnelBase;
+  d.flags = materialFlags(m);
+  return d;
+}
 
 void framebuffer_size_callback(GLFWwindow *window, int w, int h) {
   glViewport(0, 0, w, h);
@@ -148,7 +158,12 @@ void processInput(GLFWwindow *window) {
     gCamera->ProcessKeyboard(DOWN, deltaTime);
 }
 
-int main() {
+// Usage: lab2 [assets.pak ...] [grid.scene] [sculpture.mstream ...]
+// Archives made with asset_pack are mounted before anything loads; without
+// one, assets.pak is used when present and loose files otherwise. A scene
+// file (scene_gen) replaces the default row of six objects. Streaming files
+// made with stream_build are placed in a row behind the regular objects.
+int main(int argc, char **argv) {
 
   if (!glfwInit())
     return -1;
@@ -182,6 +197,8 @@ int main() {
     cerr << "Failed to initialize GLAD\n";
     return -1;
   }
+  // Linked shader programs are cached on disk when the driver allows it
+  programCache().init((GLADloadproc)glfwGetProcAddress);
 
   IMGUI_CHECKVERSION();
   ImGui::CreateContext();
@@ -191,6 +208,17 @@ int main() {
   ImGui_ImplGlfw_InitForOpenGL(window, true);
   ImGui_ImplOpenGL3_Init("#version 330 core");
 
+  // Tears down ImGui and the context on the way out of main, after every
+  // object declared below has released its GL resources.
+  struct ContextGuard {
+    ~ContextGuard() {
+      ImGui_ImplOpenGL3_Shutdown();
+      ImGui_ImplGlfw_Shutdown();
+      ImGui::DestroyContext();
+      glfwTerminate();
+    }
+  } contextGuard;
+
   gCamera = &camera;
   gLastX = width / 2.0f;
   gLastY = height / 2.0f;
@@ -200,28 +228,115 @@ int main() {
   // Configure OpenGL
   glEnable(GL_DEPTH_TEST);
 
-  // Load shaders
+  // Mount asset archives; reads fall back to loose files
+  bool mounted = false;
+  for (int i = 1; i < argc; i++)
+    if (hasExtension(argv[i], ".pak"))
+      mounted = assetFiles().mount(argv[i]) || mounted;
+  if (!mounted && assetFiles().exists(ASSET_ARCHIVE_DEFAULT))
+    assetFiles().mount(ASSET_ARCHIVE_DEFAULT);
+
+  // Load shaders. The main shader comes as an uber-shader and as variants
+  // specialized on the material switches, built when first used.
   Shader shader("shaders/main.vert", "shaders/main.frag");
   Shader skyboxShader("shaders/skybox.vert", "shaders/skybox.frag");
-  unsigned int cubemapTexture = skyboxShader.loadCubemap(cubemapOptions[0]);
-
-  // Load Models
-  vector<SceneObject> objects;
-  objects.emplace_back("Ball", "assets/models/ball.obj");
-  objects.emplace_back("Skull", "assets/models/skull.obj");
-  objects.emplace_back("Teapot", "assets/models/utah_teapot.obj");
-  objects.emplace_back("Ring", "assets/models/ring.obj");
-  objects.emplace_back("Teardrop", "assets/models/teardrop.obj");
-  objects.emplace_back("Star", "assets/models/star.obj");
-
+  ShaderVariants shaderVariants(
+      "shaders/main.vert", "shaders/main.frag",
+      vector<string>(OBJECT_FLAG_MACROS,
+                     OBJECT_FLAG_MACROS + OBJECT_FLAG_COUNT),
+      bindUniformBlocks);
+  // Camera state for both shaders, and the per-draw entries of the main one
+  FrameUniformBuffer frameUniforms;
+  bindUniformBlocks(shader);
+  bindUniformBlocks(skyboxShader);
+  ObjectUniformBuffer draws;
+
+  // Assets decode in the background; placeholders draw until they are ready
+  ThreadPool pool;
+  AssetManager assets(pool);
+  ResourceRegistry resources(pool, assets);
+  CubemapCache cubemaps(resources, assets);
+  selectCubemap(cubemaps, currentCubemap);
+
+  // Load Models, quantized to the compact vertex layout
+  const VertexFormat format = VERTEX_FORMAT_PACKED;
+  // Streamed meshes share one fixed-size pool, created only when needed;
+  // declared first so it outlives the objects drawing from it
+  unique_ptr<GeometryArena> streamPool;
+  SceneStore objects;
   const float spacing = 10.0f;
+  SceneDescription scene;
+  for (int i = 1; i < argc; i++)
+    if (hasExtension(argv[i], ".scene") && !loadScene(argv[i], scene))
+      scene = SceneDescription();
+
+  if (!scene.objects.empty()) {
+    for (size_t i = 0; i < scene.objects.size(); i++) {
+      const SceneEntry &e = scene.objects[i];
+      objects.add(e.name, e.p,
+                  objects.addModel(resources.model(e.model, format)));
+    }
+    if (scene.hasCamera) {
+      camera.position = scene.cameraPosition;
+      camera.Yaw = scene.cameraYaw;
+      camera.Pitch = scene.cameraPitch;
+      camera.updateCameraVectors();
+    }
+  } else {
+    const char *defaults[][2] = {
+        {"Ball", "assets/models/ball.obj"},
+        {"Skull", "assets/models/skull.obj"},
+        {"Teapot", "assets/models/utah_teapot.obj"},
+        {"Ring", "assets/models/ring.obj"},
+        {"Teardrop", "assets/models/teardrop.obj"},
+        {"Star", "assets/models/star.obj"}};
+    const int count = IM_ARRAYSIZE(defaults);
+
+    // Side-by-side layout centered around origin
+    float startX = -spacing * (count - 1) * 0.5f;
+    for (int i = 0; i < count; i++) {
+      TransmittanceVars p;
+      p.position.x = startX + i * spacing;
+      objects.add(defaults[i][0], p,
+                  objects.addModel(resources.model(defaults[i][1], format)));
+    }
+  }
 
-  // Side-by-side layout centered around origin
-  float startX = -spacing * (objects.size() - 1) * 0.5f;
-  for (int i = 0; i < (int)objects.size(); i++) {
-    objects[i].p.position.x = startX + i * spacing;
-    objects[i].p.position.z = 0.0f;
+  // Streamed meshes from the command line
+  vector<shared_ptr<StreamedMesh>> streamed;
+  vector<const char *> streamedNames;
+  for (int i = 1; i < argc; i++) {
+    if (!hasExtension(argv[i], ".mstream"))
+      continue;
+    if (!streamPool)
+      streamPool.reset(new GeometryArena(
+          VERTEX_FORMAT_FLOAT, STREAM_POOL_VERTICES, STREAM_POOL_INDICES));
+    shared_ptr<StreamedMesh> stream =
+        make_shared<StreamedMesh>(argv[i], *streamPool, pool);
+    if (stream->valid()) {
+      streamed.push_back(stream);
+      streamedNames.push_back(argv[i]);
+    }
   }
+  for (size_t i = 0; i < streamed.size(); i++) {
+    glm::vec4 b = streamed[i]->bounds();
+    float s = 4.0f / max(b.w, 1e-6f); // fit into the row's spacing
+    TransmittanceVars p;
+    p.scale = glm::vec3(s);
+    p.rotate = false;
+    p.position = glm::vec3(spacing * ((float)i - (streamed.size() - 1) * 0.5f),
+                           0.0f, -2.0f * spacing) -
+                 glm::vec3(b) * s;
+    objects.addStreamed(streamedNames[i], p, objects.addStream(streamed[i]));
+  }
+
+  // Far enough to see the whole scene from where it starts; generated grids
+  // can be far larger than the default row
+  float farPlane = 500.0f;
+  for (size_t i = 0; i < objects.size(); i++)
+    farPlane = max(farPlane, 1.5f * glm::length(objects.position[i] -
+                                                camera.position) +
+                                 spacing);
 
   float skyboxVertices[] = {
       // positions
@@ -254,6 +369,12 @@ int main() {
   glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void *)0);
   glBindVertexArray(0);
 
+  MeshletCuller culler;
+  vector<uint32_t> visible;
+  vector<uint32_t> firstDraw; // per visible object, into draws
+  vector<uint64_t> drawOrder;  // variant << 32 | object, sorted
+  int programSwitches = 0;
+
   // Render loop
   while (!glfwWindowShouldClose(window)) {
     float currentFrame = glfwGetTime();
@@ -262,6 +383,15 @@ int main() {
 
     processInput(window);
 
+    // Upload whatever finished decoding, within the frame budget
+    assets.update();
+    cubemaps.update();
+    resources.collect();
+    unsigned int cubemapTexture = cubemaps.current();
+
+    // Animation and world matrices; only what moved is recomputed
+    objects.update(deltaTime);
+
     ImGui_ImplOpenGL3_NewFrame();
     ImGui_ImplGlfw_NewFrame();
     ImGui::NewFrame();
@@ -273,46 +403,101 @@ int main() {
     // ImGui UI
     if (showUI) {
       ImGui::Begin("Material Controls");
+      if (assets.busy())
+        ImGui::Text("Loading assets... %d/%d", assets.completedCount(),
+                    assets.requestedCount());
       static int lastCubemap = currentCubemap;
       if (ImGui::Combo("Cubemap", &currentCubemap, cubemapNames,
-                       IM_ARRAYSIZE(cubemapNames))) {
+                       cubemapCount)) {
         if (currentCubemap != lastCubemap) {
-          cubemapTexture =
-              skyboxShader.loadCubemap(cubemapOptions[currentCubemap]);
+          selectCubemap(cubemaps, currentCubemap);
           lastCubemap = currentCubemap;
         }
       }
+      ImGui::Text("Skybox VRAM: %.1f / %.0f MB%s",
+                  cubemaps.residentBytes() / (1024.0 * 1024.0),
+                  cubemaps.budgetBytes() / (1024.0 * 1024.0),
+                  cubemaps.switching() ? " (switching)" : "");
+      ImGui::SliderFloat("LOD Error (px)", &lodPixelError, 0.25f, 8.0f,
+                         "%.2f");
+      ImGui::Checkbox("Meshlet Culling", &meshletCulling);
+      if (meshletCulling)
+        ImGui::Text("Meshlets: %zu/%zu drawn (%zu frustum, %zu backface), "
+                    "%zu tris",
+                    culler.tested - culler.frustumCulled -
+                        culler.backfaceCulled,
+                    culler.tested, culler.frustumCulled,
+                    culler.backfaceCulled, culler.triangles);
+      ImGui::Checkbox("Specialized Shaders", &specializedShaders);
+      ImGui::Text("Shader variants: %zu/%zu built, %d program switches",
+                  shaderVariants.built(), shaderVariants.size(),
+                  programSwitches);
+      ImGui::Text("Objects: %zu/%zu visible, %zu/%zu transforms updated",
+                  visible.size(), objects.size(),
+                  objects.graph.lastUpdated(), objects.graph.size());
+      ResourceStats rs = resources.stats();
+      ImGui::Text("Resources: %d models, %d cubemaps, %d refs, %.1f MB GPU",
+                  rs.models, rs.cubemaps, rs.references,
+                  (rs.modelBytes + rs.cubemapBytes) / (1024.0 * 1024.0));
+      GeometryArena &geometry = assets.geometry(format);
+      GeometryArenaStats gs = geometry.stats();
+      ImGui::Text("Geometry: %.1f / %.1f MB, %zu meshes, %zu free blocks",
+                  (gs.vertexBytes + gs.indexBytes) / (1024.0 * 1024.0),
+                  (gs.vertexCapacityBytes + gs.indexCapacityBytes) /
+                      (1024.0 * 1024.0),
+                  gs.allocations, gs.freeBlocks);
+      ImGui::SameLine();
+      if (ImGui::Button("Compact"))
+        geometry.compact();
       for (int i = 0; i < (int)objects.size(); i++) {
-        SceneObject &o = objects[i];
+        Material &m = objects.materials[objects.material[i]];
 
         // Collapsible section per object
-        if (ImGui::TreeNode((o.name + "##" + std::to_string(i)).c_str())) {
+        if (ImGui::TreeNode(
+                (objects.name[i] + "##" + std::to_string(i)).c_str())) {
 
-          ImGui::Checkbox("Reflection", &o.p.useReflection);
-          ImGui::Checkbox("Refraction", &o.p.useRefraction);
-          ImGui::BeginDisabled(!o.p.useRefraction);
-          ImGui::Checkbox("Fresnel", &o.p.useFresnel);
+          ImGui::Checkbox("Reflection", &m.useReflection);
+          ImGui::Checkbox("Refraction", &m.useRefraction);
+          ImGui::BeginDisabled(!m.useRefraction);
+          ImGui::Checkbox("Fresnel", &m.useFresnel);
           ImGui::EndDisabled();
-          ImGui::Checkbox("Dispersion", &o.p.useDispersion);
+          ImGui::Checkbox("Dispersion", &m.useDispersion);
 
           ImGui::Separator();
           // Replace material dropdown with a direct IOR slider (1.0 - 2.5).
           // Disable when refraction is turned off.
-          ImGui::BeginDisabled(!o.p.useRefraction);
-          ImGui::SliderFloat("Refractive Index (IOR)", &o.p.IOR, 1.0f, 2.5f,
+          ImGui::BeginDisabled(!m.useRefraction);
+          ImGui::SliderFloat("Refractive Index (IOR)", &m.IOR, 1.0f, 2.5f,
                              "%.3f");
           ImGui::EndDisabled();
 
-          ImGui::BeginDisabled(!o.p.useDispersion || !o.p.useRefraction);
-          ImGui::SliderFloat("Dispersion Strength", &o.p.dispersionStrength,
+          ImGui::BeginDisabled(!m.useDispersion || !m.useRefraction);
+          ImGui::SliderFloat("Dispersion Strength", &m.dispersionStrength,
                              0.0f, 0.05f);
           ImGui::EndDisabled();
 
-          ImGui::BeginDisabled(!o.p.useFresnel);
+          ImGui::BeginDisabled(!m.useFresnel);
           ImGui::SliderFloat("F0 (Normal-incidence reflectance)",
-                             &o.p.fresnelBase, 0.0f, 1.0f);
+                             &m.fresnelBase, 0.0f, 1.0f);
           ImGui::EndDisabled();
 
+          if (objects.stream[i] != RESOURCE_HANDLE_NONE) {
+            MeshStreamStats ss =
+                objects.streams[objects.stream[i]]->stats();
+            ImGui::Text("Chunks: %zu drawn, %zu/%zu resident, %zu loading, "
+                        "%zu evicted",
+                        ss.drawn, ss.resident, ss.nodes, ss.loading,
+                        ss.evictions);
+            ImGui::Text("%zu triangles", ss.triangles);
+          } else {
+            const Model &model = *objects.models[objects.model[i]];
+            if (model.ready())
+              ImGui::Text("LOD %d/%d (%.0f px)", objects.lod[i].level,
+                          model.lodCount() - 1, objects.lod[i].screenRadius);
+            else if (model.failed())
+              ImGui::Text("Failed to load");
+          }
+
           ImGui::TreePop();
         }
       }
@@ -322,59 +507,100 @@ int main() {
 
     // Set transformations
     glm::mat4 projection = glm::perspective(
-        glm::radians(camera.zoom), (float)width / (float)height, 0.1f, 500.0f);
+        glm::radians(camera.zoom), (float)width / (float)height, 0.1f,
+        farPlane);
     glm::mat4 view = camera.GetViewMatrix();
-    glm::mat4 skyboxView = glm::mat4(glm::mat3(view));
+    FrameData frame = {projection, view, glm::vec4(camera.position, 1.0f)};
+    frameUniforms.upload(frame);
 
-    // Use shader and set uniforms
-    shader.use();
-    shader.setMat4("projection", projection);
-    shader.setMat4("view", view);
-    shader.setVec3("cameraPos", camera.position);
+    culler.begin(projection * view, camera.position);
 
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
-    shader.setInt("skybox", 0);
-
-    for (auto &o : objects) {
-      // animate rotation
-      if (o.p.rotate) {
-        o.p.rotateAngleDeg += o.p.rotateSpeedDeg * deltaTime;
-        if (o.p.rotateAngleDeg > 360.0f)
-          o.p.rotateAngleDeg -= 360.0f;
-      }
+
+    // Visible objects grouped by shader variant, so each program is made
+    // current once per frame
+    objects.cull(projection * view, visible);
+    drawOrder.resize(visible.size());
+    for (size_t k = 0; k < visible.size(); k++) {
+      uint32_t i = visible[k];
+      Material &m = objects.materials[objects.material[i]];
 
       // enforce UI constraints: Fresnel requires refraction
-      if (!o.p.useRefraction)
-        o.p.useFresnel = false;
-
-      // set per-object uniforms
-      shader.setBool("useReflection", o.p.useReflection);
-      shader.setBool("useRefraction", o.p.useRefraction);
-      shader.setBool("useFresnel", o.p.useFresnel);
-      shader.setBool("useDispersion", o.p.useDispersion);
-
-      shader.setFloat("refractiveIndex", o.p.IOR);
-      shader.setFloat("dispersionStrength", o.p.dispersionStrength);
-      shader.setFloat("fresnelBase", o.p.fresnelBase);
-
-      // model matrix
-      glm::mat4 model = glm::mat4(1.0f);
-      model = glm::translate(model, o.p.position);
-      // Only use the animation rotation, no more 'baseRotationDeg' needed
-      model = glm::rotate(model, glm::radians(o.p.rotateAngleDeg), o.p.rotAxis);
-      model = glm::scale(model, o.p.scale);
-      shader.setMat4("model", model);
-
-      o.model.Draw(shader);
+      if (!m.useRefraction)
+        m.useFresnel = false;
+
+      uint64_t variant =
+          specializedShaders ? shadingVariant(materialFlags(m)) : 0;
+      drawOrder[k] = variant << 32 | i;
     }
+    sort(drawOrder.begin(), drawOrder.end());
+    for (size_t k = 0; k < visible.size(); k++)
+      visible[k] = (uint32_t)drawOrder[k];
+
+    // One Objects entry per draw (each part of a ready model, otherwise the
+    // object itself), uploaded together before anything is drawn
+    draws.clear();
+    firstDraw.resize(visible.size());
+    for (size_t k = 0; k < visible.size(); k++) {
+      uint32_t i = visible[k];
+      const Material &m = objects.materials[objects.material[i]];
+      firstDraw[k] = draws.size();
+      if (objects.stream[i] != RESOURCE_HANDLE_NONE ||
+          !objects.models[objects.model[i]]->ready()) {
+        draws.add(objectData(objects.world(i), m));
+      } else if (objects.firstPart[i] != SCENE_NODE_NONE) {
+        size_t parts = objects.models[objects.model[i]]->meshCount();
+        for (size_t p = 0; p < parts; p++)
+          draws.add(objectData(
+              objects.graph.world(objects.firstPart[i] + (SceneNode)p), m));
+      }
+    }
+    draws.upload();
+
+    Shader *current = nullptr;
+    programSwitches = 0;
+    for (size_t k = 0; k < visible.size(); k++) {
+      uint32_t i = visible[k];
+      uint32_t variant = (uint32_t)(drawOrder[k] >> 32);
+      Shader &program =
+          specializedShaders ? shaderVariants.get(variant) : shader;
+      if (&program != current) {
+        program.use();
+        program.setInt("skybox", 0);
+        current = &program;
+        programSwitches++;
+      }
+
+      const glm::mat4 &world = objects.world(i);
+      if (objects.stream[i] != RESOURCE_HANDLE_NONE) {
+        StreamedMesh &stream = *objects.streams[objects.stream[i]];
+        draws.select(program, firstDraw[k]);
+        stream.update(world, camera, (float)height, lodPixelError);
+        stream.draw(program);
+        continue;
+      }
+
+      Model &model = *objects.models[objects.model[i]];
+      if (!model.ready()) {
+        draws.select(program, firstDraw[k]);
+        assets.placeholderModel().Draw(program);
+      } else if (objects.firstPart[i] != SCENE_NODE_NONE) {
+        // parts were added together, so their world matrices are adjacent
+        model.Draw(program,
+                   selectLod(model, world, camera, (float)height,
+                             objects.lod[i], lodPixelError),
+                   meshletCulling ? &culler : nullptr,
+                   &objects.graph.world(objects.firstPart[i]), &draws,
+                   firstDraw[k]);
+      }
+    }
+    GeometryArena::unbind();
 
     glDepthFunc(GL_LEQUAL);
     glDepthMask(GL_FALSE);
 
     skyboxShader.use();
-    skyboxShader.setMat4("projection", projection);
-    skyboxShader.setMat4("view", skyboxView);
     skyboxShader.setInt("skybox", 0);
 
     glActiveTexture(GL_TEXTURE0);
@@ -395,11 +621,5 @@ int main() {
     glfwPollEvents();
   }
 
-  // Cleanup
-  ImGui_ImplOpenGL3_Shutdown();
-  ImGui_ImplGlfw_Shutdown();
-  ImGui::DestroyContext();
-  glfwTerminate();
-
   return 0;
 }
@@ -0,0 +1,211 @@
+// Packs assets into one archive for the app to mount (asset_archive.h).
+//
+//   asset_pack [--store] [--level N] [--meshes] output.pak path...
+//
+// Directories are added recursively, in sorted order so that files used
+// together sit next to each other. Entries are named by their path as
+// given, so run the packer from the directory the app runs in:
+//
+//   ./build/asset_pack assets.pak shaders assets
+//
+// Each entry is zlib-compressed unless that saves less than 10% (PNG, JPG
+// and .mshz data barely shrink) or --store is given. With --meshes, models
+// go through the import pipeline and are stored as <model>.mshz in place of
+// their source, so loading them from the archive skips import entirely.
+
+#include "asset_archive.h"
+#include "mesh_codec.h"
+#include "model.h"
+#include "thread_pool.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+static const char *MODEL_EXTENSIONS[] = {".obj",  ".ply", ".stl", ".fbx",
+                                         ".gltf", ".glb", ".dae", ".3ds"};
+
+static bool isModel(const string &path) {
+  for (size_t i = 0; i < sizeof(MODEL_EXTENSIONS) / sizeof(char *); i++)
+    if (hasExtension(path, MODEL_EXTENSIONS[i]))
+      return true;
+  return false;
+}
+
+static void collect(const string &path, vector<string> &files) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    cout << "ERROR::ASSET_PACK::NOT_FOUND " << path << endl;
+    return;
+  }
+  if (!S_ISDIR(st.st_mode)) {
+    files.push_back(normalizeAssetPath(path));
+    return;
+  }
+
+  vector<string> children;
+  DIR *dir = opendir(path.c_str());
+  if (!dir)
+    return;
+  while (dirent *child = readdir(dir))
+    if (child->d_name[0] != '.') // also skips hidden files
+      children.push_back(child->d_name);
+  closedir(dir);
+  sort(children.begin(), children.end());
+  for (size_t i = 0; i < children.size(); i++)
+    collect(path + "/" + children[i], files);
+}
+
+// Processed meshes of a model as a .mshz image.
+static bool packMeshes(const string &path, ThreadPool &pool,
+                       vector<unsigned char> &image) {
+  ModelData data = Model::decode(path, VERTEX_FORMAT_FLOAT, false, &pool);
+  if (!data.ok)
+    return false;
+  vector<MeshCacheBlob> blobs;
+  for (size_t i = 0; i < data.meshes.size(); i++)
+    blobs.push_back(data.meshes[i].blob());
+  return encodeMeshContainer(blobs, sizeof(Vertex), image);
+}
+
+int main(int argc, char **argv) {
+  bool store = false, meshes = false;
+  int level = Z_BEST_COMPRESSION;
+  vector<string> args;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--store"))
+      store = true;
+    else if (!strcmp(argv[i], "--meshes"))
+      meshes = true;
+    else if (!strcmp(argv[i], "--level") && i + 1 < argc)
+      level = atoi(argv[++i]);
+    else
+      args.push_back(argv[i]);
+  }
+  if (args.size() < 2) {
+    cout << "usage: asset_pack [--store] [--level N] [--meshes] output.pak "
+            "path..."
+         << endl;
+    return 1;
+  }
+
+  string output = normalizeAssetPath(args[0]);
+  vector<string> files;
+  for (size_t i = 1; i < args.size(); i++)
+    collect(args[i], files);
+  files.erase(remove(files.begin(), files.end(), output), files.end());
+  vector<string> unique;
+  for (size_t i = 0; i < files.size(); i++)
+    if (find(unique.begin(), unique.end(), files[i]) == unique.end())
+      unique.push_back(files[i]);
+  files.swap(unique);
+
+  // The table and names go in front of the data but are only final once
+  // every entry is packed, so room is reserved for the longest names
+  // (".mshz" suffixes) and filled in last.
+  size_t nameCapacity = 0;
+  for (size_t i = 0; i < files.size(); i++)
+    nameCapacity += files[i].size() + 5;
+  uint64_t dataStart = (sizeof(AssetArchiveHeader) +
+                        files.size() * sizeof(AssetArchiveEntry) +
+                        nameCapacity + 15) &
+                       ~15ull;
+
+  string tmpPath = output + ".tmp";
+  ofstream out(tmpPath.c_str(), ios::binary | ios::trunc);
+  if (!out) {
+    cout << "ERROR::ASSET_PACK::CANNOT_WRITE " << output << endl;
+    return 1;
+  }
+  out.seekp((streamoff)dataStart);
+
+  ThreadPool pool;
+  vector<AssetArchiveEntry> entries;
+  string names;
+  uint64_t offset = dataStart, rawBytes = 0;
+  vector<unsigned char> image, compressed;
+  for (size_t i = 0; i < files.size(); i++) {
+    string name = files[i];
+    MappedFile file;
+    const unsigned char *bytes;
+    size_t size;
+    if (meshes && isModel(name) && packMeshes(name, pool, image)) {
+      name += ".mshz";
+      bytes = image.data();
+      size = image.size();
+    } else if (file.open(name, MADV_SEQUENTIAL)) {
+      bytes = file.bytes();
+      size = file.length();
+    } else {
+      bytes = nullptr; // empty, or vanished since it was listed
+      size = 0;
+    }
+
+    AssetArchiveEntry e = {};
+    e.pathHash = assetPathHash(name.data(), name.size());
+    e.nameOffset = (uint32_t)names.size();
+    e.nameLength = (uint32_t)name.size();
+    e.offset = offset;
+    e.size = size;
+    e.crc = (uint32_t)crc32(0, bytes, (uInt)size);
+    e.compression = ASSET_STORED;
+    e.storedBytes = size;
+    if (!store && size) {
+      uLongf packed = compressBound((uLong)size);
+      compressed.resize(packed);
+      if (compress2(compressed.data(), &packed, bytes, (uLong)size, level) ==
+              Z_OK &&
+          packed < size - size / 10) {
+        e.compression = ASSET_DEFLATE;
+        e.storedBytes = packed;
+        bytes = compressed.data();
+      }
+    }
+    names += name;
+
+    static const char zeros[16] = {0};
+    out.write((const char *)bytes, (streamsize)e.storedBytes);
+    uint64_t end = (offset + e.storedBytes + 15) & ~15ull;
+    out.write(zeros, (streamsize)(end - offset - e.storedBytes));
+    offset = end;
+    rawBytes += size;
+    entries.push_back(e);
+
+    printf("  %-7s %10llu -> %10llu  %s\n",
+           e.compression == ASSET_DEFLATE ? "deflate" : "stored",
+           (unsigned long long)e.size, (unsigned long long)e.storedBytes,
+           name.c_str());
+  }
+
+  sort(entries.begin(), entries.end(),
+       [](const AssetArchiveEntry &a, const AssetArchiveEntry &b) {
+         return a.pathHash < b.pathHash;
+       });
+  AssetArchiveHeader header = {ASSET_ARCHIVE_MAGIC, ASSET_ARCHIVE_VERSION,
+                               (uint32_t)entries.size(),
+                               (uint32_t)names.size()};
+  out.seekp(0);
+  out.write((const char *)&header, sizeof(header));
+  out.write((const char *)entries.data(),
+            (streamsize)(entries.size() * sizeof(AssetArchiveEntry)));
+  out.write(names.data(), (streamsize)names.size());
+  out.close();
+  if (!out || rename(tmpPath.c_str(), output.c_str()) != 0) {
+    remove(tmpPath.c_str());
+    cout << "ERROR::ASSET_PACK::CANNOT_WRITE " << output << endl;
+    return 1;
+  }
+
+  printf("%s: %zu entries, %.1f MB -> %.1f MB\n", output.c_str(),
+         entries.size(), rawBytes / 1e6, offset / 1e6);
+  return 0;
+}
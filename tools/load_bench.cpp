@@ -0,0 +1,117 @@
+// Loader benchmark: imports models on the CPU exactly like the asset
+// workers do and reports time, heap traffic and peak RSS per file.
+//
+//   load_bench [--cache] [--packed] [--repeat N] model...
+//
+// By default the mesh cache is bypassed so every run measures the full
+// Assimp import and processing pipeline. Later repeats show the effect of
+// the warmed-up import scratch arena.
+
+#include "model.h"
+#include "scratch_arena.h"
+
+#include <sys/resource.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+static atomic<size_t> allocationCount(0);
+static atomic<size_t> allocationBytes(0);
+
+void *operator new(size_t size) {
+  allocationCount++;
+  allocationBytes += size;
+  void *p = malloc(size ? size : 1);
+  if (!p)
+    throw bad_alloc();
+  return p;
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+
+void *operator new(size_t size, const nothrow_t &) noexcept {
+  allocationCount++;
+  allocationBytes += size;
+  return malloc(size ? size : 1);
+}
+
+void *operator new[](size_t size, const nothrow_t &tag) noexcept {
+  return operator new(size, tag);
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+
+static double peakRssMb() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+  return usage.ru_maxrss / (1024.0 * 1024.0); // bytes
+#else
+  return usage.ru_maxrss / 1024.0; // kilobytes
+#endif
+}
+
+int main(int argc, char **argv) {
+  bool useCache = false;
+  VertexFormat format = VERTEX_FORMAT_FLOAT;
+  int repeat = 2;
+  vector<string> paths;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--cache"))
+      useCache = true;
+    else if (!strcmp(argv[i], "--packed"))
+      format = VERTEX_FORMAT_PACKED;
+    else if (!strcmp(argv[i], "--repeat") && i + 1 < argc)
+      repeat = max(1, atoi(argv[++i]));
+    else
+      paths.push_back(argv[i]);
+  }
+  if (paths.empty()) {
+    cout << "usage: load_bench [--cache] [--packed] [--repeat N] model..."
+         << endl;
+    return 1;
+  }
+
+  printf("%-36s %4s %9s %10s %9s %10s %9s %9s\n", "model", "run", "ms",
+         "triangles", "allocs", "alloc MB", "RSS MB", "scratch");
+  for (size_t f = 0; f < paths.size(); f++) {
+    for (int run = 0; run < repeat; run++) {
+      size_t countBefore = allocationCount;
+      size_t bytesBefore = allocationBytes;
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+      size_t triangles = 0;
+      {
+        ModelData data = Model::decode(paths[f], format, useCache);
+        if (!data.ok)
+          return 1;
+        for (size_t i = 0; i < data.meshes.size(); i++)
+          triangles += data.meshes[i].lods.empty()
+                           ? data.meshes[i].indexCount / 3
+                           : data.meshes[i].lods[0].indexCount / 3;
+      }
+
+      double ms = chrono::duration<double, milli>(
+                      chrono::steady_clock::now() - start)
+                      .count();
+      printf("%-36s %4d %9.1f %10zu %9zu %10.1f %9.1f %8.1fM\n",
+             paths[f].c_str(), run, ms, triangles,
+             allocationCount - countBefore,
+             (allocationBytes - bytesBefore) / (1024.0 * 1024.0), peakRssMb(),
+             importScratch().capacity() / (1024.0 * 1024.0));
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,251 @@
+// Mesh efficiency report (mesh_analyzer.h) as JSON on stdout.
+//
+//   mesh_analyze [--stage imported|final|both] model...
+//
+// "imported" is the mesh as it comes out of the importer, before LODs and
+// reordering. "final" is what the renderer draws: the full pipeline output,
+// measured on LOD 0. The default reports both, so each optimization pass
+// can be checked against its input. Per mesh the report has counts, bytes
+// per vertex, ACMR/ATVR for several FIFO cache sizes, vertex fetch
+// overfetch, overdraw from six axis views, and degenerate, duplicate and
+// unused geometry.
+//
+// Import and optimizer logs go to stderr, so stdout is only the JSON.
+
+#include "mesh_analyzer.h"
+#include "model.h"
+#include "thread_pool.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Minimal JSON emitter: keeps track of commas and indentation.
+class JsonWriter {
+public:
+  JsonWriter() : first(true), depth(0) {}
+
+  void beginObject(const char *key = nullptr) { open(key, '{'); }
+  void endObject() { close('}'); }
+  void beginArray(const char *key = nullptr) { open(key, '['); }
+  void endArray() { close(']'); }
+
+  void value(const char *key, const string &s) {
+    prefix(key);
+    quoted(s);
+  }
+  void value(const char *key, size_t n) {
+    prefix(key);
+    printf("%zu", n);
+  }
+  void value(const char *key, float x) {
+    prefix(key);
+    number("%.4f", x);
+  }
+  void value(const char *key, bool b) {
+    prefix(key);
+    fputs(b ? "true" : "false", stdout);
+  }
+  void vec3(const char *key, const float v[3]) {
+    prefix(key);
+    for (int i = 0; i < 3; i++) {
+      fputs(i ? ", " : "[", stdout);
+      number("%g", v[i]);
+    }
+    fputc(']', stdout);
+  }
+  void finish() { fputs("\n", stdout); }
+
+private:
+  bool first;
+  int depth;
+
+  // JSON has no NaN or infinity.
+  static void number(const char *format, float x) {
+    if (isfinite(x))
+      printf(format, x);
+    else
+      fputs("null", stdout);
+  }
+
+  void prefix(const char *key) {
+    if (!first)
+      fputc(',', stdout);
+    if (depth) {
+      fputc('\n', stdout);
+      for (int i = 0; i < depth; i++)
+        fputs("  ", stdout);
+    }
+    first = false;
+    if (key) {
+      quoted(key);
+      fputs(": ", stdout);
+    }
+  }
+
+  void open(const char *key, char bracket) {
+    prefix(key);
+    fputc(bracket, stdout);
+    depth++;
+    first = true;
+  }
+
+  void close(char bracket) {
+    depth--;
+    if (!first) {
+      fputc('\n', stdout);
+      for (int i = 0; i < depth; i++)
+        fputs("  ", stdout);
+    }
+    fputc(bracket, stdout);
+    first = false;
+  }
+
+  static void quoted(const string &s) {
+    fputc('"', stdout);
+    for (size_t i = 0; i < s.size(); i++) {
+      unsigned char c = (unsigned char)s[i];
+      if (c == '"' || c == '\\')
+        printf("\\%c", c);
+      else if (c < 0x20)
+        printf("\\u%04x", c);
+      else
+        fputc(c, stdout);
+    }
+    fputc('"', stdout);
+  }
+};
+
+static void reportMesh(JsonWriter &json, const MeshData &m, ThreadPool &pool) {
+  size_t indexCount = m.lods.empty() ? m.indexCount : m.lods[0].indexCount;
+  MeshAnalysis a =
+      analyzeMesh((const float *)m.vertexData(), sizeof(Vertex),
+                  m.vertexCount, m.indexData(), indexCount, &pool);
+
+  json.beginObject();
+  json.value("vertices", a.vertexCount);
+  json.value("triangles", a.triangleCount);
+  json.value("uniquePositions", a.uniquePositions);
+  json.value("unusedVertices", a.unusedVertices);
+  json.beginObject("bytesPerVertex");
+  json.value("float", sizeof(Vertex));
+  json.value("packed", sizeof(PackedVertex));
+  json.endObject();
+  json.value("indexBytes", m.indexCount * sizeof(unsigned int));
+
+  json.beginArray("vertexCache");
+  for (size_t c = 0; c < ANALYZER_CACHE_SIZE_COUNT; c++) {
+    json.beginObject();
+    json.value("size", (size_t)ANALYZER_CACHE_SIZES[c]);
+    json.value("acmr", a.cache[c].acmr);
+    json.value("atvr", a.cache[c].atvr);
+    json.endObject();
+  }
+  json.endArray();
+
+  json.beginObject("vertexFetch");
+  json.value("bytesFetched", a.fetch.bytesFetched);
+  json.value("overfetch", a.fetch.overfetch);
+  json.endObject();
+
+  json.beginObject("overdraw");
+  json.value("mean", a.meanOverdraw);
+  json.beginArray("views");
+  for (size_t v = 0; v < OVERDRAW_VIEW_COUNT; v++) {
+    json.beginObject();
+    json.vec3("direction", OVERDRAW_VIEWS[v]);
+    json.value("overdraw", a.overdraw[v].overdraw);
+    json.value("pixelsCovered", a.overdraw[v].pixelsCovered);
+    json.value("pixelsShaded", a.overdraw[v].pixelsShaded);
+    json.endObject();
+  }
+  json.endArray();
+  json.endObject();
+
+  json.beginObject("degenerateTriangles");
+  json.value("repeatedIndex", a.degenerateIndices);
+  json.value("zeroArea", a.degenerateArea);
+  json.endObject();
+  json.value("duplicateTriangles", a.duplicateTriangles);
+
+  json.beginArray("lods");
+  for (size_t l = 0; l < m.lods.size(); l++) {
+    json.beginObject();
+    json.value("triangles", (size_t)m.lods[l].indexCount / 3);
+    json.value("error", m.lods[l].error);
+    json.endObject();
+  }
+  json.endArray();
+  json.value("meshlets", m.meshlets.size());
+  json.endObject();
+}
+
+static void reportStage(JsonWriter &json, const char *stage,
+                        const vector<MeshData> &meshes, bool ok,
+                        ThreadPool &pool) {
+  json.beginObject(stage);
+  json.value("ok", ok);
+  json.beginArray("meshes");
+  for (size_t i = 0; i < meshes.size(); i++)
+    reportMesh(json, meshes[i], pool);
+  json.endArray();
+  json.endObject();
+}
+
+int main(int argc, char **argv) {
+  bool importedStage = true, finalStage = true;
+  vector<string> paths;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--stage") && i + 1 < argc) {
+      string stage = argv[++i];
+      importedStage = stage == "imported" || stage == "both";
+      finalStage = stage == "final" || stage == "both";
+    } else {
+      paths.push_back(argv[i]);
+    }
+  }
+  if (paths.empty() || (!importedStage && !finalStage)) {
+    cerr << "usage: mesh_analyze [--stage imported|final|both] model..."
+         << endl;
+    return 1;
+  }
+
+  // everything the loaders print goes to stderr
+  cout.rdbuf(cerr.rdbuf());
+
+  ThreadPool pool;
+  JsonWriter json;
+  int failures = 0;
+  json.beginObject();
+  json.beginArray("models");
+  for (size_t p = 0; p < paths.size(); p++) {
+    json.beginObject();
+    json.value("path", paths[p]);
+    if (importedStage) {
+      vector<MeshData> meshes;
+      bool ok = Model::importMeshes(paths[p], meshes, &pool);
+      for (size_t i = 0; i < meshes.size(); i++) {
+        meshes[i].vertexCount = meshes[i].vertices.size();
+        meshes[i].indexCount = meshes[i].indices.size();
+      }
+      reportStage(json, "imported", meshes, ok, pool);
+      failures += !ok;
+    }
+    if (finalStage) {
+      ModelData data =
+          Model::decode(paths[p], VERTEX_FORMAT_FLOAT, false, &pool);
+      reportStage(json, "final", data.meshes, data.ok, pool);
+      failures += !data.ok;
+    }
+    json.endObject();
+  }
+  json.endArray();
+  json.endObject();
+  json.finish();
+  return failures ? 1 : 0;
+}
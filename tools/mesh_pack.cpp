@@ -0,0 +1,94 @@
+// Packs models into the compressed mesh container (mesh_codec.h).
+//
+//   mesh_pack [--level N] [--threads N] model...
+//
+// Each model goes through the full import pipeline (LODs, vertex cache
+// order, meshlets) and is written next to it as <model>.mshz. The report
+// compares the container with the raw cache layout and times decoding it
+// back, best of three.
+
+#include "mesh_codec.h"
+#include "model.h"
+#include "thread_pool.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+using namespace std;
+
+static uint64_t fileSize(const string &path) {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0 ? (uint64_t)st.st_size : 0;
+}
+
+int main(int argc, char **argv) {
+  int level = Z_BEST_COMPRESSION;
+  unsigned threads = 0;
+  vector<string> paths;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--level") && i + 1 < argc)
+      level = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+      threads = (unsigned)max(1, atoi(argv[++i]));
+    else
+      paths.push_back(argv[i]);
+  }
+  if (paths.empty()) {
+    cout << "usage: mesh_pack [--level N] [--threads N] model..." << endl;
+    return 1;
+  }
+
+  ThreadPool pool(threads);
+  int failures = 0;
+  for (size_t p = 0; p < paths.size(); p++) {
+    ModelData data =
+        Model::decode(paths[p], VERTEX_FORMAT_FLOAT, false, &pool);
+    if (!data.ok) {
+      failures++;
+      continue;
+    }
+
+    vector<MeshCacheBlob> blobs;
+    uint64_t raw = 0;
+    for (size_t i = 0; i < data.meshes.size(); i++) {
+      blobs.push_back(data.meshes[i].blob());
+      raw += data.meshes[i].vertexCount * sizeof(Vertex) +
+             data.meshes[i].indexCount * sizeof(unsigned int);
+    }
+    string out = paths[p] + ".mshz";
+    if (!writeMeshContainer(out, blobs, sizeof(Vertex), level)) {
+      failures++;
+      continue;
+    }
+    uint64_t packed = fileSize(out);
+
+    double best = 1e30;
+    for (int run = 0; run < 3; run++) {
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      ModelData check = Model::decode(out, VERTEX_FORMAT_FLOAT, false, &pool);
+      double seconds = chrono::duration<double>(chrono::steady_clock::now() -
+                                                start)
+                           .count();
+      if (!check.ok) {
+        best = 0.0;
+        break;
+      }
+      best = min(best, seconds);
+    }
+    if (best == 0.0) {
+      failures++;
+      continue;
+    }
+
+    printf("%s: %.1f MB -> %.1f MB (%.2fx), decode %.1f ms (%.0f MB/s)\n",
+           out.c_str(), raw / 1e6, packed / 1e6,
+           packed ? (double)raw / packed : 0.0, best * 1e3,
+           raw / 1e6 / best);
+  }
+  return failures ? 1 : 0;
+}
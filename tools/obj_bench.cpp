@@ -0,0 +1,113 @@
+// OBJ import benchmark: times Assimp's ReadFile, set up as the renderer uses
+// it, against the native parser, single-threaded and on a thread pool.
+//
+//   obj_bench [--repeat N] [--threads N] model.obj...
+//
+// Only the import itself is measured; normal generation, LODs, optimization
+// and meshlets run the same afterwards whichever reader produced the mesh.
+
+#include "model.h"
+#include "obj_parser.h"
+#include "thread_pool.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct Timing {
+  double ms;
+  size_t vertices;
+  size_t triangles;
+};
+
+static double elapsedMs(chrono::steady_clock::time_point start) {
+  return chrono::duration<double, milli>(chrono::steady_clock::now() - start)
+      .count();
+}
+
+static bool timeAssimp(const string &path, Timing &t) {
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  Assimp::Importer importer;
+  configureImporter(importer);
+  const aiScene *scene = importer.ReadFile(path, MODEL_IMPORT_FLAGS);
+  t.ms = elapsedMs(start);
+  if (!scene) {
+    cout << "ERROR::ASSIMP::" << importer.GetErrorString() << endl;
+    return false;
+  }
+  t.vertices = t.triangles = 0;
+  for (unsigned int i = 0; i < scene->mNumMeshes; i++) {
+    t.vertices += scene->mMeshes[i]->mNumVertices;
+    t.triangles += scene->mMeshes[i]->mNumFaces;
+  }
+  return true;
+}
+
+static bool timeNative(const string &path, ThreadPool *pool, Timing &t) {
+  vector<Vertex> vertices;
+  vector<unsigned int> indices;
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  ObjParser parser(pool);
+  bool ok = parser.parse(path, vertices, indices);
+  t.ms = elapsedMs(start);
+  t.vertices = vertices.size();
+  t.triangles = indices.size() / 3;
+  return ok;
+}
+
+static void report(const char *reader, const Timing &t, double baseline) {
+  printf("  %-14s %9.1f ms %10zu verts %10zu tris %6.2fx\n", reader, t.ms,
+         t.vertices, t.triangles, baseline / t.ms);
+}
+
+int main(int argc, char **argv) {
+  int repeat = 3;
+  unsigned int threads = thread::hardware_concurrency();
+  vector<string> paths;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--repeat") && i + 1 < argc)
+      repeat = max(1, atoi(argv[++i]));
+    else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+      threads = (unsigned int)max(1, atoi(argv[++i]));
+    else
+      paths.push_back(argv[i]);
+  }
+  if (paths.empty()) {
+    cout << "usage: obj_bench [--repeat N] [--threads N] model.obj..."
+         << endl;
+    return 1;
+  }
+
+  ThreadPool pool(threads);
+  for (size_t f = 0; f < paths.size(); f++) {
+    // best of N, so page cache warm-up is not counted
+    Timing assimp = {1e30, 0, 0}, single = assimp, parallel = assimp;
+    for (int run = 0; run < repeat; run++) {
+      Timing t;
+      if (!timeAssimp(paths[f], t))
+        return 1;
+      if (t.ms < assimp.ms)
+        assimp = t;
+      if (!timeNative(paths[f], nullptr, t))
+        return 1;
+      if (t.ms < single.ms)
+        single = t;
+      if (!timeNative(paths[f], &pool, t))
+        return 1;
+      if (t.ms < parallel.ms)
+        parallel = t;
+    }
+
+    printf("%s\n", paths[f].c_str());
+    report("assimp", assimp, assimp.ms);
+    report("native x1", single, assimp.ms);
+    report(("native x" + to_string(threads)).c_str(), parallel, assimp.ms);
+  }
+  return 0;
+}
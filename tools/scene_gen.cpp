@@ -0,0 +1,410 @@
+// Synthetic assets for scaling tests: meshes at a chosen triangle count and
+// grid scenes of many objects.
+//
+//   scene_gen mesh SHAPE TRIANGLES output.obj [--seed N]
+//   scene_gen scene ROWS COLS output.scene model... [--spacing S]
+//                   [--seed N]
+//
+// SHAPE is sphere, torus, teardrop or blob (a sphere displaced by noise).
+// TRIANGLES takes K and M suffixes (50M); the count is rounded to the
+// nearest grid that closes the shape. Spheres and tori are written with
+// analytic normals. Teardrops and blobs have none, which exercises normal
+// generation on import. Meshes are streamed out while they are generated,
+// so memory use does not grow with the triangle count.
+//
+// Scenes place the models in a ROWS x COLS grid, picked at random, with
+// randomized TransmittanceVars. A camera that sees the whole grid is
+// included. The same seed gives the same scene on every platform; the
+// random generator and its float conversion are defined here rather than
+// taken from <random>, whose distributions differ between standard
+// libraries.
+
+#include "scene.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+const float PI = 3.14159265358979f;
+
+// splitmix64
+struct Random {
+  uint64_t state;
+
+  explicit Random(uint64_t seed) : state(seed) {}
+
+  uint64_t next() {
+    uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+  }
+
+  float uniform(float lo, float hi) {
+    return lo + (hi - lo) * (float)(next() >> 40) * (1.0f / 16777216.0f);
+  }
+
+  bool chance(float p) { return uniform(0.0f, 1.0f) < p; }
+};
+
+// ---- noise ----
+
+inline float latticeValue(int x, int y, int z, uint64_t seed) {
+  uint64_t h = seed ^ ((uint64_t)(uint32_t)x * 0x8da6b343ull) ^
+               ((uint64_t)(uint32_t)y * 0xd8163841ull) ^
+               ((uint64_t)(uint32_t)z * 0xcb1ab31full);
+  h = (h ^ (h >> 29)) * 0xbf58476d1ce4e5b9ull;
+  h ^= h >> 32;
+  return (float)(h & 0xffffff) * (2.0f / 16777215.0f) - 1.0f;
+}
+
+inline float smooth(float t) { return t * t * (3.0f - 2.0f * t); }
+
+// Trilinear value noise in [-1, 1].
+inline float valueNoise(glm::vec3 p, uint64_t seed) {
+  float fx = floorf(p.x), fy = floorf(p.y), fz = floorf(p.z);
+  int x = (int)fx, y = (int)fy, z = (int)fz;
+  float tx = smooth(p.x - fx), ty = smooth(p.y - fy), tz = smooth(p.z - fz);
+  float c[2][2];
+  for (int j = 0; j < 2; j++)
+    for (int k = 0; k < 2; k++)
+      c[j][k] = latticeValue(x, y + j, z + k, seed) +
+                (latticeValue(x + 1, y + j, z + k, seed) -
+                 latticeValue(x, y + j, z + k, seed)) *
+                    tx;
+  float c0 = c[0][0] + (c[1][0] - c[0][0]) * ty;
+  float c1 = c[0][1] + (c[1][1] - c[0][1]) * ty;
+  return c0 + (c1 - c0) * tz;
+}
+
+inline float fractalNoise(glm::vec3 p, uint64_t seed) {
+  float sum = 0.0f, amplitude = 0.5f;
+  for (int octave = 0; octave < 4; octave++) {
+    sum += amplitude * valueNoise(p, seed + octave);
+    p *= 2.03f;
+    amplitude *= 0.5f;
+  }
+  return sum;
+}
+
+// ---- shapes ----
+
+enum Shape { SHAPE_SPHERE, SHAPE_TORUS, SHAPE_TEARDROP, SHAPE_BLOB };
+
+const float TORUS_MAJOR = 1.0f, TORUS_MINOR = 0.3f;
+
+// Point at angle u around the y axis (or the torus ring) and v from the top
+// pole down (or around the tube), both in [0, 1].
+static glm::vec3 surfacePoint(Shape shape, float u, float v, uint64_t seed,
+                              glm::vec3 &normal) {
+  float phi = u * 2.0f * PI;
+  if (shape == SHAPE_TORUS) {
+    float theta = -v * 2.0f * PI; // keeps the winding counter-clockwise
+    glm::vec3 ring(cosf(phi), 0.0f, sinf(phi));
+    normal = ring * cosf(theta) + glm::vec3(0.0f, sinf(theta), 0.0f);
+    return ring * TORUS_MAJOR + normal * TORUS_MINOR;
+  }
+
+  float theta = v * PI;
+  if (shape == SHAPE_TEARDROP) {
+    // tip at the top, round at the bottom
+    float r = sinf(theta) * sinf(theta * 0.5f);
+    return glm::vec3(r * cosf(phi), cosf(theta), r * sinf(phi));
+  }
+  normal = glm::vec3(sinf(theta) * cosf(phi), cosf(theta),
+                     sinf(theta) * sinf(phi));
+  if (shape == SHAPE_BLOB)
+    return normal * (1.0f + 0.35f * fractalNoise(normal * 2.0f, seed));
+  return normal;
+}
+
+// Buffered OBJ output with fixed-precision number formatting; printf would
+// dominate the run time at tens of millions of lines.
+class ObjWriter {
+public:
+  explicit ObjWriter(FILE *f) : f(f) { buffer.reserve(BUFFER_BYTES + 256); }
+  ~ObjWriter() { flush(); }
+
+  void vertex(const char *kind, const glm::vec3 &p) {
+    buffer += kind;
+    number(p.x);
+    number(p.y);
+    number(p.z);
+    line();
+  }
+
+  void face(uint64_t a, uint64_t b, uint64_t c, bool normals) {
+    buffer += 'f';
+    corner(a, normals);
+    corner(b, normals);
+    corner(c, normals);
+    line();
+  }
+
+  void text(const string &s) { buffer += s; }
+
+  void flush() {
+    fwrite(buffer.data(), 1, buffer.size(), f);
+    buffer.clear();
+  }
+
+private:
+  static const size_t BUFFER_BYTES = 1 << 20;
+  FILE *f;
+  string buffer;
+
+  void line() {
+    buffer += '\n';
+    if (buffer.size() >= BUFFER_BYTES)
+      flush();
+  }
+
+  void number(float x) {
+    buffer += ' ';
+    if (x < 0.0f) {
+      buffer += '-';
+      x = -x;
+    }
+    uint64_t fixed = (uint64_t)((double)x * 1e6 + 0.5);
+    integer(fixed / 1000000);
+    char frac[7] = {'.'};
+    uint32_t digits = (uint32_t)(fixed % 1000000);
+    for (int i = 6; i > 0; i--, digits /= 10)
+      frac[i] = (char)('0' + digits % 10);
+    buffer.append(frac, 7);
+  }
+
+  void integer(uint64_t v) {
+    char digits[24];
+    int n = 0;
+    do {
+      digits[n++] = (char)('0' + v % 10);
+      v /= 10;
+    } while (v);
+    while (n)
+      buffer += digits[--n];
+  }
+
+  void corner(uint64_t index, bool normals) {
+    buffer += ' ';
+    integer(index);
+    if (normals) {
+      buffer += "//";
+      integer(index);
+    }
+  }
+};
+
+static bool writeMesh(Shape shape, uint64_t triangles, uint64_t seed,
+                      const string &path) {
+  FILE *f = fopen(path.c_str(), "wb");
+  if (!f) {
+    cout << "ERROR::SCENE_GEN::CANNOT_WRITE " << path << endl;
+    return false;
+  }
+  bool torus = shape == SHAPE_TORUS;
+  bool normals = shape == SHAPE_SPHERE || torus;
+
+  // Grid of rows x segments. Closed shapes get a single vertex per pole and
+  // 2 * segments * (rows - 1) triangles; the torus wraps both ways, with
+  // 2 * segments * rows. Segments follow the aspect of the surface.
+  uint64_t rows, segments;
+  if (torus) {
+    rows = max<uint64_t>(3, (uint64_t)llround(sqrt(triangles / 6.0)));
+    segments = 3 * rows;
+  } else {
+    rows = max<uint64_t>(
+        2, (uint64_t)llround((1.0 + sqrt(1.0 + (double)triangles)) / 2.0));
+    segments = 2 * rows;
+  }
+
+  ObjWriter out(f);
+  char header[128];
+  snprintf(header, sizeof(header), "# scene_gen %s grid %llux%llu\n",
+           path.c_str(), (unsigned long long)rows,
+           (unsigned long long)segments);
+  out.text(header);
+
+  glm::vec3 normal(0.0f);
+  uint64_t ringCount = torus ? rows : rows - 1;
+  if (!torus) {
+    glm::vec3 top = surfacePoint(shape, 0.0f, 0.0f, seed, normal);
+    out.vertex("v", glm::vec3(0.0f, top.y, 0.0f));
+    if (normals)
+      out.vertex("vn", glm::vec3(0.0f, 1.0f, 0.0f));
+  }
+  for (uint64_t r = 0; r < ringCount; r++) {
+    float v = torus ? (float)r / rows : (float)(r + 1) / rows;
+    for (uint64_t s = 0; s < segments; s++) {
+      glm::vec3 p =
+          surfacePoint(shape, (float)s / segments, v, seed, normal);
+      out.vertex("v", p);
+      if (normals)
+        out.vertex("vn", normal);
+    }
+  }
+  if (!torus) {
+    glm::vec3 bottom = surfacePoint(shape, 0.0f, 1.0f, seed, normal);
+    out.vertex("v", glm::vec3(0.0f, bottom.y, 0.0f));
+    if (normals)
+      out.vertex("vn", glm::vec3(0.0f, -1.0f, 0.0f));
+  }
+
+  // 1-based OBJ indices; ring r starts after the top pole
+  uint64_t first = torus ? 1 : 2;
+  uint64_t generated = 0;
+  for (uint64_t s = 0; s < segments && !torus; s++) {
+    out.face(1, first + (s + 1) % segments, first + s, normals);
+    generated++;
+  }
+  uint64_t bands = torus ? rows : rows - 2;
+  for (uint64_t r = 0; r < bands; r++) {
+    uint64_t upper = first + r * segments;
+    uint64_t lower = first + ((r + 1) % ringCount) * segments;
+    for (uint64_t s = 0; s < segments; s++) {
+      uint64_t next = (s + 1) % segments;
+      out.face(upper + s, upper + next, lower + s, normals);
+      out.face(lower + s, upper + next, lower + next, normals);
+      generated += 2;
+    }
+  }
+  if (!torus) {
+    uint64_t last = first + (rows - 2) * segments;
+    uint64_t pole = last + segments;
+    for (uint64_t s = 0; s < segments; s++) {
+      out.face(pole, last + s, last + (s + 1) % segments, normals);
+      generated++;
+    }
+  }
+  out.flush();
+
+  bool ok = !ferror(f);
+  if (fclose(f) != 0 || !ok) {
+    cout << "ERROR::SCENE_GEN::CANNOT_WRITE " << path << endl;
+    return false;
+  }
+  printf("%s: %llu triangles\n", path.c_str(), (unsigned long long)generated);
+  return true;
+}
+
+// ---- scenes ----
+
+static string stem(const string &path) {
+  size_t slash = path.find_last_of('/');
+  string name = slash == string::npos ? path : path.substr(slash + 1);
+  return name.substr(0, name.find('.'));
+}
+
+static bool writeScene(int rows, int cols, const vector<string> &models,
+                       float spacing, uint64_t seed, const string &path) {
+  Random random(seed);
+  SceneDescription scene;
+  scene.objects.reserve((size_t)rows * cols);
+  for (int r = 0; r < rows; r++) {
+    for (int c = 0; c < cols; c++) {
+      SceneEntry e;
+      e.model = models[random.next() % models.size()];
+      e.name = stem(e.model) + "_" + to_string(r) + "_" + to_string(c);
+
+      TransmittanceVars &p = e.p;
+      p.position = glm::vec3((c - (cols - 1) * 0.5f) * spacing, 0.0f,
+                             (r - (rows - 1) * 0.5f) * spacing);
+      p.scale = glm::vec3(random.uniform(0.6f, 1.4f));
+      p.useReflection = random.chance(0.85f);
+      p.useRefraction = random.chance(0.85f);
+      p.useFresnel = p.useRefraction && random.chance(0.85f);
+      p.useDispersion = random.chance(0.85f);
+      p.IOR = random.uniform(1.1f, 2.4f);
+      p.dispersionStrength = random.uniform(0.0f, 0.05f);
+      p.fresnelBase = random.uniform(0.02f, 0.1f);
+      p.rotate = random.chance(0.7f);
+      p.rotateSpeedDeg = random.uniform(10.0f, 60.0f);
+      p.rotateAngleDeg = random.uniform(0.0f, 360.0f);
+      glm::vec3 axis(random.uniform(-1.0f, 1.0f), random.uniform(-1.0f, 1.0f),
+                     random.uniform(-1.0f, 1.0f));
+      p.rotAxis = glm::length(axis) > 1e-3f ? glm::normalize(axis)
+                                            : glm::vec3(0.0f, 1.0f, 0.0f);
+      scene.objects.push_back(e);
+    }
+  }
+
+  // Look down at the grid from in front of its near edge.
+  float depth = rows * spacing, extent = max(rows, cols) * spacing;
+  scene.hasCamera = true;
+  scene.cameraPosition =
+      glm::vec3(0.0f, 0.35f * extent + 5.0f, 0.5f * depth + 0.6f * extent);
+  scene.cameraYaw = -90.0f;
+  scene.cameraPitch = -glm::degrees(
+      atanf(scene.cameraPosition.y / max(scene.cameraPosition.z, 1.0f)));
+
+  if (!saveScene(path, scene))
+    return false;
+  printf("%s: %d x %d objects, %zu models\n", path.c_str(), rows, cols,
+         models.size());
+  return true;
+}
+
+// "50M", "250K" or a plain number
+static uint64_t parseCount(const char *s) {
+  char *end;
+  double v = strtod(s, &end);
+  if (*end == 'k' || *end == 'K')
+    v *= 1e3;
+  else if (*end == 'm' || *end == 'M')
+    v *= 1e6;
+  return v > 0.0 ? (uint64_t)v : 0;
+}
+
+static int usage() {
+  cout << "usage: scene_gen mesh sphere|torus|teardrop|blob TRIANGLES "
+          "output.obj [--seed N]\n"
+          "       scene_gen scene ROWS COLS output.scene model... "
+          "[--spacing S] [--seed N]"
+       << endl;
+  return 1;
+}
+
+int main(int argc, char **argv) {
+  uint64_t seed = 1;
+  float spacing = 10.0f;
+  vector<string> args;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--seed") && i + 1 < argc)
+      seed = strtoull(argv[++i], nullptr, 10);
+    else if (!strcmp(argv[i], "--spacing") && i + 1 < argc)
+      spacing = (float)atof(argv[++i]);
+    else
+      args.push_back(argv[i]);
+  }
+
+  if (args.size() == 4 && args[0] == "mesh") {
+    const char *names[] = {"sphere", "torus", "teardrop", "blob"};
+    for (int s = 0; s < 4; s++) {
+      if (args[1] == names[s]) {
+        uint64_t triangles = parseCount(args[2].c_str());
+        if (!triangles)
+          return usage();
+        return writeMesh((Shape)s, triangles, seed, args[3]) ? 0 : 1;
+      }
+    }
+    return usage();
+  }
+
+  if (args.size() >= 5 && args[0] == "scene") {
+    int rows = atoi(args[1].c_str()), cols = atoi(args[2].c_str());
+    if (rows <= 0 || cols <= 0)
+      return usage();
+    vector<string> models(args.begin() + 4, args.end());
+    return writeScene(rows, cols, models, spacing, seed, args[3]) ? 0 : 1;
+  }
+  return usage();
+}
@@ -0,0 +1,98 @@
+// Build step: preprocesses shader stages (#include) and writes them, with
+// their hashes, as a header of constexpr strings for EMBEDDED_SHADERS
+// builds.
+//
+//   shader_embed output.h shaders/main.vert shaders/main.frag ...
+//
+// Paths are stored as given, so run it from the directory the program
+// resolves shader paths against (CMake runs it from the source root).
+
+#include "shader_source.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+static bool readFile(const string &path, string &out) {
+  ifstream in(path.c_str(), ios::binary);
+  if (!in)
+    return false;
+  stringstream ss;
+  ss << in.rdbuf();
+  out = ss.str();
+  return true;
+}
+
+// One C string literal per source line.
+static void writeLiteral(ostream &out, const string &text) {
+  out << "    \"";
+  for (size_t i = 0; i < text.size(); i++) {
+    unsigned char c = (unsigned char)text[i];
+    if (c == '\n') {
+      out << "\\n\"";
+      if (i + 1 < text.size())
+        out << "\n    \"";
+      else
+        return;
+    } else if (c == '"' || c == '\\') {
+      out << '\\' << c;
+    } else if (c < 0x20 || c >= 0x7f) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\%03o", c);
+      out << escaped;
+    } else {
+      out << c;
+    }
+  }
+  out << "\"";
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    cerr << "usage: shader_embed output.h shader..." << endl;
+    return 1;
+  }
+
+  stringstream out;
+  out << "// Generated by shader_embed; do not edit.\n"
+         "#ifndef EMBEDDED_SHADERS_H\n"
+         "#define EMBEDDED_SHADERS_H\n\n";
+  vector<uint64_t> hashes;
+  for (int i = 2; i < argc; i++) {
+    string source;
+    if (!expandShaderIncludes(argv[i], readFile, source))
+      return 1;
+    hashes.push_back(shaderHash(source.data(), source.size()));
+    out << "// " << argv[i] << "\n"
+        << "constexpr char EMBEDDED_SHADER_" << i - 2 << "[] =\n";
+    writeLiteral(out, source);
+    out << ";\n\n";
+  }
+
+  out << "const EmbeddedShader EMBEDDED_SHADER_TABLE[] = {\n";
+  for (int i = 2; i < argc; i++) {
+    char hash[24];
+    snprintf(hash, sizeof(hash), "0x%016llxull",
+             (unsigned long long)hashes[i - 2]);
+    out << "    {\"" << argv[i] << "\", EMBEDDED_SHADER_" << i - 2
+        << ", sizeof(EMBEDDED_SHADER_" << i - 2 << ") - 1, " << hash
+        << "},\n";
+  }
+  out << "};\n"
+      << "const size_t EMBEDDED_SHADER_COUNT = " << argc - 2 << ";\n\n"
+      << "#endif\n";
+
+  ofstream file(argv[1], ios::binary | ios::trunc);
+  file << out.str();
+  file.close();
+  if (!file) {
+    cerr << "ERROR::SHADER_EMBED::WRITE_FAILED " << argv[1] << endl;
+    return 1;
+  }
+  return 0;
+}
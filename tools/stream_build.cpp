@@ -0,0 +1,84 @@
+// Converts a model into a streaming file for StreamedMesh (mesh_stream.h).
+//
+//   stream_build [--chunk TRIANGLES] model output.mstream
+//
+// All meshes of the model are merged into one, with their node transforms
+// applied. The build itself needs the whole mesh in memory; only viewing the
+// result is out-of-core.
+
+#include "mesh_stream.h"
+#include "model.h"
+#include "thread_pool.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Moves a mesh's vertices from its node's space into model space.
+static void applyTransform(MeshData &mesh) {
+  const glm::mat4 &t = mesh.transform;
+  if (t == glm::mat4(1.0f))
+    return;
+  glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(t)));
+  for (size_t i = 0; i < mesh.vertices.size(); i++) {
+    Vertex &v = mesh.vertices[i];
+    v.Position = glm::vec3(t * glm::vec4(v.Position, 1.0f));
+    v.Normal = glm::normalize(normalMatrix * v.Normal);
+  }
+}
+
+int main(int argc, char **argv) {
+  size_t chunk = STREAM_CHUNK_TRIANGLES;
+  vector<string> paths;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--chunk") && i + 1 < argc)
+      chunk = (size_t)max(1, atoi(argv[++i]));
+    else
+      paths.push_back(argv[i]);
+  }
+  if (paths.size() != 2) {
+    cout << "usage: stream_build [--chunk TRIANGLES] model output.mstream"
+         << endl;
+    return 1;
+  }
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  ThreadPool pool;
+  vector<MeshData> meshes;
+  if (!Model::importMeshes(paths[0], meshes, &pool))
+    return 1;
+
+  for (size_t i = 0; i < meshes.size(); i++)
+    applyTransform(meshes[i]);
+
+  vector<Vertex> vertices;
+  vector<unsigned int> indices;
+  if (meshes.size() == 1) {
+    vertices.swap(meshes[0].vertices);
+    indices.swap(meshes[0].indices);
+  } else {
+    for (size_t i = 0; i < meshes.size(); i++) {
+      unsigned int base = (unsigned int)vertices.size();
+      vertices.insert(vertices.end(), meshes[i].vertices.begin(),
+                      meshes[i].vertices.end());
+      for (size_t k = 0; k < meshes[i].indices.size(); k++)
+        indices.push_back(meshes[i].indices[k] + base);
+      meshes[i].releaseArrays();
+    }
+  }
+
+  MeshStreamBuilder builder(vertices, indices, chunk);
+  if (!builder.write(paths[1]))
+    return 1;
+
+  double seconds =
+      chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  printf("%s: %zu triangles in %zu chunks, %.1f s\n", paths[1].c_str(),
+         indices.size() / 3, builder.nodeCount(), seconds);
+  return 0;
+}
@@ -0,0 +1,230 @@
+// Uniform submission benchmark: the per-object uniform updates of the
+// render loop, four ways, in a hidden window.
+//
+//   uniform_bench [--objects N] [--frames N]
+//
+// The first three set 11 plain uniforms per object on a program with the
+// main shader's former interface:
+//   lookup   std::string + glGetUniformLocation per call (the old setters)
+//   name     setX("name"): hashed name, reflected table (Shader)
+//   handle   Uniform<T> handles fetched once
+// The last is what the render loop does now, with the real main shader:
+//   block    one Objects entry per object, uploaded once per frame; per
+//            object, its index plus the three per-mesh uniforms
+//
+// Nothing is drawn, so the numbers are CPU cost in the driver and in our
+// code; glFinish() closes each frame so queued work is counted.
+
+#include <glad/glad.h>
+
+#include <GLFW/glfw3.h>
+
+#include "shaders.h"
+#include "uniform_buffer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// The main shader's uniforms before they moved into blocks.
+static const char *plainVertexShader = R"(#version 330 core
+layout (location = 0) in vec3 aPos;
+uniform mat4 model;
+uniform vec3 positionScale;
+uniform vec3 positionOffset;
+uniform bool octNormals;
+void main()
+{
+    vec3 p = aPos * positionScale + positionOffset;
+    gl_Position = model * vec4(octNormals ? -p : p, 1.0);
+}
+)";
+
+static const char *plainFragmentShader = R"(#version 330 core
+out vec4 FragColor;
+uniform float refractiveIndex;
+uniform float fresnelBase;
+uniform float dispersionStrength;
+uniform bool useDispersion;
+uniform bool useFresnel;
+uniform bool useRefraction;
+uniform bool useReflection;
+void main()
+{
+    FragColor = vec4(refractiveIndex, fresnelBase, dispersionStrength,
+                     float(useDispersion) + float(useFresnel) +
+                         float(useRefraction) + float(useReflection));
+}
+)";
+
+static void setByLookup(const Shader &shader, const glm::mat4 &model,
+                        float x) {
+  GLuint id = shader.ID;
+  glUniform1i(glGetUniformLocation(id, string("useReflection").c_str()), 1);
+  glUniform1i(glGetUniformLocation(id, string("useRefraction").c_str()), 1);
+  glUniform1i(glGetUniformLocation(id, string("useFresnel").c_str()), 1);
+  glUniform1i(glGetUniformLocation(id, string("useDispersion").c_str()), 1);
+  glUniform1f(glGetUniformLocation(id, string("refractiveIndex").c_str()), x);
+  glUniform1f(glGetUniformLocation(id, string("dispersionStrength").c_str()),
+              x);
+  glUniform1f(glGetUniformLocation(id, string("fresnelBase").c_str()), x);
+  glUniformMatrix4fv(glGetUniformLocation(id, string("model").c_str()), 1,
+                     GL_FALSE, glm::value_ptr(model));
+  glUniform3fv(glGetUniformLocation(id, string("positionScale").c_str()), 1,
+               glm::value_ptr(glm::vec3(x)));
+  glUniform3fv(glGetUniformLocation(id, string("positionOffset").c_str()), 1,
+               glm::value_ptr(glm::vec3(x)));
+  glUniform1i(glGetUniformLocation(id, string("octNormals").c_str()), 1);
+}
+
+static void setByName(const Shader &shader, const glm::mat4 &model, float x) {
+  shader.setBool("useReflection", true);
+  shader.setBool("useRefraction", true);
+  shader.setBool("useFresnel", true);
+  shader.setBool("useDispersion", true);
+  shader.setFloat("refractiveIndex", x);
+  shader.setFloat("dispersionStrength", x);
+  shader.setFloat("fresnelBase", x);
+  shader.setMat4(UNIFORM_NAME("model"), model);
+  shader.setVec3(UNIFORM_NAME("positionScale"), glm::vec3(x));
+  shader.setVec3(UNIFORM_NAME("positionOffset"), glm::vec3(x));
+  shader.setBool(UNIFORM_NAME("octNormals"), true);
+}
+
+static void setByBlock(const Shader &shader, ObjectUniformBuffer &draws,
+                       uint32_t index, float x) {
+  draws.select(shader, index);
+  shader.setVec3(UNIFORM_NAME("positionScale"), glm::vec3(x));
+  shader.setVec3(UNIFORM_NAME("positionOffset"), glm::vec3(x));
+  shader.setBool(UNIFORM_NAME("octNormals"), true);
+}
+
+struct Handles {
+  Uniform<bool> reflection, refraction, fresnel, dispersion, octNormals;
+  Uniform<float> ior, dispersionStrength, fresnelBase;
+  Uniform<glm::mat4> model;
+  Uniform<glm::vec3> scale, offset;
+};
+
+static void setByHandle(const Shader &shader, const Handles &h,
+                        const glm::mat4 &model, float x) {
+  shader.set(h.reflection, true);
+  shader.set(h.refraction, true);
+  shader.set(h.fresnel, true);
+  shader.set(h.dispersion, true);
+  shader.set(h.ior, x);
+  shader.set(h.dispersionStrength, x);
+  shader.set(h.fresnelBase, x);
+  shader.set(h.model, model);
+  shader.set(h.scale, glm::vec3(x));
+  shader.set(h.offset, glm::vec3(x));
+  shader.set(h.octNormals, true);
+}
+
+int main(int argc, char **argv) {
+  int objects = 10000, frames = 50;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (!strcmp(argv[i], "--objects"))
+      objects = max(1, atoi(argv[i + 1]));
+    else if (!strcmp(argv[i], "--frames"))
+      frames = max(1, atoi(argv[i + 1]));
+  }
+
+  if (!glfwInit())
+    return 1;
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+#ifdef __APPLE__
+  glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#endif
+  glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+  GLFWwindow *window = glfwCreateWindow(64, 64, "uniform_bench", nullptr,
+                                        nullptr);
+  if (!window) {
+    cout << "ERROR::UNIFORM_BENCH::NO_CONTEXT" << endl;
+    glfwTerminate();
+    return 1;
+  }
+  glfwMakeContextCurrent(window);
+  if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+    glfwTerminate();
+    return 1;
+  }
+
+  int status = 0;
+  {
+    Shader plain = Shader::fromSource(plainVertexShader, plainFragmentShader);
+    Shader shader("shaders/main.vert", "shaders/main.frag");
+    bindUniformBlocks(shader);
+    ObjectUniformBuffer draws;
+    Handles h;
+    h.reflection = plain.uniform<bool>("useReflection");
+    h.refraction = plain.uniform<bool>("useRefraction");
+    h.fresnel = plain.uniform<bool>("useFresnel");
+    h.dispersion = plain.uniform<bool>("useDispersion");
+    h.octNormals = plain.uniform<bool>("octNormals");
+    h.ior = plain.uniform<float>("refractiveIndex");
+    h.dispersionStrength = plain.uniform<float>("dispersionStrength");
+    h.fresnelBase = plain.uniform<float>("fresnelBase");
+    h.model = plain.uniform<glm::mat4>("model");
+    h.scale = plain.uniform<glm::vec3>("positionScale");
+    h.offset = plain.uniform<glm::vec3>("positionOffset");
+    if (plain.activeUniforms().size() != 11 ||
+        shader.location("objectIndex") < 0)
+      status = 1;
+
+    const char *names[] = {"lookup", "name", "handle", "block"};
+    printf("%d objects, %d frames\n", objects, frames);
+    for (int method = 0; method < 4; method++) {
+      (method < 3 ? plain : shader).use();
+      vector<double> times;
+      for (int f = 0; f < frames; f++) {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        if (method == 3) {
+          draws.clear();
+          for (int o = 0; o < objects; o++) {
+            ObjectData d;
+            d.model = glm::mat4(1.0f + (float)o);
+            d.refractiveIndex = d.dispersionStrength = d.fresnelBase =
+                (float)(o & 7) * 0.125f;
+            d.flags = OBJECT_REFLECTION | OBJECT_REFRACTION |
+                      OBJECT_FRESNEL | OBJECT_DISPERSION;
+            draws.add(d);
+          }
+          draws.upload();
+        }
+        for (int o = 0; o < objects; o++) {
+          glm::mat4 model(1.0f + (float)o);
+          float x = (float)(o & 7) * 0.125f;
+          if (method == 0)
+            setByLookup(plain, model, x);
+          else if (method == 1)
+            setByName(plain, model, x);
+          else if (method == 2)
+            setByHandle(plain, h, model, x);
+          else
+            setByBlock(shader, draws, (uint32_t)o, x);
+        }
+        glFinish();
+        times.push_back(chrono::duration<double, nano>(
+                            chrono::steady_clock::now() - start)
+                            .count());
+      }
+      sort(times.begin(), times.end());
+      printf("  %-7s %8.1f ns per object (median frame %.2f ms)\n",
+             names[method], times[times.size() / 2] / objects,
+             times[times.size() / 2] / 1e6);
+    }
+  }
+
+  glfwDestroyWindow(window);
+  glfwTerminate();
+  return status;
+}
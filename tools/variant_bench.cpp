@@ -0,0 +1,260 @@
+// Shader permutation benchmark: the main shader as one uber-shader against
+// its ShaderVariants specializations, in a hidden window.
+//
+//   variant_bench [--size N] [--draws N] [--frames N]
+//
+// Every draw covers an N x N offscreen target with one of the eight
+// material combinations that shade differently, so frames are bound by
+// fragment work. "uber" draws them in scene order and reads the switches
+// from the object's flags; "variants" sorts the draws by variant and makes
+// each program current once. Each material is then also timed alone with
+// both programs.
+
+#include <glad/glad.h>
+
+#include <GLFW/glfw3.h>
+
+#include "shaders.h"
+#include "uniform_buffer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+using namespace std;
+
+// One per variant key shadingVariant() can return.
+static const int32_t materials[] = {
+    0,
+    OBJECT_REFLECTION,
+    OBJECT_REFRACTION,
+    OBJECT_REFRACTION | OBJECT_DISPERSION,
+    OBJECT_REFLECTION | OBJECT_REFRACTION,
+    OBJECT_REFLECTION | OBJECT_REFRACTION | OBJECT_FRESNEL,
+    OBJECT_REFLECTION | OBJECT_REFRACTION | OBJECT_DISPERSION,
+    OBJECT_REFLECTION | OBJECT_REFRACTION | OBJECT_FRESNEL |
+        OBJECT_DISPERSION};
+static const int materialCount = 8;
+
+// A cubemap with a different gradient on each face.
+static GLuint makeCubemap(int size) {
+  GLuint texture;
+  glGenTextures(1, &texture);
+  glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+  vector<unsigned char> pixels((size_t)size * size * 3);
+  for (int face = 0; face < 6; face++) {
+    for (int y = 0; y < size; y++)
+      for (int x = 0; x < size; x++) {
+        unsigned char *p = &pixels[((size_t)y * size + x) * 3];
+        p[0] = (unsigned char)(x * 255 / size);
+        p[1] = (unsigned char)(y * 255 / size);
+        p[2] = (unsigned char)(face * 40);
+      }
+    glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_RGB8, size,
+                 size, 0, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+  }
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+  return texture;
+}
+
+// A triangle over the whole viewport, normals spread so refraction and
+// reflection look up different texels per pixel.
+static GLuint makeTriangle() {
+  const float vertices[] = {-1, -1, 0, -0.8f, -0.8f, 1, 0, 0,
+                            3,  -1, 0, 2.4f,  -0.8f, 1, 0, 0,
+                            -1, 3,  0, -0.8f, 2.4f,  1, 0, 0};
+  GLuint vao, vbo;
+  glGenVertexArrays(1, &vao);
+  glBindVertexArray(vao);
+  glGenBuffers(1, &vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+  for (GLuint a = 0; a < 3; a++) {
+    glEnableVertexAttribArray(a);
+    glVertexAttribPointer(a, a == 2 ? 2 : 3, GL_FLOAT, GL_FALSE,
+                          8 * sizeof(float), (void *)(a * 3 * sizeof(float)));
+  }
+  return vao;
+}
+
+static void prepare(Shader &shader) {
+  shader.use();
+  shader.setInt("skybox", 0);
+  shader.setVec3("positionScale", glm::vec3(1.0f));
+  shader.setVec3("positionOffset", glm::vec3(0.0f));
+  shader.setBool("octNormals", false);
+}
+
+int main(int argc, char **argv) {
+  int size = 1024, drawCount = 64, frames = 20;
+  for (int i = 1; i + 1 < argc; i += 2) {
+    if (!strcmp(argv[i], "--size"))
+      size = max(16, atoi(argv[i + 1]));
+    else if (!strcmp(argv[i], "--draws"))
+      drawCount = max(1, atoi(argv[i + 1]));
+    else if (!strcmp(argv[i], "--frames"))
+      frames = max(1, atoi(argv[i + 1]));
+  }
+
+  if (!glfwInit())
+    return 1;
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+#ifdef __APPLE__
+  glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#endif
+  glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+  GLFWwindow *window = glfwCreateWindow(64, 64, "variant_bench", nullptr,
+                                        nullptr);
+  if (!window) {
+    cout << "ERROR::VARIANT_BENCH::NO_CONTEXT" << endl;
+    glfwTerminate();
+    return 1;
+  }
+  glfwMakeContextCurrent(window);
+  if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+    glfwTerminate();
+    return 1;
+  }
+
+  int status = 0;
+  {
+    GLuint framebuffer, color;
+    glGenFramebuffers(1, &framebuffer);
+    glGenRenderbuffers(1, &color);
+    glBindRenderbuffer(GL_RENDERBUFFER, color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, size, size);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                              GL_RENDERBUFFER, color);
+    glViewport(0, 0, size, size);
+    glActiveTexture(GL_TEXTURE0);
+    GLuint cubemap = makeCubemap(256);
+    GLuint triangle = makeTriangle();
+
+    Shader uber("shaders/main.vert", "shaders/main.frag");
+    bindUniformBlocks(uber);
+    ShaderVariants variants(
+        "shaders/main.vert", "shaders/main.frag",
+        vector<string>(OBJECT_FLAG_MACROS,
+                       OBJECT_FLAG_MACROS + OBJECT_FLAG_COUNT),
+        bindUniformBlocks);
+
+    FrameUniformBuffer frame;
+    FrameData f = {glm::mat4(1.0f), glm::mat4(1.0f),
+                   glm::vec4(0.0f, 0.0f, 2.0f, 1.0f)};
+    frame.upload(f);
+
+    // entries 0..7 are the materials alone, then the mixed scene
+    ObjectUniformBuffer draws;
+    for (int i = 0; i < materialCount + drawCount; i++) {
+      ObjectData d;
+      d.model = glm::mat4(1.0f);
+      d.refractiveIndex = 1.52f;
+      d.dispersionStrength = 0.02f;
+      d.fresnelBase = 0.04f;
+      d.flags = materials[i < materialCount ? i : (i - materialCount) %
+                                                      materialCount];
+      draws.add(d);
+    }
+    draws.upload();
+
+    // variant order of the mixed scene
+    vector<int> sorted(drawCount);
+    for (int i = 0; i < drawCount; i++)
+      sorted[i] = materialCount + i;
+    stable_sort(sorted.begin(), sorted.end(), [](int a, int b) {
+      return materials[(a - materialCount) % materialCount] <
+             materials[(b - materialCount) % materialCount];
+    });
+    for (int m = 0; m < materialCount; m++)
+      prepare(variants.get(shadingVariant(materials[m])));
+    prepare(uber);
+    if (variants.built() != (size_t)materialCount)
+      status = 1;
+
+    // median frame time of draw(), which submits one frame
+    auto time = [&](const function<void()> &draw) {
+      vector<double> times;
+      for (int f = 0; f < frames + 1; f++) {
+        glFinish();
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        draw();
+        glFinish();
+        if (f) // the first frame warms up
+          times.push_back(chrono::duration<double, milli>(
+                              chrono::steady_clock::now() - start)
+                              .count());
+      }
+      sort(times.begin(), times.end());
+      return times[times.size() / 2];
+    };
+
+    int switches = 0;
+    double uberMs = time([&]() {
+      uber.use();
+      for (int i = 0; i < drawCount; i++) {
+        draws.select(uber, materialCount + i);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+      }
+    });
+    double variantMs = time([&]() {
+      Shader *current = nullptr;
+      switches = 0;
+      for (int i = 0; i < drawCount; i++) {
+        Shader &program = variants.get(shadingVariant(
+            materials[(sorted[i] - materialCount) % materialCount]));
+        if (&program != current) {
+          program.use();
+          current = &program;
+          switches++;
+        }
+        draws.select(program, sorted[i]);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+      }
+    });
+
+    printf("%dx%d, %d draws, %d frames\n", size, size, drawCount, frames);
+    printf("  mixed scene: uber %.2f ms, variants %.2f ms (%d programs)\n",
+           uberMs, variantMs, switches);
+    printf("  %-6s %10s %10s\n", "flags", "uber ms", "variant ms");
+    for (int m = 0; m < materialCount; m++) {
+      Shader &variant = variants.get(shadingVariant(materials[m]));
+      double u = time([&]() {
+        uber.use();
+        draws.select(uber, m);
+        for (int i = 0; i < drawCount; i++)
+          glDrawArrays(GL_TRIANGLES, 0, 3);
+      });
+      double v = time([&]() {
+        variant.use();
+        draws.select(variant, m);
+        for (int i = 0; i < drawCount; i++)
+          glDrawArrays(GL_TRIANGLES, 0, 3);
+      });
+      // R reflection, T refraction, F Fresnel, D dispersion
+      char label[5] = "----";
+      for (int b = 0; b < 4; b++)
+        if (materials[m] & (1 << b))
+          label[b] = "RTFD"[b];
+      printf("  %-6s %10.2f %10.2f\n", label, u, v);
+    }
+
+    glDeleteTextures(1, &cubemap);
+    glDeleteVertexArrays(1, &triangle);
+    glDeleteRenderbuffers(1, &color);
+    glDeleteFramebuffers(1, &framebuffer);
+  }
+
+  glfwDestroyWindow(window);
+  glfwTerminate();
+  return status;
+}